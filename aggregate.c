@@ -15,6 +15,11 @@
 #include <beato/random_coord.h>
 #include "bwtool.h"
 #include "bwtool_shared.h"
+#include "blockcache.h"
+#include "prefetch.h"
+#include "kmeans.h"
+#include "profile.h"
+#include "memtrack.h"
 #include <beato/cluster.h>
 #include <beato/stuff.h>
 
@@ -51,6 +56,16 @@ errAbort(
   "   -header          useful particularly with the -expanded option to have a\n"
   "                    reminder of what column is what.\n"
   "   -cluster=k       cluster with k-means with given parameter (2-10 are best)\n"
+  "   -seed=s          seed for picking the starting centroids (default 0)\n"
+  "   -cluster-max-iter=n\n"
+  "                    stop k-means after n iterations (default 300)\n"
+  "   -cluster-reduce=paa:n or random:n\n"
+  "                    shorten the rows to n values before clustering, with\n"
+  "                    piecewise aggregate approximation (segment means) or a\n"
+  "                    random projection.  The output rows are still full length.\n"
+  "   -cluster-mini-batch=b\n"
+  "                    do mini-batch k-means with random batches of b regions\n"
+  "   -threads=n       cluster using n threads\n"
   "   -cluster-sets=file.bed\n"
   "                    write out the original bed with the cluster label along\n"
   "                    with the accompanying region used for the clustering\n"
@@ -79,6 +94,12 @@ struct agg_data
     double **data;
 };
 
+static size_t agg_data_size(struct agg_data *agg)
+/* bytes the table of results takes */
+{
+    return (size_t)agg->nrow * (sizeof(int) + sizeof(double *) + (size_t)agg->ncol * sizeof(double));
+}
+
 struct agg_data *init_agg_data(int left, int right, int meta, boolean firstbase, boolean nozero, int num_firsts,
 			       int num_seconds, boolean expanded, struct slName *lf_labels)
 /* init the output struct */
@@ -120,6 +141,7 @@ struct agg_data *init_agg_data(int left, int right, int meta, boolean firstbase,
 	    agg->second_names[i-num_firsts] = cloneString(name->name);
 	i++;
     }
+    memTrackAdd(mem_agg, agg_data_size(agg));
     return agg;
 }
 
@@ -128,6 +150,7 @@ void free_agg_data(struct agg_data **pAgg)
 {
     struct agg_data *agg = *pAgg;
     int i;
+    memTrackSub(mem_agg, agg_data_size(agg));
     for (i = 0; i < agg->nrow; i++)
 	freeMem(agg->data[i]);
     freeMem(agg->data);
@@ -138,40 +161,53 @@ void free_agg_data(struct agg_data **pAgg)
 }
 
 void do_summary(struct perBaseMatrix *pbm, struct agg_data *agg, boolean expanded, int offset)
-/* calculate mean, median, sd */
+/* calculate mean, median, sd.  the sums go through the matrix a row at a time so the */
+/* inner loops run along contiguous data without branches and can be vectorized. */
+/* the values of a column are only gathered together for the median. */
 {
     const double na = NANUM;
+    int ncol = agg->nrow;
     int i, j;
-    double *one_pbm_col;
-    AllocArray(one_pbm_col, pbm->nrow);
-    for (i = 0; i < agg->nrow; i++)
+    unsigned long long prof_start = PROFILE_START();
+    int *sizes;
+    double *sums, *means, *sqs;
+    AllocArray(sizes, ncol);
+    AllocArray(sums, ncol);
+    AllocArray(means, ncol);
+    AllocArray(sqs, ncol);
+    for (j = 0; j < pbm->nrow; j++)
+    {
+	const double *row = pbm->matrix[j];
+	for (i = 0; i < ncol; i++)
+	{
+	    double v = row[i];
+	    int ok = (v == v);
+	    sizes[i] += ok;
+	    sums[i] += (ok) ? v : 0;
+	}
+    }
+    for (i = 0; i < ncol; i++)
+	means[i] = (sizes[i] > 0) ? sums[i]/sizes[i] : 0;
+    for (j = 0; j < pbm->nrow; j++)
+    {
+	const double *row = pbm->matrix[j];
+	for (i = 0; i < ncol; i++)
+	{
+	    double d = row[i] - means[i];
+	    sqs[i] += (d == d) ? d*d : 0;
+	}
+    }
+    for (i = 0; i < ncol; i++)
     {
-	int size = 0;
-	double sum = 0;
-	double mean = 0;
-	double sd = 0;
-	for (j = 0; j < pbm->nrow; j++)
-	    if (!isnan(pbm->matrix[j][i]))
-		one_pbm_col[size++] = pbm->matrix[j][i];
+	int size = sizes[i];
 	if (size > 0)
 	{
-	    for (j = 0; j < size; j++)
-		sum += one_pbm_col[j];
-	    mean = sum/size;
-	    sum = 0;
-	    for (j = 0; j < size; j++)
-		sum += pow(one_pbm_col[j] - mean,2);
-	    if (size > 1)
-		sd = sqrt(sum/(size-1));
-	    else
-		sd = na;
-	    agg->data[i][offset] = mean;
+	    agg->data[i][offset] = means[i];
 	    if (expanded)
 	    {
-		agg->data[i][offset+1] = doubleMedian(size, one_pbm_col);
-		agg->data[i][offset+2] = sd;
+		agg->data[i][offset+2] = (size > 1) ? sqrt(sqs[i]/(size-1)) : na;
 		agg->data[i][offset+3] = (double)size;
-		agg->data[i][offset+4] = sum;
+		agg->data[i][offset+4] = sqs[i];
 	    }
 	}
 	else
@@ -186,7 +222,27 @@ void do_summary(struct perBaseMatrix *pbm, struct agg_data *agg, boolean expande
 	    }
 	}
     }
-    freeMem(one_pbm_col);
+    if (expanded)
+    {
+	double *one_pbm_col;
+	AllocArray(one_pbm_col, pbm->nrow);
+	for (i = 0; i < ncol; i++)
+	{
+	    int size = 0;
+	    if (sizes[i] == 0)
+		continue;
+	    for (j = 0; j < pbm->nrow; j++)
+		if (!isnan(pbm->matrix[j][i]))
+		    one_pbm_col[size++] = pbm->matrix[j][i];
+	    agg->data[i][offset+1] = doubleMedian(size, one_pbm_col);
+	}
+	freeMem(one_pbm_col);
+    }
+    freeMem(sizes);
+    freeMem(sums);
+    freeMem(means);
+    freeMem(sqs);
+    PROFILE_STOP(prof_stats, prof_start);
 }
 
 void copy_centroids(struct cluster_bed_matrix *cbm, struct agg_data *agg)
@@ -239,6 +295,7 @@ void output_agg_data(FILE *out, boolean expanded, boolean header, struct agg_dat
 {
     int i, j, k, l;
     char buf[LONG_NUMBER];
+    unsigned long long prof_start = PROFILE_START();
     if (long_form)
     /* currently there is no expanded form here */
     {
@@ -319,13 +376,14 @@ void output_agg_data(FILE *out, boolean expanded, boolean header, struct agg_dat
 	    }
 	}
     }
+    PROFILE_STOP(prof_format, prof_start);
 }
 
 void output_cluster_sets(struct cluster_bed_matrix *cbm, char *cluster_sets)
 /* Output original bed6, followed by the cluster label, followed by the modified bed6 */
 /* indicating the region used in clustering */
 {
-    FILE *out = mustOpen(cluster_sets, "w");
+    FILE *out = mustOpen_tracked(cluster_sets, "w");
     struct perBaseMatrix *pbm = cbm->pbm;
     int i;
     for (i = 0; i < pbm->nrow; i++)
@@ -337,7 +395,7 @@ void output_cluster_sets(struct cluster_bed_matrix *cbm, char *cluster_sets)
 		pbw->label, pbw->chrom, pbw->chromStart, pbw->chromEnd, pbw->name, pbw->score,
 		pbw->strand[0]);
     }
-    carefulClose(&out);
+    carefulClose_tracked(&out);
 }
 
 static struct slName *setup_labels(char *long_form, boolean clustering, int k, struct slName *region_list, struct slName *wig_list,
@@ -414,6 +472,7 @@ void bwtool_aggregate(struct hash *options, char *regions, unsigned decimals, do
 {
     unsigned left = 0, right = 0;
     struct slName *region_list = slNameListFromComma(region_list_s);
+    int prefetch = get_prefetch_connections(options);
     struct slName *wig_list = slNameListFromComma(wig);
     boolean firstbase = (hashFindVal(options, "firstbase") != NULL) ? TRUE : FALSE;
     boolean nozero = TRUE;
@@ -439,8 +498,8 @@ void bwtool_aggregate(struct hash *options, char *regions, unsigned decimals, do
     boolean do_meta = (num_parse == 3);
     if (use_start && use_end)
 	errAbort("cannot specify both -starts and -ends");
-    if ((clustering) && ((k < 2) || (k > 10)))
-	errAbort("k should be between 2 and 10\n");
+    if ((clustering) && (k < 2))
+	errAbort("k should be at least 2\n");
     if ((mult_regions || mult_wigs) && clustering)
 	errAbort("with clustering just specify one region list and one bigWig");
     if (do_meta && clustering)
@@ -452,13 +511,12 @@ void bwtool_aggregate(struct hash *options, char *regions, unsigned decimals, do
     if (mult_regions && mult_wigs)
 	do_long_form = TRUE;
     lf_labels = setup_labels(long_form, clustering, k, region_list, wig_list, &lf_labels_b, &lf_labels_w);
-    output = mustOpen(output_file, "w");
+    output = mustOpen_tracked(output_file, "w");
     if (!clustering)
     {
 	int num_regions = slCount(region_list);
 	int num_wigs = slCount(wig_list);
 	struct slName *reg;
-	struct slName *wig_name;
 	struct agg_data *agg = NULL;
 	struct metaBig *mbList = NULL;
 	struct metaBig *mb;
@@ -469,86 +527,91 @@ void bwtool_aggregate(struct hash *options, char *regions, unsigned decimals, do
 	    fprintf(stderr, "calculated meta = %d bases\n", meta);
 	}
 	agg = init_agg_data(left, right, meta, firstbase, nozero, num_regions, num_wigs, expanded, lf_labels);
-	for (wig_name = wig_list; wig_name != NULL; wig_name = wig_name->next)
-	{
-	    mb = metaBigOpenWithTmpDir(wig_name->name, tmp_dir, NULL);
-	    if (mb == NULL)
-	        errAbort("ERROR: Problem opening one of the bigWigs. Check that your arguments are in the correct order.");
-	    slAddHead(&mbList, mb);
-	}
-	slReverse(&mbList);
+	mbList = metaBigOpenList(wig_list, tmp_dir, NULL, NULL);
 	int offset = 0;
 	if (!do_meta)
 	{
 	    for (reg = region_list; reg != NULL; reg = reg->next)
 	    {
 		struct bed6 *regions = load_and_recalculate_coords(reg->name, left, right, firstbase, use_start, use_end);
+		size_t regions_size = bed6ListSize(regions);
 		struct slName *wig_name;
+		memTrackAdd(mem_beds, regions_size);
 		for (mb = mbList; mb != NULL; mb = mb->next)
 		{
-		    struct perBaseMatrix *pbm = load_perBaseMatrix(mb, regions, fill);
+		    struct perBaseMatrix *pbm;
+		    prefetch_regions(mb, regions, 0, tmp_dir, prefetch);
+		    pbm = load_perBaseMatrix_cached(mb, regions, fill);
+		    memTrackAdd(mem_pbm, perBaseMatrixSize(pbm));
 		    do_summary(pbm, agg, expanded, offset);
 		    offset += (expanded) ? NUM_EXPANDED : 1;
+		    memTrackSub(mem_pbm, perBaseMatrixSize(pbm));
 		    free_perBaseMatrix(&pbm);
 		}
 		bed6FreeList(&regions);
+		memTrackSub(mem_beds, regions_size);
 	    }
 	}
 	else
-	/* the meta will be a fusion of three matrices */
+	/* each row is upstream, meta, and downstream from one fetch */
 	{
 	    for (reg = region_list; reg != NULL; reg = reg->next)
 	    {
-		struct bed6 *regions_left = load_and_recalculate_coords(reg->name, left, 0, FALSE, TRUE, FALSE);
-		struct bed6 *regions_right = load_and_recalculate_coords(reg->name, 0, right, FALSE, FALSE, TRUE);
-		struct bed6 *regions_meta = (meta > 0) ? readBed6Soft(reg->name) : NULL;
-		struct slName *wig_name;
+		struct bed6 *regions = readBed6Soft_cached(reg->name);
+		size_t regions_size = bed6ListSize(regions);
+		memTrackAdd(mem_beds, regions_size);
 		for (mb = mbList; mb != NULL; mb = mb->next)
 		{
-		    struct perBaseMatrix *pbm = load_perBaseMatrix(mb, regions_left, fill);
-		    struct perBaseMatrix *right_pbm = load_perBaseMatrix(mb, regions_right, fill);
-		    if (meta > 0)
-		    {
-			struct perBaseMatrix *meta_pbm = load_meta_perBaseMatrix(mb, regions_meta, meta, fill);
-			fuse_pbm(&pbm, &meta_pbm, TRUE);
-		    }
-		    fuse_pbm(&pbm, &right_pbm, TRUE);
+		    struct perBaseMatrix *pbm;
+		    prefetch_regions(mb, regions, (left > right) ? left : right, tmp_dir, prefetch);
+		    pbm = load_meta_span_perBaseMatrix(mb, regions, left, meta, right, fill);
+		    memTrackAdd(mem_pbm, perBaseMatrixSize(pbm));
 		    do_summary(pbm, agg, expanded, offset);
 		    offset += (expanded) ? NUM_EXPANDED : 1;
+		    memTrackSub(mem_pbm, perBaseMatrixSize(pbm));
 		    free_perBaseMatrix(&pbm);
 		}
-		bed6FreeList(&regions_left);
-		bed6FreeList(&regions_right);
-		if (meta > 0)
-		    bed6FreeList(&regions_meta);
+		bed6FreeList(&regions);
+		memTrackSub(mem_beds, regions_size);
 	    }
 	}
 	while ((mb = slPopHead(&mbList)) != NULL)
-	    metaBigClose(&mb);
+	    metaBigRelease(&mb);
     	output_agg_data(output, expanded, header, agg, do_long_form);
 	free_agg_data(&agg);
     }
     else
     {
 	struct agg_data *agg = init_agg_data(left, right, 0, firstbase, nozero, 1, k, FALSE, lf_labels);
-	struct metaBig *mb = metaBigOpenWithTmpDir(wig_list->name, tmp_dir, NULL);
+	struct metaBig *mb = metaBigOpen_cached(wig_list->name, tmp_dir, NULL);
 	struct bed6 *regions = load_and_recalculate_coords(region_list->name, left, right, firstbase, use_start, use_end);
-	struct bed6 *orig_regions = readBed6Soft(region_list->name);
-	struct perBaseMatrix *pbm = load_perBaseMatrix(mb, regions, fill);
+	struct bed6 *orig_regions = readBed6Soft_cached(region_list->name);
+	size_t regions_size = bed6ListSize(regions) + bed6ListSize(orig_regions);
+	memTrackAdd(mem_beds, regions_size);
+	memTrackNeed(matrixSize(slCount(regions), (regions) ? regions->chromEnd - regions->chromStart : 0),
+		     "the matrix to cluster");
+	prefetch_regions(mb, regions, 0, tmp_dir, prefetch);
+	struct perBaseMatrix *pbm = load_perBaseMatrix_cached(mb, regions, fill);
+	size_t pbm_size = perBaseMatrixSize(pbm);
+	memTrackAdd(mem_pbm, pbm_size);
 	if (cluster_sets)
 	    perBaseMatrixAddOrigRegions(pbm, orig_regions);
+	struct kmeans_params params;
+	kmeans_params_from_options(options, k, &params);
 	struct cluster_bed_matrix *cbm = init_cbm_from_pbm(pbm, k);
-	do_kmeans_sort(cbm, 0.001, TRUE);
+	kmeans_cluster_cbm(cbm, &params);
 	copy_centroids(cbm, agg);
 	output_agg_data(output, FALSE, FALSE, agg, do_long_form);
 	if (cluster_sets)
 	    output_cluster_sets(cbm, cluster_sets);
 	free_cbm(&cbm);
-	metaBigClose(&mb);
+	memTrackSub(mem_pbm, pbm_size);
+	metaBigRelease(&mb);
 	bed6FreeList(&regions);
+	memTrackSub(mem_beds, regions_size);
 	free_agg_data(&agg);
     }
-    carefulClose(&output);
+    carefulClose_tracked(&output);
     slNameFreeList(&lf_labels);
     slNameFreeList(&region_list);
     slNameFreeList(&wig_list);
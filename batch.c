@@ -0,0 +1,349 @@
+/* bwtool_batch - run a file of bwtool commands in one process */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <jkweb/common.h>
+#include <jkweb/linefile.h>
+#include <jkweb/hash.h>
+#include <jkweb/options.h>
+#include <jkweb/sqlNum.h>
+#include <beato/bigs.h>
+#include "bwtool.h"
+#include "bwtool_shared.h"
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/* open bigWigs each worker keeps */
+#define BATCH_CACHE_SIZE 64
+
+void usage_batch()
+/* Explain usage and exit. */
+{
+errAbort(
+  "bwtool batch - run a list of bwtool commands in one go, sharing open bigWigs\n"
+  "   and parsed bed files between them\n"
+  "usage:\n"
+  "   bwtool batch jobs.txt\n"
+  "where jobs.txt has one command per line, as it would be given to bwtool\n"
+  "(with or without the \"bwtool\" in front).  Blank lines and lines starting\n"
+  "with # are skipped.  A line with just \"wait\" makes the commands after it\n"
+  "wait for all those before it, e.g. when one makes a bigWig another reads.\n"
+  "Standard output of the commands comes out in the order of the file.\n"
+  "options:\n"
+  "   -workers=n       run up to n commands at once (default 1)\n"
+  "   -keep-going      run the rest of the commands after one fails\n"
+  );
+}
+
+struct batch_job
+/* one line of the jobs file */
+{
+    struct batch_job *next;
+    int line;
+    char *command;
+    boolean wait;               /* A barrier, not a command. */
+    int status;
+    boolean done;
+};
+
+static struct batch_job *read_jobs(char *jobs_file)
+/* the commands and barriers in the order in the file */
+{
+    struct lineFile *lf = lineFileOpen(jobs_file, TRUE);
+    struct batch_job *list = NULL;
+    char *line;
+    while (lineFileNextReal(lf, &line))
+    {
+	struct batch_job *job;
+	AllocVar(job);
+	job->line = lf->lineIx;
+	job->wait = sameString(trimSpaces(line), "wait");
+	job->command = cloneString(line);
+	slAddHead(&list, job);
+    }
+    lineFileClose(&lf);
+    slReverse(&list);
+    return list;
+}
+
+static int run_job(struct batch_job *job)
+/* split the line up like a shell would (double quotes only) and run it */
+{
+    char *line = cloneString(job->command);
+    int num_words = chopByWhiteRespectDoubleQuotes(line, NULL, 0);
+    char **words;
+    char **argv;
+    int argc = num_words + 1;
+    int status;
+    AllocArray(words, num_words + 2);
+    words[0] = "bwtool";
+    chopByWhiteRespectDoubleQuotes(line, words + 1, num_words);
+    argv = words;
+    /* the "bwtool" in front is optional */
+    if ((argc > 1) && sameString(argv[1], "bwtool"))
+    {
+	argv++;
+	argc--;
+    }
+    if ((argc > 1) && (sameString(argv[1], "batch") || sameString(argv[1], "serve")))
+    {
+	fprintf(stderr, "can't run %s from a batch\n", argv[1]);
+	status = 1;
+    }
+    else
+	status = bwtool_run_catching(argc, argv);
+    fflush(stdout);
+    fflush(stderr);
+    freeMem(words);
+    freeMem(line);
+    return status;
+}
+
+static void report_failure(struct batch_job *job, char *jobs_file)
+/* the command's own error is already out, this says which line it was */
+{
+    fprintf(stderr, "%s line %d failed: %s\n", jobs_file, job->line, job->command);
+}
+
+static int batch_serial(struct batch_job *jobs, char *jobs_file, boolean keep_going)
+/* run the jobs one after the other in this process.  returns the number that failed */
+{
+    struct batch_job *job;
+    int failed = 0;
+    for (job = jobs; job != NULL; job = job->next)
+    {
+	if (job->wait)
+	    continue;
+	job->status = run_job(job);
+	job->done = TRUE;
+	if (job->status != 0)
+	{
+	    report_failure(job, jobs_file);
+	    failed++;
+	    if (!keep_going)
+		break;
+	}
+    }
+    return failed;
+}
+
+/* with more than one worker, the workers are forked copies of this process that */
+/* each keep their own cache and take jobs one at a time over a socket: */
+/* the job's index and back the job's status.  each job's stdout goes to its own */
+/* file in the tmp dir, copied to our stdout in job order as the jobs finish */
+
+struct batch_worker
+/* a forked worker and what it's doing */
+{
+    pid_t pid;
+    int sock;
+    int job_ix;                 /* -1 when idle. */
+};
+
+static char *job_output_name(char *out_dir, int job_ix)
+/* where a job's stdout goes */
+{
+    char name[PATH_LEN];
+    safef(name, sizeof(name), "%s/bwtool-batch-%d-%d.out", out_dir, (int)getpid(), job_ix);
+    return cloneString(name);
+}
+
+static void worker_loop(int sock, struct batch_job **job_array, char **out_names)
+/* in the worker: run jobs until told to stop (index -1) */
+{
+    int32_t job_ix;
+    while ((read(sock, &job_ix, sizeof(job_ix)) == sizeof(job_ix)) && (job_ix >= 0))
+    {
+	int32_t status;
+	FILE *out = freopen(out_names[job_ix], "w", stdout);
+	if (out == NULL)
+	{
+	    fprintf(stderr, "couldn't write %s\n", out_names[job_ix]);
+	    status = 1;
+	}
+	else
+	    status = run_job(job_array[job_ix]);
+	if (write(sock, &status, sizeof(status)) != sizeof(status))
+	    break;
+    }
+    _exit(0);
+}
+
+static void copy_output(char *name)
+/* copy a finished job's stdout to ours and remove it */
+{
+    FILE *f = fopen(name, "r");
+    if (f)
+    {
+	char buf[65536];
+	size_t got;
+	while ((got = fread(buf, 1, sizeof(buf), f)) > 0)
+	    mustWrite(stdout, buf, got);
+	fclose(f);
+    }
+    remove(name);
+}
+
+static int batch_parallel(struct batch_job *jobs, char *jobs_file, boolean keep_going, int num_workers,
+			  char *out_dir)
+/* hand the jobs out to num_workers forked workers.  returns the number that failed */
+{
+    int num_jobs = slCount(jobs);
+    struct batch_job **job_array;
+    struct batch_worker *workers;
+    char **out_names;
+    struct batch_job *job;
+    int next_job = 0, next_output = 0, running = 0, failed = 0;
+    boolean stopping = FALSE;
+    int i;
+    AllocArray(job_array, num_jobs);
+    AllocArray(out_names, num_jobs);
+    for (job = jobs, i = 0; job != NULL; job = job->next, i++)
+    {
+	job_array[i] = job;
+	out_names[i] = (job->wait) ? NULL : job_output_name(out_dir, i);
+    }
+    AllocArray(workers, num_workers);
+    fflush(stdout);
+    fflush(stderr);
+    for (i = 0; i < num_workers; i++)
+    {
+	int pair[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0)
+	    errnoAbort("couldn't make a socket for worker %d", i);
+	workers[i].pid = fork();
+	if (workers[i].pid < 0)
+	    errnoAbort("couldn't start worker %d", i);
+	if (workers[i].pid == 0)
+	{
+	    int j;
+	    close(pair[0]);
+	    for (j = 0; j < i; j++)
+		close(workers[j].sock);
+	    worker_loop(pair[1], job_array, out_names);
+	}
+	close(pair[1]);
+	workers[i].sock = pair[0];
+	workers[i].job_ix = -1;
+    }
+    while ((next_output < num_jobs) && !(stopping && (running == 0)))
+    {
+	struct pollfd *fds;
+	int num_fds = 0;
+	/* hand out jobs to the idle workers up to the next barrier, which is passed */
+	/* once everything before it is finished */
+	for (i = 0; (i < num_workers) && !stopping; i++)
+	{
+	    int32_t ix;
+	    if (workers[i].job_ix >= 0)
+		continue;
+	    while ((next_job < num_jobs) && job_array[next_job]->wait && (running == 0))
+		job_array[next_job++]->done = TRUE;
+	    if ((next_job >= num_jobs) || job_array[next_job]->wait)
+		break;
+	    ix = next_job++;
+	    if (write(workers[i].sock, &ix, sizeof(ix)) != sizeof(ix))
+		errnoAbort("lost worker %d", i);
+	    workers[i].job_ix = ix;
+	    running++;
+	}
+	/* copy out what's finished, in order */
+	while ((next_output < num_jobs) && job_array[next_output]->done)
+	{
+	    if (out_names[next_output])
+		copy_output(out_names[next_output]);
+	    next_output++;
+	}
+	if (running == 0)
+	    continue;
+	AllocArray(fds, num_workers);
+	for (i = 0; i < num_workers; i++)
+	    if (workers[i].job_ix >= 0)
+	    {
+		fds[num_fds].fd = workers[i].sock;
+		fds[num_fds].events = POLLIN;
+		num_fds++;
+	    }
+	if (poll(fds, num_fds, -1) < 0)
+	    errnoAbort("waiting on the workers");
+	freeMem(fds);
+	for (i = 0; i < num_workers; i++)
+	{
+	    struct pollfd one;
+	    int32_t status;
+	    if (workers[i].job_ix < 0)
+		continue;
+	    one.fd = workers[i].sock;
+	    one.events = POLLIN;
+	    if (poll(&one, 1, 0) <= 0)
+		continue;
+	    job = job_array[workers[i].job_ix];
+	    if (read(workers[i].sock, &status, sizeof(status)) != sizeof(status))
+		errAbort("worker %d died running %s line %d", i, jobs_file, job->line);
+	    job->status = status;
+	    job->done = TRUE;
+	    workers[i].job_ix = -1;
+	    running--;
+	    if (status != 0)
+	    {
+		report_failure(job, jobs_file);
+		failed++;
+		if (!keep_going)
+		    stopping = TRUE;
+	    }
+	}
+    }
+    /* after a failure, what's finished is still copied out, in order */
+    while ((next_output < num_jobs) && job_array[next_output]->done)
+    {
+	if (out_names[next_output])
+	    copy_output(out_names[next_output]);
+	next_output++;
+    }
+    for (i = 0; i < num_workers; i++)
+    {
+	int32_t stop = -1;
+	if (write(workers[i].sock, &stop, sizeof(stop)) != sizeof(stop))
+	    warn("couldn't stop worker %d", i);
+	close(workers[i].sock);
+	waitpid(workers[i].pid, NULL, 0);
+    }
+    for (i = 0; i < num_jobs; i++)
+	freeMem(out_names[i]);
+    freeMem(out_names);
+    freeMem(job_array);
+    freeMem(workers);
+    return failed;
+}
+
+void bwtool_batch(struct hash *options, char *tmp_dir, char *jobs_file)
+/* bwtool_batch - main for running a file of commands */
+{
+    int num_workers = (int)sqlUnsigned((char *)hashOptionalVal(options, "workers", "1"));
+    boolean keep_going = (hashFindVal(options, "keep-going") != NULL) ? TRUE : FALSE;
+    struct batch_job *jobs = read_jobs(jobs_file);
+    int failed;
+    if (num_workers < 1)
+	errAbort("-workers should be at least 1");
+    metaBigCacheEnable(BATCH_CACHE_SIZE);
+    bedCacheEnable(TRUE);
+    if (num_workers == 1)
+	failed = batch_serial(jobs, jobs_file, keep_going);
+    else
+	failed = batch_parallel(jobs, jobs_file, keep_going, num_workers, (tmp_dir) ? tmp_dir : "/tmp");
+    metaBigCacheEnable(0);
+    bedCacheEnable(FALSE);
+    while (jobs)
+    {
+	struct batch_job *job = slPopHead(&jobs);
+	freeMem(job->command);
+	freeMem(job);
+    }
+    if (failed > 0)
+	errAbort("%d command%s in %s failed", failed, (failed > 1) ? "s" : "", jobs_file);
+}
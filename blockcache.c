@@ -0,0 +1,556 @@
+/* a cache of inflated bigWig data blocks shared by the region loaders */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <jkweb/common.h>
+#include <jkweb/hash.h>
+#include <jkweb/dlist.h>
+#include <jkweb/dystring.h>
+#include <jkweb/sqlNum.h>
+#include <jkweb/udc.h>
+#include <jkweb/zlibFace.h>
+#include <jkweb/bbiFile.h>
+#include <jkweb/bigWig.h>
+#include <jkweb/bwgInternal.h>
+#include <beato/bigs.h>
+#include "blockcache.h"
+#include "profile.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+struct cached_block
+/* one inflated data block */
+{
+    char *key;                  /* File and offset of the block. */
+    char *data;
+    size_t size;
+    int refs;                   /* Queries decoding it right now. */
+    boolean dropped;            /* Out of the cache, freed when the last ref goes. */
+    struct dlNode *node;        /* Place in the LRU list, head most recent. */
+};
+
+static pthread_mutex_t block_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hash *block_hash = NULL;
+static struct dlList *block_lru = NULL;
+static size_t block_cache_max = (size_t)BLOCK_CACHE_MB << 20;
+static struct block_cache_stats block_stats;
+
+/* local files mapped at once */
+#define LOCAL_MAP_MAX 64
+
+struct local_map
+/* a local bigWig mapped into memory, so its data blocks are read without udc */
+{
+    struct local_map *next;
+    char *prefix;               /* Same as the blocks' key prefix. */
+    char *base;
+    size_t size;
+    int refs;
+    unsigned long last_used;
+};
+
+static struct local_map *local_maps = NULL;
+static unsigned long local_map_clock = 0;
+static boolean mmap_off = FALSE;
+
+void blockCacheSetup(struct hash *options)
+/* size the cache from -block-cache=MB (0 turns it off) and see if -no-mmap is given */
+{
+    char *mb_s = (char *)hashFindVal(options, "block-cache");
+    if (mb_s)
+	blockCacheSetSize((size_t)sqlUnsigned(mb_s) << 20);
+    mmap_off = (hashFindVal(options, "no-mmap") != NULL) ? TRUE : FALSE;
+}
+
+static void cached_block_free(struct cached_block **pBlock)
+/* free a block no longer in the cache or in use */
+{
+    struct cached_block *block = *pBlock;
+    if (block)
+    {
+	freeMem(block->key);
+	freeMem(block->data);
+	freez(pBlock);
+    }
+}
+
+static void drop_block(struct cached_block *block)
+/* with the lock held, take a block out of the cache.  it's freed now or when the */
+/* last query using it lets go */
+{
+    hashRemove(block_hash, block->key);
+    dlRemove(block->node);
+    freez(&block->node);
+    block_stats.bytes_cached -= block->size;
+    block->dropped = TRUE;
+    if (block->refs == 0)
+	cached_block_free(&block);
+}
+
+static void trim_cache()
+/* with the lock held, drop least recently used blocks until it fits */
+{
+    struct dlNode *node = (block_lru) ? block_lru->tail : NULL;
+    while ((block_stats.bytes_cached > block_cache_max) && (node != NULL) && !dlStart(node))
+    {
+	struct dlNode *prev = node->prev;
+	drop_block((struct cached_block *)node->val);
+	block_stats.evictions++;
+	node = prev;
+    }
+}
+
+void blockCacheSetSize(size_t max_bytes)
+/* keep up to max_bytes of inflated blocks, dropping the least recently used */
+/* ones if there's more than that already */
+{
+    pthread_mutex_lock(&block_cache_lock);
+    block_cache_max = max_bytes;
+    trim_cache();
+    pthread_mutex_unlock(&block_cache_lock);
+}
+
+void blockCacheGetStats(struct block_cache_stats *stats)
+/* a copy of the counters */
+{
+    pthread_mutex_lock(&block_cache_lock);
+    *stats = block_stats;
+    pthread_mutex_unlock(&block_cache_lock);
+}
+
+void blockCacheReport(FILE *f)
+/* print the hit rate and sizes in one line */
+{
+    struct block_cache_stats stats;
+    unsigned long lookups;
+    blockCacheGetStats(&stats);
+    lookups = stats.hits + stats.misses;
+    fprintf(f, "block cache: %lu lookups, %lu hits (%.1f%%), %lu evicted, %llu bytes read, "
+	    "%llu bytes mapped, %llu bytes inflated, %lu bytes cached\n", lookups, stats.hits,
+	    (lookups > 0) ? 100.0 * stats.hits / lookups : 0.0, stats.evictions, stats.bytes_read,
+	    stats.bytes_mapped, stats.bytes_inflated, (unsigned long)stats.bytes_cached);
+}
+
+void blockCacheFree()
+/* drop everything in the cache that isn't in use */
+{
+    pthread_mutex_lock(&block_cache_lock);
+    if (block_lru)
+    {
+	struct dlNode *node = block_lru->head;
+	while (!dlEnd(node))
+	{
+	    struct dlNode *next = node->next;
+	    drop_block((struct cached_block *)node->val);
+	    node = next;
+	}
+    }
+    pthread_mutex_unlock(&block_cache_lock);
+}
+
+static struct cached_block *get_block(char *key)
+/* the block if it's cached, with a ref taken */
+{
+    struct cached_block *block = NULL;
+    pthread_mutex_lock(&block_cache_lock);
+    if (block_hash == NULL)
+    {
+	block_hash = hashNew(16);
+	block_lru = dlListNew();
+    }
+    block = (struct cached_block *)hashFindVal(block_hash, key);
+    if (block)
+    {
+	block->refs++;
+	dlRemove(block->node);
+	dlAddHead(block_lru, block->node);
+	block_stats.hits++;
+    }
+    else
+	block_stats.misses++;
+    pthread_mutex_unlock(&block_cache_lock);
+    return block;
+}
+
+static struct cached_block *add_block(char *key, char *data, size_t size)
+/* put a freshly inflated block in the cache (taking over data) and return it with */
+/* a ref taken.  if another thread beat us to it, theirs is returned instead */
+{
+    struct cached_block *block;
+    pthread_mutex_lock(&block_cache_lock);
+    block = (struct cached_block *)hashFindVal(block_hash, key);
+    if (block)
+    {
+	block->refs++;
+	freeMem(data);
+    }
+    else
+    {
+	AllocVar(block);
+	block->key = cloneString(key);
+	block->data = data;
+	block->size = size;
+	block->refs = 1;
+	if (size <= block_cache_max)
+	{
+	    AllocVar(block->node);
+	    block->node->val = block;
+	    dlAddHead(block_lru, block->node);
+	    hashAdd(block_hash, key, block);
+	    block_stats.bytes_cached += size;
+	    trim_cache();
+	}
+	else
+	    /* too big to keep (or the cache is off): just for this query */
+	    block->dropped = TRUE;
+    }
+    pthread_mutex_unlock(&block_cache_lock);
+    return block;
+}
+
+static void release_block(struct cached_block *block)
+/* let go of the ref from get_block() or add_block() */
+{
+    pthread_mutex_lock(&block_cache_lock);
+    block->refs--;
+    if (block->dropped && (block->refs == 0))
+	cached_block_free(&block);
+    pthread_mutex_unlock(&block_cache_lock);
+}
+
+static void decode_block(struct cached_block *block, boolean isSwapped, bits32 start, bits32 end, double *data)
+/* write the values of a block that fall in start-end into data (indexed from start) */
+{
+    char *pt = block->data;
+    struct bwgSectionHead head;
+    bits32 s, e;
+    float val;
+    int i;
+    bwgSectionHeadFromMem(&pt, &head, isSwapped);
+    for (i = 0; i < head.itemCount; i++)
+    {
+	switch (head.type)
+	{
+	    case bwgTypeBedGraph:
+		s = memReadBits32(&pt, isSwapped);
+		e = memReadBits32(&pt, isSwapped);
+		break;
+	    case bwgTypeVariableStep:
+		s = memReadBits32(&pt, isSwapped);
+		e = s + head.itemSpan;
+		break;
+	    case bwgTypeFixedStep:
+		s = head.start + i * head.itemStep;
+		e = s + head.itemSpan;
+		break;
+	    default:
+		errAbort("unknown bigWig section type %d", head.type);
+		return;
+	}
+	val = memReadFloat(&pt, isSwapped);
+	if (s < start)
+	    s = start;
+	if (e > end)
+	    e = end;
+	for (; s < e; s++)
+	    data[s - start] = val;
+    }
+}
+
+static char *block_key_prefix(char *file_name, off_t *pLocalSize)
+/* blocks are keyed by the file's absolute name and, for local files, its */
+/* modification time and size so a rewritten file doesn't get old blocks.  */
+/* *pLocalSize is the size of a local regular file, otherwise 0 */
+{
+    struct dyString *prefix = dyStringNew(0);
+    struct stat st;
+    *pLocalSize = 0;
+    if (stat(file_name, &st) == 0)
+    {
+	char cwd[PATH_LEN];
+	if ((file_name[0] != '/') && (getcwd(cwd, sizeof(cwd)) != NULL))
+	    dyStringPrintf(prefix, "%s/", cwd);
+	dyStringPrintf(prefix, "%s:%ld:%lld", file_name, (long)st.st_mtime, (long long)st.st_size);
+	if (S_ISREG(st.st_mode))
+	    *pLocalSize = st.st_size;
+    }
+    else
+	dyStringAppend(prefix, file_name);
+    return dyStringCannibalize(&prefix);
+}
+
+static void local_map_free(struct local_map **pMap)
+/* unmap and free */
+{
+    struct local_map *map = *pMap;
+    if (map)
+    {
+	munmap(map->base, map->size);
+	freeMem(map->prefix);
+	freez(pMap);
+    }
+}
+
+static struct local_map *local_map_get(char *file_name, char *prefix, off_t size)
+/* the mapping of a local file, mapping it if it isn't yet, with a ref taken. */
+/* NULL if it can't be mapped, and the caller reads through udc like before */
+{
+    struct local_map *map, *added, *prev, *lru = NULL, *lru_prev = NULL;
+    int fd, count = 0;
+    void *base;
+    pthread_mutex_lock(&block_cache_lock);
+    for (map = local_maps; map != NULL; map = map->next)
+	if (sameString(map->prefix, prefix))
+	{
+	    map->refs++;
+	    map->last_used = ++local_map_clock;
+	    pthread_mutex_unlock(&block_cache_lock);
+	    return map;
+	}
+    pthread_mutex_unlock(&block_cache_lock);
+    fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+	return NULL;
+    base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+	return NULL;
+    /* regions jump around the file, so the kernel shouldn't read ahead on its own; */
+    /* each run of blocks gets a WILLNEED when it's about to be used */
+    madvise(base, size, MADV_RANDOM);
+    AllocVar(added);
+    added->prefix = cloneString(prefix);
+    added->base = (char *)base;
+    added->size = size;
+    added->refs = 1;
+    pthread_mutex_lock(&block_cache_lock);
+    added->last_used = ++local_map_clock;
+    slAddHead(&local_maps, added);
+    /* unmap the least recently used idle file if there are too many */
+    for (prev = NULL, lru = NULL, map = local_maps; map != NULL; prev = map, map = map->next)
+    {
+	count++;
+	if ((map->refs == 0) && ((lru == NULL) || (map->last_used < lru->last_used)))
+	{
+	    lru = map;
+	    lru_prev = prev;
+	}
+    }
+    if ((count > LOCAL_MAP_MAX) && lru)
+    {
+	if (lru_prev)
+	    lru_prev->next = lru->next;
+	else
+	    local_maps = lru->next;
+	local_map_free(&lru);
+    }
+    pthread_mutex_unlock(&block_cache_lock);
+    return added;
+}
+
+static void local_map_release(struct local_map *map)
+/* let go of the ref from local_map_get() */
+{
+    if (map)
+    {
+	pthread_mutex_lock(&block_cache_lock);
+	map->refs--;
+	pthread_mutex_unlock(&block_cache_lock);
+    }
+}
+
+static char *read_run(struct bbiFile *bbi, struct local_map *map, bits64 offset, bits64 size, boolean *pOwned)
+/* the bytes of a run of blocks: straight out of the mapping for a local file, */
+/* otherwise read through udc into memory the caller frees */
+{
+    char *buf;
+    if (map && (offset + size <= map->size))
+    {
+	long page = sysconf(_SC_PAGESIZE);
+	bits64 aligned = offset - (offset % page);
+	madvise(map->base + aligned, size + (offset - aligned), MADV_WILLNEED);
+	*pOwned = FALSE;
+	pthread_mutex_lock(&block_cache_lock);
+	block_stats.bytes_mapped += size;
+	pthread_mutex_unlock(&block_cache_lock);
+	return map->base + offset;
+    }
+    buf = needLargeMem(size);
+    udcSeek(bbi->udc, offset);
+    udcMustRead(bbi->udc, buf, size);
+    *pOwned = TRUE;
+    pthread_mutex_lock(&block_cache_lock);
+    block_stats.bytes_read += size;
+    pthread_mutex_unlock(&block_cache_lock);
+    return buf;
+}
+
+static void fill_from_blocks(struct bbiFile *bbi, char *chrom, bits32 start, bits32 end, double *data)
+/* bigWigIntervalQuery() written straight into data.  runs of blocks next to each */
+/* other in the file are read in one go like there, but only if one isn't cached */
+{
+    struct fileOffsetSize *blockList, *block, *beforeGap, *afterGap;
+    bits32 chromId;
+    off_t local_size;
+    char *prefix = block_key_prefix(bbi->fileName, &local_size);
+    struct local_map *map = ((local_size > 0) && !mmap_off) ? local_map_get(bbi->fileName, prefix, local_size) : NULL;
+    size_t key_size = strlen(prefix) + 32;
+    char *key = needMem(key_size);
+    unsigned long long prof_start = PROFILE_START();
+    bbiAttachUnzoomedCir(bbi);
+    blockList = bbiOverlappingBlocks(bbi, bbi->unzoomedCir, chrom, start, end, &chromId);
+    PROFILE_STOP(prof_index, prof_start);
+    for (block = blockList; block != NULL; block = afterGap)
+    {
+	struct fileOffsetSize *one;
+	struct cached_block **run;
+	char *merged = NULL;
+	boolean owned = FALSE;
+	int run_size = 0, i;
+	fileOffsetSizeFindGap(block, &beforeGap, &afterGap);
+	for (one = block; one != afterGap; one = one->next)
+	    run_size++;
+	AllocArray(run, run_size);
+	for (one = block, i = 0; one != afterGap; one = one->next, i++)
+	{
+	    safef(key, key_size, "%s@%llu", prefix, (unsigned long long)one->offset);
+	    run[i] = get_block(key);
+	    if ((run[i] == NULL) && (merged == NULL))
+	    {
+		bits64 merged_size = beforeGap->offset + beforeGap->size - block->offset;
+		prof_start = PROFILE_START();
+		merged = read_run(bbi, map, block->offset, merged_size, &owned);
+		PROFILE_STOP(prof_read, prof_start);
+	    }
+	    if (run[i] == NULL)
+	    {
+		char *compressed = merged + (one->offset - block->offset);
+		char *inflated;
+		size_t size = one->size;
+		prof_start = PROFILE_START();
+		if (bbi->uncompressBufSize > 0)
+		{
+		    inflated = needLargeMem(bbi->uncompressBufSize);
+		    size = zUncompress(compressed, one->size, inflated, bbi->uncompressBufSize);
+		    inflated = needLargeMemResize(inflated, size);
+		}
+		else
+		{
+		    inflated = needLargeMem(size);
+		    memcpy(inflated, compressed, size);
+		}
+		PROFILE_STOP(prof_inflate, prof_start);
+		PROFILE_COUNT(prof_blocks, 1);
+		pthread_mutex_lock(&block_cache_lock);
+		block_stats.bytes_inflated += size;
+		pthread_mutex_unlock(&block_cache_lock);
+		run[i] = add_block(key, inflated, size);
+	    }
+	    prof_start = PROFILE_START();
+	    decode_block(run[i], bbi->isSwapped, start, end, data);
+	    PROFILE_STOP(prof_expand, prof_start);
+	    release_block(run[i]);
+	}
+	if (owned)
+	    freeMem(merged);
+	freeMem(run);
+    }
+    local_map_release(map);
+    slFreeList(&blockList);
+    freeMem(prefix);
+    freeMem(key);
+}
+
+struct perBaseWig *perBaseWigLoad_cached(struct metaBig *mb, char *chrom, int start, int end, boolean reverse,
+					 double fill)
+/* perBaseWigLoadSingleContinue(), with the bigWig's data blocks decoded through the */
+/* cache so regions that overlap (in the same or other threads) only inflate each */
+/* block once.  bases without data are fill.  other file types aren't cached */
+{
+    struct perBaseWig *pbw;
+    int i;
+    if ((mb->type != isaBigWig) || (start < 0) || (end <= start))
+    {
+	unsigned long long prof_start = PROFILE_START();
+	pbw = perBaseWigLoadSingleContinue(mb, chrom, start, end, reverse, fill);
+	PROFILE_STOP(prof_load, prof_start);
+	return pbw;
+    }
+    PROFILE_COUNT(prof_regions, 1);
+    pbw = alloc_perBaseWig(chrom, start, end);
+    for (i = 0; i < pbw->len; i++)
+	pbw->data[i] = fill;
+    fill_from_blocks(mb->big.bbi, chrom, (bits32)start, (bits32)end, pbw->data);
+    if (reverse)
+	reverseDoubles(pbw->data, pbw->len);
+    return pbw;
+}
+
+struct perBaseMatrix *load_perBaseMatrix_cached(struct metaBig *mb, struct bed6 *regions, double fill)
+/* load_perBaseMatrix() through the block cache: a row per region, reversed on the */
+/* minus strand */
+{
+    struct perBaseMatrix *pbm;
+    struct bed6 *bed;
+    int i;
+    if (mb->type != isaBigWig)
+    {
+	unsigned long long prof_start = PROFILE_START();
+	pbm = load_perBaseMatrix(mb, regions, fill);
+	PROFILE_STOP(prof_load, prof_start);
+	return pbm;
+    }
+    AllocVar(pbm);
+    pbm->nrow = slCount(regions);
+    pbm->ncol = (regions) ? regions->chromEnd - regions->chromStart : 0;
+    AllocArray(pbm->array, pbm->nrow);
+    AllocArray(pbm->matrix, pbm->nrow);
+    for (bed = regions, i = 0; bed != NULL; bed = bed->next, i++)
+    {
+	struct perBaseWig *pbw = perBaseWigLoad_cached(mb, bed->chrom, bed->chromStart, bed->chromEnd,
+						       (bed->strand[0] == '-'), fill);
+	pbw->name = cloneString(bed->name);
+	pbw->score = bed->score;
+	pbw->strand[0] = bed->strand[0];
+	pbm->array[i] = pbw;
+	pbm->matrix[i] = pbw->data;
+    }
+    return pbm;
+}
+
+void load_rows_cached(struct metaBig *mb, struct bed6 *regions, double fill, double **rows, int col)
+/* load_perBaseMatrix_cached() written into columns col onward of rows, a row per region, */
+/* so the rows can be part of a wider matrix.  regions partly off the chrom are loaded */
+/* the uncached way and copied in */
+{
+    struct bed6 *bed;
+    int i, j;
+    for (bed = regions, i = 0; bed != NULL; bed = bed->next, i++)
+    {
+	double *row = rows[i] + col;
+	int len = bed->chromEnd - bed->chromStart;
+	boolean rev = (bed->strand[0] == '-');
+	if ((mb->type == isaBigWig) && (bed->chromStart >= 0) && (len > 0))
+	{
+	    PROFILE_COUNT(prof_regions, 1);
+	    for (j = 0; j < len; j++)
+		row[j] = fill;
+	    fill_from_blocks(mb->big.bbi, bed->chrom, (bits32)bed->chromStart, (bits32)bed->chromEnd, row);
+	    if (rev)
+		reverseDoubles(row, len);
+	}
+	else
+	{
+	    struct perBaseWig *pbw = perBaseWigLoad_cached(mb, bed->chrom, bed->chromStart, bed->chromEnd, rev, fill);
+	    for (j = 0; j < len; j++)
+		row[j] = (pbw) ? pbw->data[j] : sqrt(-1);
+	    perBaseWigFree(&pbw);
+	}
+    }
+}
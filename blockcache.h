@@ -0,0 +1,54 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <jkweb/common.h>
+#include <jkweb/hash.h>
+#include <beato/bigs.h>
+
+/* megabytes of inflated bigWig blocks kept if -block-cache isn't given */
+#define BLOCK_CACHE_MB 64
+
+struct block_cache_stats
+/* how the cache has done so far */
+{
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long long bytes_read;      /* Compressed bytes read through udc. */
+    unsigned long long bytes_mapped;    /* Compressed bytes taken from mapped local files. */
+    unsigned long long bytes_inflated;
+    size_t bytes_cached;
+};
+
+void blockCacheSetup(struct hash *options);
+/* size the cache from -block-cache=MB (0 turns it off) and see if -no-mmap is given */
+
+void blockCacheSetSize(size_t max_bytes);
+/* keep up to max_bytes of inflated blocks, dropping the least recently used */
+/* ones if there's more than that already */
+
+void blockCacheGetStats(struct block_cache_stats *stats);
+/* a copy of the counters */
+
+void blockCacheReport(FILE *f);
+/* print the hit rate and sizes in one line */
+
+void blockCacheFree();
+/* drop everything in the cache that isn't in use */
+
+struct perBaseWig *perBaseWigLoad_cached(struct metaBig *mb, char *chrom, int start, int end, boolean reverse,
+					 double fill);
+/* perBaseWigLoadSingleContinue(), with the bigWig's data blocks decoded through the */
+/* cache so regions that overlap (in the same or other threads) only inflate each */
+/* block once.  bases without data are fill.  other file types aren't cached */
+
+struct perBaseMatrix *load_perBaseMatrix_cached(struct metaBig *mb, struct bed6 *regions, double fill);
+/* load_perBaseMatrix() through the block cache: a row per region, reversed on the */
+/* minus strand */
+
+void load_rows_cached(struct metaBig *mb, struct bed6 *regions, double fill, double **rows, int col);
+/* load_perBaseMatrix_cached() written into columns col onward of rows, a row per region, */
+/* so the rows can be part of a wider matrix.  regions partly off the chrom are loaded */
+/* the uncached way and copied in */
+
+#endif /* BLOCKCACHE_H */
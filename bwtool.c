@@ -11,8 +11,14 @@
 #include <jkweb/sqlNum.h>
 #include <jkweb/basicBed.h>
 #include <jkweb/bigWig.h>
+#include <jkweb/errCatch.h>
+#include <jkweb/verbose.h>
 #include <beato/bigs.h>
 #include "bwtool.h"
+#include "bwtool_shared.h"
+#include "blockcache.h"
+#include "profile.h"
+#include "memtrack.h"
 
 #define NANUM sqrt(-1)
 
@@ -26,6 +32,8 @@ errAbort(
   "commands:\n"
   "   aggregate      (or \"agg\") produce plot data as an average of values around\n"
   "                  the regions specified in a bed file\n"
+  "   batch          run a file of bwtool commands in one process, sharing open\n"
+  "                  bigWigs and bed files between them\n"
   "   chromgraph     roughly convert to the chromgraph format, suitable for UCSC's\n"
   "                  Genome Graphs page\n"
   "   distribution   (or \"dist\") produce plot data as the frequency of values seen\n"
@@ -46,6 +54,8 @@ errAbort(
   "                  or remove data using ranges specified in a bed file\n"
   "   roll           compute rolling means, etc\n"
   "   sax            run symbolic aggregate approximation (SAX) algorithm on data\n"
+  "   serve          run commands sent over a Unix socket, keeping bigWigs open\n"
+  "                  between them\n"
   "   shift          move data on the chromosome\n"
 /*   "   split          make a set of files describing evenly-sized regions of the bigWig,\n" */
 /*   "                  each of which may be used separately on a cluster and combined later\n" */
@@ -64,6 +74,29 @@ errAbort(
   "                          file instead.\n"
   " -tmp-dir=dir             by default, bigWig caching is done in /tmp/udcCache/*.\n"
   "                          Override this by setting dir to the desired path.\n"
+  " -threads=n               programs that can split up their work will use up to\n"
+  "                          n threads (default 1)\n"
+  " -block-cache=MB          keep up to MB megabytes of decompressed bigWig data\n"
+  "                          for programs loading overlapping regions (default 64)\n"
+  " -block-cache-stats       print how the block cache did to stderr at the end\n"
+  " -no-mmap                 read local bigWigs' data through the usual file layer\n"
+  "                          instead of mapping them into memory\n"
+  " -prefetch=n              for bigWigs given as URLs, fetch the parts the regions\n"
+  "                          need with up to n range requests at once before loading\n"
+  "                          them (default 4, 0 to turn off)\n"
+  " -profile[=json]          print where the time went (opening, index queries,\n"
+  "                          reading, inflating, expanding, statistics, output)\n"
+  "                          and how much was read and written to stderr at the\n"
+  "                          end, as a table or one line of JSON\n"
+  " -mem-report              print the peak memory taken by loaded data, and what\n"
+  "                          it went to, to stderr at the end\n"
+  " -mem-limit=size          keep loaded data under size (in MB, or with K, M, or G\n"
+  "                          after it): programs reading in chunks use smaller\n"
+  "                          ones, others stop with a message when it won't fit\n"
+  " -server=socket           send the command to a running \"bwtool serve\" instead\n"
+  "                          of running it here\n"
+  " -verbose=n               print more about what's being done to stderr, e.g.\n"
+  "                          what -prefetch fetched with 2 (default 1)\n"
   );
 }
 
@@ -115,8 +148,13 @@ enum bw_op_type get_bw_op_type(char *thresh_type, boolean inverse)
     return invalid;
 }
 
-int main(int argc, char *argv[])
-/* Process command line. */
+/* the options of the command being run, for bwtool_run_catching() to free when the */
+/* command ends with errAbort */
+static struct hash *run_options = NULL;
+
+int bwtool_run(int argc, char *argv[])
+/* parse the options and run the command in argv, returning the exit status.  main() */
+/* for a command given on the command line or sent to a server */
 {
 /* Display help if no arguments are given. */
 if (argc == 1)
@@ -126,6 +164,7 @@ if (argc == 1)
 
 bool version_cmd = sameString(argv[1], "--version") || sameString(argv[1], "-V");//argv containing '-' will be removed by the next function
 struct hash *options = optionParseIntoHashExceptNumbers(&argc, argv, FALSE);
+run_options = options;
 
 /* common options */
 char *tmp_dir = (char *)hashOptionalVal(options, "tmp-dir", NULL);
@@ -141,6 +180,11 @@ double na = NANUM;
 double fill = na;
 if (fill_s)
     fill = sqlDouble(hashFindVal(options, "fill"));
+/* set every time, as served and batch commands share the process */
+verboseSetLevel((int)sqlUnsigned((char *)hashOptionalVal(options, "verbose", "1")));
+blockCacheSetup(options);
+boolean profile = profileSetup(options);
+boolean mem_report = memTrackSetup(options);
 
 if (argc == 1 && !version_cmd) {
     usage();
@@ -309,11 +353,72 @@ else if (sameString(argv[1], "extract") || sameString(argv[1], "ex"))
     else
 	bwtool_extract(options, argv[3], decimals, fill, argv[2], argv[4], tmp_dir, argv[5]);
 }
+else if (sameString(argv[1], "batch"))
+{
+    if (argc != 3)
+	usage_batch();
+    else
+	bwtool_batch(options, tmp_dir, argv[2]);
+}
+else if (sameString(argv[1], "serve"))
+{
+    if (argc != 3)
+	usage_serve();
+    else
+	bwtool_serve(options, argv[2]);
+}
 else
 {
     usage();
 }
 
+if (hashFindVal(options, "block-cache-stats") != NULL)
+    blockCacheReport(stderr);
+if (profile)
+    profileReport(argv[1]);
+if (mem_report)
+    memTrackReport(argv[1]);
 hashFree(&options);
+run_options = NULL;
 return 0;
 }
+
+int bwtool_run_catching(int argc, char *argv[])
+/* bwtool_run(), but an errAbort only ends the command: the message goes to stderr, */
+/* the bigWigs and output files it had open are closed, and the status is 1.  for */
+/* running many commands in one process */
+{
+struct errCatch *errCatch = errCatchNew();
+int status = 0;
+if (errCatchStart(errCatch))
+    status = bwtool_run(argc, argv);
+errCatchEnd(errCatch);
+if (errCatch->gotError)
+{
+    fprintf(stderr, "%s", errCatch->message->string);
+    /* give back what the command had open, since it never got to */
+    metaBigReleaseAll();
+    close_tracked_files();
+    hashFree(&run_options);
+    memTrackClear();
+    status = 1;
+}
+errCatchFree(&errCatch);
+return status;
+}
+
+int main(int argc, char *argv[])
+/* Process command line. */
+{
+int i;
+/* -server hands the whole command to a server, so it's looked for before any parsing */
+for (i = 1; i < argc; i++)
+    if (startsWith("-server=", argv[i]))
+    {
+	char *socket_path = argv[i] + strlen("-server=");
+	for (; i < argc - 1; i++)
+	    argv[i] = argv[i + 1];
+	return bwtool_client(socket_path, argc - 1, argv);
+    }
+return bwtool_run(argc, argv);
+}
@@ -75,6 +75,21 @@ void usage_window();
 void usage_extract();
 /* Explain usage and exit. */
 
+void usage_batch();
+/* Explain batch usage and exit. */
+
+void usage_serve();
+/* Explain serve usage and exit. */
+
+int bwtool_run(int argc, char *argv[]);
+/* parse the options and run the command in argv, returning the exit status.  main() */
+/* for a command given on the command line or sent to a server */
+
+int bwtool_run_catching(int argc, char *argv[]);
+/* bwtool_run(), but an errAbort only ends the command: the message goes to stderr, */
+/* the bigWigs and output files it had open are closed, and the status is 1.  for */
+/* running many commands in one process */
+
 void bwtool_remove(struct hash *options, char *favorites, char *regions, unsigned decimals, enum wigOutType wot,
 		   boolean condense, boolean wig_only, char *thresh_type, char *val_or_file, char *bigfile, char *tmp_dir,
 		   char *outputfile);
@@ -155,4 +170,14 @@ void bwtool_roll(struct hash *options, char *favorites, char *regions, unsigned
 		 enum wigOutType wot, char *command, char *size_s, char *bigfile, char *tmp_dir, char *outputfile);
 /* bwtool_roll - main for the rolling-mean program */
 
+void bwtool_batch(struct hash *options, char *tmp_dir, char *jobs_file);
+/* bwtool_batch - main for running a file of commands */
+
+void bwtool_serve(struct hash *options, char *socket_path);
+/* bwtool_serve - main for the server; only a signal stops it */
+
+int bwtool_client(char *socket_path, int argc, char *argv[]);
+/* send the command in argv (without the -server option) to a server and return */
+/* its exit status */
+
 #endif /* BWTOOL_H */
@@ -6,19 +6,27 @@
 
 #include <jkweb/common.h>
 #include <jkweb/sqlNum.h>
+#include <jkweb/dystring.h>
+#include <jkweb/errCatch.h>
 #include <beato/metaBig.h>
 #include <beato/bigs.h>
 #include <jkweb/bigWig.h>
 #include <jkweb/bwgInternal.h>
 #include "bwtool_shared.h"
+#include "blockcache.h"
+#include "profile.h"
+#include "resample.h"
 
 #include <math.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 struct bed6 *load_and_recalculate_coords(char *list_file, int left, int right, boolean firstbase, boolean starts, boolean ends)
 /* do the coordinate recalculation */
 {
     struct bed6 *bed;
-    struct bed6 *list = readBed6Soft(list_file);
+    struct bed6 *list = readBed6Soft_cached(list_file);
     for (bed = list; bed != NULL; bed = bed->next)
     {
 	boolean rev = (bed->strand[0] == '-');
@@ -195,12 +203,14 @@ int parse_left_right(char *size_s, unsigned *pleft, unsigned *pright, int *pmeta
 void writeBw(char *inName, char *outName, struct hash *chromSizeHash)
 /* shared func */
 {
+    unsigned long long prof_start = PROFILE_START();
     struct lm *lm = lmInit(0);
     struct bwgSection *sectionList = bwgParseWig(inName, TRUE, chromSizeHash, 1024, lm);
     if (sectionList == NULL)
 	errAbort("%s is empty of data", inName);
     bwgCreate(sectionList, chromSizeHash, 256, 1024, TRUE, outName);
     lmCleanup(&lm);
+    PROFILE_STOP(prof_write, prof_start);
 }
 
 static boolean local_file(char *filename)
@@ -217,23 +227,441 @@ static boolean local_file(char *filename)
     return ret;
 }
 
+static void open_problem(char *bigfile, char *msg, int size)
+/* say why a bigWig couldn't be opened */
+{
+    boolean internet = (strstr(bigfile, "tp://") != 0);
+    if (!internet && !local_file(bigfile))
+	safef(msg, size, "%s wasn't found", bigfile);
+    else if (!internet)
+	safef(msg, size, "%s could not be opened. Perhaps it is not a valid bigWig.", bigfile);
+    else
+	safef(msg, size, "There was a problem opening %s. Perhaps there is a problem with the internet connection.", bigfile);
+}
+
 struct metaBig *metaBigOpen_check(char *bigfile, char *tmp_dir, char *regions)
 /* A wrapper for metaBigOpen that does some checking and erroring */
 {
-    struct metaBig *mb = metaBigOpenWithTmpDir(bigfile, tmp_dir, regions);
+    struct metaBig *mb = metaBigOpen_cached(bigfile, tmp_dir, regions);
     if (!mb)
     {
-	boolean internet = (strstr(bigfile, "tp://") != 0);
-	if (!internet && !local_file(bigfile))
-	    errAbort("%s wasn't found", bigfile);
-	else if (!internet)
-	    errAbort("%s could not be opened. Perhaps it is not a valid bigWig.", bigfile);
+	char msg[2*PATH_LEN];
+	open_problem(bigfile, msg, sizeof(msg));
+	errAbort("%s", msg);
+    }
+    return mb;
+}
+
+struct mb_cache_entry
+/* an open metaBig kept around for the next command that wants the same file */
+{
+    struct mb_cache_entry *next;
+    char *key;                  /* Absolute file name and tmp dir. */
+    struct metaBig *mb;
+    time_t mtime;               /* For local files, to notice them being rewritten. */
+    off_t size;
+    boolean in_use;             /* Handed out and not released yet. */
+    unsigned long last_used;
+};
+
+/* the cache is off (max_idle 0) unless something like serve turns it on */
+static pthread_mutex_t mb_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mb_cache_entry *mb_cache = NULL;
+static int mb_cache_max_idle = 0;
+static unsigned long mb_cache_clock = 0;
+
+void metaBigCacheEnable(int max_idle)
+/* keep up to max_idle released metaBigs open for reuse by later opens of the */
+/* same file.  0 turns it off again (closing what's cached) */
+{
+    pthread_mutex_lock(&mb_cache_lock);
+    mb_cache_max_idle = max_idle;
+    pthread_mutex_unlock(&mb_cache_lock);
+    if (max_idle == 0)
+	metaBigCacheFree();
+}
+
+static char *mb_cache_key(char *bigfile, char *tmp_dir)
+/* relative names are made absolute since the cache can outlive a chdir() */
+{
+    struct dyString *key = dyStringNew(0);
+    if ((bigfile[0] != '/') && (strstr(bigfile, "tp://") == NULL))
+    {
+	char cwd[PATH_LEN];
+	if (getcwd(cwd, sizeof(cwd)) != NULL)
+	    dyStringPrintf(key, "%s/", cwd);
+    }
+    dyStringPrintf(key, "%s\t%s", bigfile, (tmp_dir) ? tmp_dir : "");
+    return dyStringCannibalize(&key);
+}
+
+static boolean mb_cache_stat(char *bigfile, time_t *pMtime, off_t *pSize)
+/* the modification time and size of a local file, if it is one */
+{
+    struct stat st;
+    char *s = cloneString(bigfile);
+    char *colon = strchr(s, ':');
+    boolean ret;
+    if (colon)
+	*colon = '\0';
+    ret = (stat(s, &st) == 0);
+    freeMem(s);
+    *pMtime = (ret) ? st.st_mtime : 0;
+    *pSize = (ret) ? st.st_size : 0;
+    return ret;
+}
+
+static void mb_cache_entry_free(struct mb_cache_entry **pEntry)
+/* close the metaBig and free the entry */
+{
+    struct mb_cache_entry *entry = *pEntry;
+    if (entry)
+    {
+	metaBigClose(&entry->mb);
+	freeMem(entry->key);
+	freez(pEntry);
+    }
+}
+
+static void mb_cache_trim()
+/* with the lock held, close the least recently used idle metaBigs until there */
+/* are no more than the maximum */
+{
+    for (;;)
+    {
+	struct mb_cache_entry *entry, *prev = NULL, *lru = NULL, *lru_prev = NULL;
+	int idle = 0;
+	for (entry = mb_cache; entry != NULL; prev = entry, entry = entry->next)
+	    if (!entry->in_use)
+	    {
+		idle++;
+		if ((lru == NULL) || (entry->last_used < lru->last_used))
+		{
+		    lru = entry;
+		    lru_prev = prev;
+		}
+	    }
+	if (idle <= mb_cache_max_idle)
+	    break;
+	if (lru_prev)
+	    lru_prev->next = lru->next;
 	else
-	    errAbort("There was a problem opening %s. Perhaps there is a problem with the internet connection.", bigfile);
+	    mb_cache = lru->next;
+	mb_cache_entry_free(&lru);
     }
+}
+
+/* metaBigs handed out while the cache is off (or with regions), kept track of so */
+/* metaBigReleaseAll() can close them */
+static struct mb_cache_entry *mb_loose = NULL;
+
+static struct metaBig *open_timed(char *bigfile, char *tmp_dir, char *regions)
+/* metaBigOpenWithTmpDir(), counted as opening for -profile */
+{
+    unsigned long long prof_start = PROFILE_START();
+    struct metaBig *mb = metaBigOpenWithTmpDir(bigfile, tmp_dir, regions);
+    PROFILE_STOP(prof_open, prof_start);
     return mb;
 }
 
+static struct metaBig *open_loose(char *bigfile, char *tmp_dir, char *regions)
+/* open without the cache, but remember it's out */
+{
+    struct metaBig *mb = open_timed(bigfile, tmp_dir, regions);
+    struct mb_cache_entry *entry;
+    if (mb == NULL)
+	return NULL;
+    AllocVar(entry);
+    entry->mb = mb;
+    entry->in_use = TRUE;
+    pthread_mutex_lock(&mb_cache_lock);
+    slAddHead(&mb_loose, entry);
+    pthread_mutex_unlock(&mb_cache_lock);
+    return mb;
+}
+
+struct metaBig *metaBigOpen_cached(char *bigfile, char *tmp_dir, char *regions)
+/* metaBigOpenWithTmpDir(), but when the cache is on and there are no regions, */
+/* an idle metaBig of the same file is handed back instead of opening it again. */
+/* a metaBig from here has to go back with metaBigRelease() */
+{
+    struct mb_cache_entry *entry;
+    struct metaBig *mb;
+    time_t mtime;
+    off_t size;
+    char *key;
+    if ((mb_cache_max_idle == 0) || (regions != NULL))
+	return open_loose(bigfile, tmp_dir, regions);
+    key = mb_cache_key(bigfile, tmp_dir);
+    mb_cache_stat(bigfile, &mtime, &size);
+    pthread_mutex_lock(&mb_cache_lock);
+    for (entry = mb_cache; entry != NULL; entry = entry->next)
+	if (!entry->in_use && sameString(entry->key, key) && (entry->mtime == mtime) && (entry->size == size))
+	{
+	    entry->in_use = TRUE;
+	    pthread_mutex_unlock(&mb_cache_lock);
+	    freeMem(key);
+	    return entry->mb;
+	}
+    pthread_mutex_unlock(&mb_cache_lock);
+    /* opening can be slow so it's done without the lock */
+    mb = open_timed(bigfile, tmp_dir, NULL);
+    if (mb == NULL)
+    {
+	freeMem(key);
+	return NULL;
+    }
+    AllocVar(entry);
+    entry->key = key;
+    entry->mb = mb;
+    entry->mtime = mtime;
+    entry->size = size;
+    entry->in_use = TRUE;
+    pthread_mutex_lock(&mb_cache_lock);
+    slAddHead(&mb_cache, entry);
+    pthread_mutex_unlock(&mb_cache_lock);
+    return mb;
+}
+
+void metaBigRelease(struct metaBig **pMb)
+/* give back a metaBig from metaBigOpen_cached(): it stays open in the cache if the */
+/* cache is on, otherwise it's closed like metaBigClose() */
+{
+    struct mb_cache_entry *entry;
+    if ((pMb == NULL) || (*pMb == NULL))
+	return;
+    pthread_mutex_lock(&mb_cache_lock);
+    for (entry = mb_cache; entry != NULL; entry = entry->next)
+	if (entry->mb == *pMb)
+	{
+	    entry->in_use = FALSE;
+	    entry->last_used = ++mb_cache_clock;
+	    mb_cache_trim();
+	    pthread_mutex_unlock(&mb_cache_lock);
+	    *pMb = NULL;
+	    return;
+	}
+    for (entry = mb_loose; entry != NULL; entry = entry->next)
+	if (entry->mb == *pMb)
+	{
+	    slRemoveEl(&mb_loose, entry);
+	    pthread_mutex_unlock(&mb_cache_lock);
+	    mb_cache_entry_free(&entry);
+	    *pMb = NULL;
+	    return;
+	}
+    pthread_mutex_unlock(&mb_cache_lock);
+    metaBigClose(pMb);
+}
+
+void metaBigReleaseAll()
+/* close every metaBig from metaBigOpen_cached() that hasn't been given back.  for */
+/* after a command ends with errAbort and never releases what it had.  the cached */
+/* ones are closed too rather than kept, since the command could have stopped part */
+/* way through reading one */
+{
+    struct mb_cache_entry *entry, *next, *keep = NULL, *out;
+    pthread_mutex_lock(&mb_cache_lock);
+    out = mb_loose;
+    for (entry = mb_cache; entry != NULL; entry = next)
+    {
+	next = entry->next;
+	if (entry->in_use)
+	    slAddHead(&out, entry);
+	else
+	    slAddHead(&keep, entry);
+    }
+    slReverse(&keep);
+    mb_cache = keep;
+    mb_loose = NULL;
+    pthread_mutex_unlock(&mb_cache_lock);
+    while ((entry = slPopHead(&out)) != NULL)
+	mb_cache_entry_free(&entry);
+}
+
+void metaBigCacheFree()
+/* close all the idle metaBigs in the cache */
+{
+    struct mb_cache_entry *entry, *next, *keep = NULL;
+    pthread_mutex_lock(&mb_cache_lock);
+    for (entry = mb_cache; entry != NULL; entry = next)
+    {
+	next = entry->next;
+	if (entry->in_use)
+	    slAddHead(&keep, entry);
+	else
+	    mb_cache_entry_free(&entry);
+    }
+    mb_cache = keep;
+    pthread_mutex_unlock(&mb_cache_lock);
+}
+
+struct tracked_file
+/* an output file that's still open */
+{
+    struct tracked_file *next;
+    FILE *f;
+};
+
+static pthread_mutex_t tracked_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tracked_file *tracked_files = NULL;
+
+FILE *mustOpen_tracked(char *fileName, char *mode)
+/* mustOpen(), with the file remembered until carefulClose_tracked() so */
+/* close_tracked_files() can close it if the command ends with errAbort first */
+{
+    FILE *f = mustOpen(fileName, mode);
+    struct tracked_file *tf;
+    if ((f == stdout) || (f == stdin))
+	return f;
+    AllocVar(tf);
+    tf->f = f;
+    pthread_mutex_lock(&tracked_lock);
+    slAddHead(&tracked_files, tf);
+    pthread_mutex_unlock(&tracked_lock);
+    return f;
+}
+
+void carefulClose_tracked(FILE **pFile)
+/* carefulClose() a file from mustOpen_tracked() (or stdout) */
+{
+    struct tracked_file *tf;
+    if ((pFile == NULL) || (*pFile == NULL))
+	return;
+    pthread_mutex_lock(&tracked_lock);
+    for (tf = tracked_files; tf != NULL; tf = tf->next)
+	if (tf->f == *pFile)
+	{
+	    slRemoveEl(&tracked_files, tf);
+	    freeMem(tf);
+	    break;
+	}
+    pthread_mutex_unlock(&tracked_lock);
+    carefulClose(pFile);
+}
+
+void close_tracked_files()
+/* close every file from mustOpen_tracked() that's still open.  for after a command */
+/* ends with errAbort, so nothing is checked */
+{
+    struct tracked_file *list, *tf;
+    pthread_mutex_lock(&tracked_lock);
+    list = tracked_files;
+    tracked_files = NULL;
+    pthread_mutex_unlock(&tracked_lock);
+    while ((tf = slPopHead(&list)) != NULL)
+    {
+	fclose(tf->f);
+	freeMem(tf);
+    }
+}
+
+struct bed_cache_entry
+/* a parsed bed kept around for the next command that reads it */
+{
+    struct bed_cache_entry *next;
+    char *key;                  /* Absolute file name. */
+    time_t mtime;
+    off_t size;
+    struct bed6 *list;
+};
+
+/* beds kept, the least recently read going first */
+#define BED_CACHE_SIZE 16
+
+static pthread_mutex_t bed_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct bed_cache_entry *bed_cache = NULL;
+static boolean bed_cache_on = FALSE;
+
+static void bed_cache_entry_free(struct bed_cache_entry **pEntry)
+/* free the bed and the entry */
+{
+    struct bed_cache_entry *entry = *pEntry;
+    if (entry)
+    {
+	bed6FreeList(&entry->list);
+	freeMem(entry->key);
+	freez(pEntry);
+    }
+}
+
+void bedCacheEnable(boolean on)
+/* keep beds read through readBed6Soft_cached() parsed for later reads of the same file */
+{
+    struct bed_cache_entry *entry;
+    pthread_mutex_lock(&bed_cache_lock);
+    bed_cache_on = on;
+    if (!on)
+	while ((entry = slPopHead(&bed_cache)) != NULL)
+	    bed_cache_entry_free(&entry);
+    pthread_mutex_unlock(&bed_cache_lock);
+}
+
+static struct bed6 *bed6_list_clone(struct bed6 *list)
+/* a deep copy, so the caller can change or free it */
+{
+    struct bed6 *copy = NULL, *bed;
+    for (bed = list; bed != NULL; bed = bed->next)
+    {
+	struct bed6 *one;
+	AllocVar(one);
+	one->chrom = cloneString(bed->chrom);
+	one->chromStart = bed->chromStart;
+	one->chromEnd = bed->chromEnd;
+	one->name = cloneString(bed->name);
+	one->score = bed->score;
+	one->strand[0] = bed->strand[0];
+	slAddHead(&copy, one);
+    }
+    slReverse(&copy);
+    return copy;
+}
+
+struct bed6 *readBed6Soft_cached(char *filename)
+/* readBed6Soft(), but when the bed cache is on, a file already read (and not changed */
+/* since) is copied from the cache instead of parsed again */
+{
+    struct bed_cache_entry *entry, *prev;
+    struct bed6 *list;
+    time_t mtime;
+    off_t size;
+    char *key;
+    if (!bed_cache_on || !mb_cache_stat(filename, &mtime, &size))
+	return readBed6Soft(filename);
+    key = mb_cache_key(filename, NULL);
+    pthread_mutex_lock(&bed_cache_lock);
+    for (entry = bed_cache, prev = NULL; entry != NULL; prev = entry, entry = entry->next)
+	if (sameString(entry->key, key) && (entry->mtime == mtime) && (entry->size == size))
+	{
+	    if (prev)
+	    {
+		prev->next = entry->next;
+		slAddHead(&bed_cache, entry);
+	    }
+	    list = bed6_list_clone(entry->list);
+	    pthread_mutex_unlock(&bed_cache_lock);
+	    freeMem(key);
+	    return list;
+	}
+    pthread_mutex_unlock(&bed_cache_lock);
+    list = readBed6Soft(filename);
+    AllocVar(entry);
+    entry->key = key;
+    entry->mtime = mtime;
+    entry->size = size;
+    entry->list = bed6_list_clone(list);
+    pthread_mutex_lock(&bed_cache_lock);
+    slAddHead(&bed_cache, entry);
+    if (slCount(bed_cache) > BED_CACHE_SIZE)
+    {
+	for (prev = bed_cache; prev->next->next != NULL; prev = prev->next)
+	    ;
+	bed_cache_entry_free(&prev->next);
+    }
+    pthread_mutex_unlock(&bed_cache_lock);
+    return list;
+}
+
 void fuse_pbm(struct perBaseMatrix **pBig, struct perBaseMatrix **pTo_add, boolean add_coords)
 /* not this makes perhaps-illegal perBaseWigs where the chromEnd-chromStart are not the */
 /* same as the len... which may break things somewhere if this were ever library-ized */
@@ -276,6 +704,201 @@ void fuse_pbm(struct perBaseMatrix **pBig, struct perBaseMatrix **pTo_add, boole
     }
 }
 
+static struct perBaseWig *load_span(struct metaBig *mb, char *chrom, int start, int end, boolean reverse, double fill)
+/* load start-end in the given orientation.  the part off the ends of the chrom or */
+/* without data is NA */
+{
+    struct perBaseWig *span = alloc_perBaseWig(chrom, start, end);
+    int size = hashIntValDefault(mb->chromSizeHash, chrom, 0);
+    int s = (start > 0) ? start : 0;
+    int e = (end < size) ? end : size;
+    int i;
+    for (i = 0; i < span->len; i++)
+	span->data[i] = sqrt(-1);
+    if (e > s)
+    {
+	struct perBaseWig *pbw = perBaseWigLoad_cached(mb, chrom, s, e, reverse, fill);
+	if (pbw)
+	{
+	    int offset = (reverse) ? end - e : s - start;
+	    memcpy(span->data + offset, pbw->data, (e - s) * sizeof(double));
+	    perBaseWigFree(&pbw);
+	}
+    }
+    return span;
+}
+
+struct meta_plan
+/* the resampling plan for one body length, and how many rows still need it */
+{
+    struct meta_plan *next;
+    int rows_left;
+    struct resample_plan plan;
+};
+
+static struct meta_plan *meta_plan_for(struct hash *plans, struct meta_plan **pList, int body_len)
+/* the plan for rows of body_len bases, made if there isn't one yet */
+{
+    char key[16];
+    struct meta_plan *mp;
+    safef(key, sizeof(key), "%d", body_len);
+    mp = (struct meta_plan *)hashFindVal(plans, key);
+    if (!mp)
+    {
+	AllocVar(mp);
+	hashAdd(plans, key, mp);
+	slAddHead(pList, mp);
+    }
+    return mp;
+}
+
+void meta_span_coords(struct bed6 *bed, int left, int right, int *pStart, int *pEnd)
+/* how an up:meta:down row is labelled: like the upstream, meta, and downstream pieces */
+/* fused together, so from the upstream end to the downstream end on either strand */
+{
+    boolean rev = (bed->strand[0] == '-');
+    *pStart = (rev) ? bed->chromEnd : bed->chromStart - left;
+    *pEnd = (rev) ? bed->chromStart : bed->chromEnd + right;
+}
+
+void load_meta_span_rows(struct metaBig *mb, struct bed6 *regions, int left, int meta, int right,
+			 double fill, double **rows, int col)
+/* load_meta_span_perBaseMatrix() written into columns col onward of rows, a row per */
+/* region, so the rows can be part of a wider matrix */
+{
+    struct bed6 *bed;
+    /* gene bodies are mostly all different lengths, so a plan is only made for a length */
+    /* more than one row has, and freed after the last of them */
+    struct hash *plans = newHash(10);
+    struct meta_plan *planList = NULL;
+    int i, j;
+    if (meta > 0)
+	for (bed = regions; bed != NULL; bed = bed->next)
+	    if (bed->chromEnd > bed->chromStart)
+		meta_plan_for(plans, &planList, bed->chromEnd - bed->chromStart)->rows_left++;
+    for (bed = regions, i = 0; bed != NULL; bed = bed->next, i++)
+    {
+	boolean rev = (bed->strand[0] == '-');
+	int span_start = bed->chromStart - ((rev) ? right : left);
+	int span_end = bed->chromEnd + ((rev) ? left : right);
+	struct perBaseWig *span = load_span(mb, bed->chrom, span_start, span_end, rev, fill);
+	double *row = rows[i] + col;
+	int body_len = bed->chromEnd - bed->chromStart;
+	memcpy(row, span->data, left * sizeof(double));
+	if ((meta > 0) && (body_len > 0))
+	{
+	    struct meta_plan *mp = meta_plan_for(plans, &planList, body_len);
+	    if ((mp->rows_left == 1) && (mp->plan.in_len == 0))
+		resample_nan_aware(span->data + left, body_len, row + left, meta);
+	    else
+	    {
+		if (mp->plan.in_len == 0)
+		    resample_plan_set(&mp->plan, body_len, meta);
+		resample_row(&mp->plan, span->data + left, row + left);
+	    }
+	    if (--mp->rows_left == 0)
+		resample_plan_free(&mp->plan);
+	}
+	else if (meta > 0)
+	    for (j = left; j < left + meta; j++)
+		row[j] = sqrt(-1);
+	memcpy(row + left + meta, span->data + left + body_len, right * sizeof(double));
+	perBaseWigFree(&span);
+    }
+    hashFree(&plans);
+    slFreeList(&planList);
+}
+
+struct perBaseMatrix *load_meta_span_perBaseMatrix(struct metaBig *mb, struct bed6 *regions, int left, int meta,
+						   int right, double fill)
+/* for up:meta:down, load each region with left bases upstream and right bases downstream */
+/* in one go and make the row: upstream, the region resampled to meta bases, downstream, */
+/* all in the region's orientation */
+{
+    struct perBaseMatrix *pbm;
+    struct bed6 *bed;
+    int width = left + meta + right;
+    int i;
+    AllocVar(pbm);
+    pbm->nrow = slCount(regions);
+    pbm->ncol = width;
+    AllocArray(pbm->array, pbm->nrow);
+    AllocArray(pbm->matrix, pbm->nrow);
+    for (bed = regions, i = 0; bed != NULL; bed = bed->next, i++)
+    {
+	struct perBaseWig *row = alloc_perBaseWig(bed->chrom, 0, width);
+	meta_span_coords(bed, left, right, &row->chromStart, &row->chromEnd);
+	row->name = cloneString(bed->name);
+	row->score = 0;
+	row->strand[0] = bed->strand[0];
+	pbm->array[i] = row;
+	pbm->matrix[i] = row->data;
+    }
+    load_meta_span_rows(mb, regions, left, meta, right, fill, pbm->matrix, 0);
+    return pbm;
+}
+
+/* rows of packed matrices start on cache lines when ncol allows */
+#define PACK_ALIGN 64
+
+double *alloc_packed_block(int nrow, int ncol)
+/* a cache-line-aligned block for nrow rows of ncol doubles one after another.  it's */
+/* freed by unpack_perBaseMatrix() */
+{
+    size_t size = (size_t)nrow * ncol * sizeof(double);
+    void *block = NULL;
+    if (posix_memalign(&block, PACK_ALIGN, (size > 0) ? size : PACK_ALIGN) != 0)
+	errAbort("out of memory making a %d x %d matrix", nrow, ncol);
+    return (double *)block;
+}
+
+double *pack_perBaseMatrix(struct perBaseMatrix *pbm)
+/* move the rows of the matrix into one cache-line-aligned row-major block and point */
+/* the rows (and matrix[]) into it.  returns the block, which has to be given back to */
+/* unpack_perBaseMatrix() before the matrix is freed */
+{
+    double *block = alloc_packed_block(pbm->nrow, pbm->ncol);
+    int i;
+    for (i = 0; i < pbm->nrow; i++)
+    {
+	struct perBaseWig *pbw = pbm->array[i];
+	double *row = block + (size_t)i * pbm->ncol;
+	memcpy(row, pbw->data, pbm->ncol * sizeof(double));
+	freeMem(pbw->data);
+	pbw->data = row;
+	pbm->matrix[i] = row;
+    }
+    return block;
+}
+
+void unpack_perBaseMatrix(struct perBaseMatrix *pbm, double **pBlock)
+/* let go of the rows' data so free_perBaseMatrix()/free_cbm() don't free it row by */
+/* row, then free the block */
+{
+    int i;
+    if (!pBlock || !*pBlock)
+	return;
+    if (pbm)
+	for (i = 0; i < pbm->nrow; i++)
+	{
+	    pbm->array[i]->data = NULL;
+	    pbm->matrix[i] = NULL;
+	}
+    free(*pBlock);
+    *pBlock = NULL;
+}
+
+boolean perBaseMatrixIsPacked(struct perBaseMatrix *pbm)
+/* whether the rows are still one after another in a single block, */
+/* e.g. not reordered by clustering */
+{
+    int i;
+    for (i = 1; i < pbm->nrow; i++)
+	if (pbm->matrix[i] != pbm->matrix[0] + (size_t)i * pbm->ncol)
+	    return FALSE;
+    return TRUE;
+}
+
 int calculate_meta_file(char *file_name)
 /* from all the beds in all the region files, get a single average */
 {
@@ -283,7 +906,7 @@ int calculate_meta_file(char *file_name)
     int sum = 0;
     if (!file_name)
 	return 0;
-    struct bed6 *beds = readBed6Soft(file_name);
+    struct bed6 *beds = readBed6Soft_cached(file_name);
     struct bed6 *bed;
     for (bed = beds; bed != NULL; bed = bed->next)
     {
@@ -304,7 +927,7 @@ int calculate_meta_file_list(struct slName *region_list)
 	return 0;
     for (reg = region_list; reg != NULL; reg = reg->next)
     {
-	struct bed6 *beds = readBed6Soft(reg->name);
+	struct bed6 *beds = readBed6Soft_cached(reg->name);
 	struct bed6 *bed;
 	for (bed = beds; bed != NULL; bed = bed->next)
 	{
@@ -316,3 +939,213 @@ int calculate_meta_file_list(struct slName *region_list)
     return sum / count;
 }
 
+
+int get_num_threads(struct hash *options)
+/* read the -threads option, defaulting to a single thread */
+{
+    int num_threads = (int)sqlUnsigned((char *)hashOptionalVal(options, "threads", "1"));
+    if (num_threads < 1)
+	errAbort("-threads should be at least 1");
+    return num_threads;
+}
+
+struct parallel_jobs
+/* shared state for the workers in parallel_for() */
+{
+    pthread_mutex_t lock;
+    int next_job;
+    int num_jobs;
+    void (*job)(void *data, int job_ix, int thread_ix);
+    void *data;
+    char *error;                /* The first errAbort in a job, NULL if none. */
+};
+
+struct parallel_worker
+/* what each thread gets */
+{
+    struct parallel_jobs *jobs;
+    int thread_ix;
+};
+
+static void parallel_worker_jobs(struct parallel_jobs *jobs, int thread_ix)
+/* keep taking the next job until there are none left */
+{
+    for (;;)
+    {
+	int job_ix;
+	pthread_mutex_lock(&jobs->lock);
+	job_ix = jobs->next_job++;
+	pthread_mutex_unlock(&jobs->lock);
+	if (job_ix >= jobs->num_jobs)
+	    break;
+	jobs->job(jobs->data, job_ix, thread_ix);
+    }
+}
+
+static void *parallel_worker_run(void *v)
+/* a thread's jobs.  an errAbort in a thread isn't caught by the main thread's */
+/* errCatch, so it's caught here and the jobs not started yet are skipped */
+{
+    struct parallel_worker *worker = (struct parallel_worker *)v;
+    struct parallel_jobs *jobs = worker->jobs;
+    struct errCatch *errCatch = errCatchNew();
+    if (errCatchStart(errCatch))
+	parallel_worker_jobs(jobs, worker->thread_ix);
+    errCatchEnd(errCatch);
+    if (errCatch->gotError)
+    {
+	pthread_mutex_lock(&jobs->lock);
+	if (!jobs->error)
+	    jobs->error = cloneString(trimSpaces(errCatch->message->string));
+	jobs->next_job = jobs->num_jobs;
+	pthread_mutex_unlock(&jobs->lock);
+    }
+    errCatchFree(&errCatch);
+    return NULL;
+}
+
+void parallel_for(int num_threads, int num_jobs, void (*job)(void *data, int job_ix, int thread_ix), void *data)
+/* run job() for every job_ix in [0,num_jobs) using up to num_threads threads.  jobs are */
+/* handed out in order and thread_ix (0 to num_threads-1) lets the caller keep per-thread */
+/* things like open metaBigs.  returns once every job is finished.  an errAbort in a */
+/* job stops the jobs not started yet and is raised again here once the threads are done */
+{
+    struct parallel_jobs jobs;
+    struct parallel_worker *workers;
+    pthread_t *threads;
+    int i;
+    if (num_threads > num_jobs)
+	num_threads = num_jobs;
+    if (num_threads <= 1)
+    {
+	for (i = 0; i < num_jobs; i++)
+	    job(data, i, 0);
+	return;
+    }
+    pthread_mutex_init(&jobs.lock, NULL);
+    jobs.next_job = 0;
+    jobs.num_jobs = num_jobs;
+    jobs.job = job;
+    jobs.data = data;
+    jobs.error = NULL;
+    AllocArray(workers, num_threads);
+    AllocArray(threads, num_threads);
+    for (i = 0; i < num_threads; i++)
+    {
+	workers[i].jobs = &jobs;
+	workers[i].thread_ix = i;
+	if (pthread_create(&threads[i], NULL, parallel_worker_run, &workers[i]) != 0)
+	    errAbort("couldn't start thread %d", i);
+    }
+    for (i = 0; i < num_threads; i++)
+	pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&jobs.lock);
+    freeMem(workers);
+    freeMem(threads);
+    if (jobs.error)
+    {
+	/* copied to the stack so the message can be freed before errAbort */
+	char msg[1024];
+	snprintf(msg, sizeof(msg), "%s", jobs.error);
+	freeMem(jobs.error);
+	errAbort("%s", msg);
+    }
+}
+
+struct open_list_job
+/* what the threads in metaBigOpenList() share */
+{
+    char **names;
+    char *tmp_dir;
+    char *regions;
+    struct metaBig **mbs;
+    struct bbiSummaryElement *sums;     /* NULL if summaries aren't wanted. */
+    char **errors;                      /* Why each one failed, NULL if it didn't. */
+};
+
+static void open_list_job(void *data, int job_ix, int thread_ix)
+/* parallel_for() job: open one file, and read its summary if wanted */
+{
+    struct open_list_job *olj = (struct open_list_job *)data;
+    char *name = olj->names[job_ix];
+    struct errCatch *errCatch = errCatchNew();
+    if (errCatchStart(errCatch))
+    {
+	struct metaBig *mb = metaBigOpen_cached(name, olj->tmp_dir, olj->regions);
+	if (!mb)
+	{
+	    char msg[2*PATH_LEN];
+	    open_problem(name, msg, sizeof(msg));
+	    olj->errors[job_ix] = cloneString(msg);
+	}
+	else
+	{
+	    olj->mbs[job_ix] = mb;
+	    if (olj->sums)
+	    {
+		if (mb->type != isaBigWig)
+		    errAbort("%s isn't a bigWig", name);
+		olj->sums[job_ix] = bbiTotalSummary(mb->big.bbi);
+	    }
+	}
+    }
+    errCatchEnd(errCatch);
+    if (errCatch->gotError && !olj->errors[job_ix])
+	olj->errors[job_ix] = cloneString(trimSpaces(errCatch->message->string));
+    errCatchFree(&errCatch);
+}
+
+struct metaBig *metaBigOpenList(struct slName *files, char *tmp_dir, char *regions, struct bbiSummaryElement **pSums)
+/* open all the files at once with up to METABIG_OPEN_THREADS threads, since with */
+/* many files (or slow filesystems) most of the time goes to waiting.  the metaBigs */
+/* come back as a list in the same order as the files, each to be given back with */
+/* metaBigRelease().  with pSums, the whole-file summary of each is read too, into */
+/* an array in the same order.  files that can't be opened are each reported like */
+/* metaBigOpen_check() does, then it errAborts */
+{
+    struct open_list_job olj;
+    struct metaBig *list = NULL;
+    struct slName *file;
+    int num_files = slCount(files);
+    int num_failed = 0;
+    int i;
+    ZeroVar(&olj);
+    AllocArray(olj.names, num_files);
+    AllocArray(olj.mbs, num_files);
+    AllocArray(olj.errors, num_files);
+    for (file = files, i = 0; file != NULL; file = file->next, i++)
+	olj.names[i] = file->name;
+    olj.tmp_dir = tmp_dir;
+    olj.regions = regions;
+    if (pSums)
+	AllocArray(olj.sums, num_files);
+    parallel_for(METABIG_OPEN_THREADS, num_files, open_list_job, &olj);
+    for (i = 0; i < num_files; i++)
+	if (olj.errors[i])
+	{
+	    warn("%s", olj.errors[i]);
+	    num_failed++;
+	}
+    for (i = num_files - 1; i >= 0; i--)
+    {
+	if (num_failed > 0)
+	{
+	    if (olj.mbs[i])
+		metaBigRelease(&olj.mbs[i]);
+	}
+	else
+	    slAddHead(&list, olj.mbs[i]);
+	freeMem(olj.errors[i]);
+    }
+    freeMem(olj.errors);
+    freeMem(olj.mbs);
+    freeMem(olj.names);
+    if (num_failed > 0)
+    {
+	freeMem(olj.sums);
+	errAbort("%d of the %d bigWigs couldn't be opened", num_failed, num_files);
+    }
+    if (pSums)
+	*pSums = olj.sums;
+    return list;
+}
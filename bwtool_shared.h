@@ -22,14 +22,106 @@ void writeBw(char *inName, char *outName, struct hash *chromSizeHash);
 struct metaBig *metaBigOpen_check(char *bigfile, char *tmp_dir, char *regions);
 /* A wrapper for metaBigOpen that does some checking and erroring */
 
+struct metaBig *metaBigOpen_cached(char *bigfile, char *tmp_dir, char *regions);
+/* metaBigOpenWithTmpDir(), but when the cache is on and there are no regions, */
+/* an idle metaBig of the same file is handed back instead of opening it again. */
+/* a metaBig from here has to go back with metaBigRelease() */
+
+void metaBigRelease(struct metaBig **pMb);
+/* give back a metaBig from metaBigOpen_cached(): it stays open in the cache if the */
+/* cache is on, otherwise it's closed like metaBigClose() */
+
+void metaBigCacheEnable(int max_idle);
+/* keep up to max_idle released metaBigs open for reuse by later opens of the */
+/* same file.  0 turns it off again (closing what's cached) */
+
+void metaBigCacheFree();
+/* close all the idle metaBigs in the cache */
+
+void metaBigReleaseAll();
+/* close every metaBig from metaBigOpen_cached() that hasn't been given back.  for */
+/* after a command ends with errAbort and never releases what it had.  the cached */
+/* ones are closed too rather than kept, since the command could have stopped part */
+/* way through reading one */
+
+FILE *mustOpen_tracked(char *fileName, char *mode);
+/* mustOpen(), with the file remembered until carefulClose_tracked() so */
+/* close_tracked_files() can close it if the command ends with errAbort first */
+
+void carefulClose_tracked(FILE **pFile);
+/* carefulClose() a file from mustOpen_tracked() (or stdout) */
+
+void close_tracked_files();
+/* close every file from mustOpen_tracked() that's still open.  for after a command */
+/* ends with errAbort, so nothing is checked */
+
+/* files opened at once by metaBigOpenList() */
+#define METABIG_OPEN_THREADS 16
+
+struct metaBig *metaBigOpenList(struct slName *files, char *tmp_dir, char *regions, struct bbiSummaryElement **pSums);
+/* open all the files at once with up to METABIG_OPEN_THREADS threads, since with */
+/* many files (or slow filesystems) most of the time goes to waiting.  the metaBigs */
+/* come back as a list in the same order as the files, each to be given back with */
+/* metaBigRelease().  with pSums, the whole-file summary of each is read too, into */
+/* an array in the same order.  files that can't be opened are each reported like */
+/* metaBigOpen_check() does, then it errAborts */
+
+void bedCacheEnable(boolean on);
+/* keep beds read through readBed6Soft_cached() parsed for later reads of the same file */
+
+struct bed6 *readBed6Soft_cached(char *filename);
+/* readBed6Soft(), but when the bed cache is on, a file already read (and not changed */
+/* since) is copied from the cache instead of parsed again */
+
 void fuse_pbm(struct perBaseMatrix **pBig, struct perBaseMatrix **pTo_add, boolean add_coords);
 /* not this makes perhaps-illegal perBaseWigs where the chromEnd-chromStart are not the */
 /* same as the len... which may break things somewhere if this were ever library-ized */
 
+double *alloc_packed_block(int nrow, int ncol);
+/* a cache-line-aligned block for nrow rows of ncol doubles one after another.  it's */
+/* freed by unpack_perBaseMatrix() */
+
+double *pack_perBaseMatrix(struct perBaseMatrix *pbm);
+/* move the rows of the matrix into one cache-line-aligned row-major block and point */
+/* the rows (and matrix[]) into it.  returns the block, which has to be given back to */
+/* unpack_perBaseMatrix() before the matrix is freed */
+
+void unpack_perBaseMatrix(struct perBaseMatrix *pbm, double **pBlock);
+/* let go of the rows' data so free_perBaseMatrix()/free_cbm() don't free it row by */
+/* row, then free the block */
+
+boolean perBaseMatrixIsPacked(struct perBaseMatrix *pbm);
+/* whether the rows are still one after another in a single block, */
+/* e.g. not reordered by clustering */
+
+void meta_span_coords(struct bed6 *bed, int left, int right, int *pStart, int *pEnd);
+/* how an up:meta:down row is labelled: like the upstream, meta, and downstream pieces */
+/* fused together, so from the upstream end to the downstream end on either strand */
+
+void load_meta_span_rows(struct metaBig *mb, struct bed6 *regions, int left, int meta, int right,
+			 double fill, double **rows, int col);
+/* load_meta_span_perBaseMatrix() written into columns col onward of rows, a row per */
+/* region, so the rows can be part of a wider matrix */
+
+struct perBaseMatrix *load_meta_span_perBaseMatrix(struct metaBig *mb, struct bed6 *regions, int left, int meta,
+						   int right, double fill);
+/* for up:meta:down, load each region with left bases upstream and right bases downstream */
+/* in one go and make the row: upstream, the region resampled to meta bases, downstream, */
+/* all in the region's orientation */
+
 int calculate_meta_file(char *file_name);
 /* from all the beds one region file, get a single average */
 
 int calculate_meta_file_list(struct slName *region_list);
 /* from all the beds in all the region files, get a single average */
 
+int get_num_threads(struct hash *options);
+/* read the -threads option, defaulting to a single thread */
+
+void parallel_for(int num_threads, int num_jobs, void (*job)(void *data, int job_ix, int thread_ix), void *data);
+/* run job() for every job_ix in [0,num_jobs) using up to num_threads threads.  jobs are */
+/* handed out in order and thread_ix (0 to num_threads-1) lets the caller keep per-thread */
+/* things like open metaBigs.  returns once every job is finished.  an errAbort in a */
+/* job stops the jobs not started yet and is raised again here once the threads are done */
+
 #endif /* BWTOOL_SHARED_H */
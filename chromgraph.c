@@ -14,6 +14,7 @@
 #include <beato/bigs.h>
 #include "bwtool.h"
 #include "bwtool_shared.h"
+#include "profile.h"
 
 void usage_chromgraph()
 /* Explain usage of chromgraph program and exit. */
@@ -32,7 +33,7 @@ void bwtool_chromgraph(struct hash *options, char *favorites, char *regions, uns
 /* bwtool_chromgraph - main for making the chromgraph file */
 {
     struct metaBig *mb = metaBigOpen_check(bigfile, tmp_dir, regions);
-    FILE *output = mustOpen(outputfile, "w");
+    FILE *output = mustOpen_tracked(outputfile, "w");
     struct bed *section;
     struct bbiSummaryElement summary;
     unsigned every = sqlUnsigned((char *)hashOptionalVal(options, "every", "10000"));
@@ -46,7 +47,10 @@ void bwtool_chromgraph(struct hash *options, char *favorites, char *regions, uns
 	int numBases = 0;
 	double sum = 0;
 	int windowPos;
+	unsigned long long prof_start = PROFILE_START();
 	struct perBaseWig *pbw = perBaseWigLoadSingleContinue(mb, section->chrom, section->chromStart, section->chromEnd, FALSE, fill);
+	PROFILE_STOP(prof_load, prof_start);
+	PROFILE_COUNT(prof_sections, 1);
 
 	windowPos = pbw->chromStart;
 	while (windowPos < pbw->chromEnd)
@@ -70,6 +74,6 @@ void bwtool_chromgraph(struct hash *options, char *favorites, char *regions, uns
 	}
 	perBaseWigFreeList(&pbw);
     }
-    carefulClose(&output);
-    metaBigClose(&mb);
+    carefulClose_tracked(&output);
+    metaBigRelease(&mb);
 }
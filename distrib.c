@@ -14,6 +14,7 @@
 #include <beato/bigs.h>
 #include "bwtool.h"
 #include "bwtool_shared.h"
+#include "profile.h"
 
 void usage_distrib()
 /* Explain usage of distribution program and exit. */
@@ -33,7 +34,7 @@ void bwtool_distrib(struct hash *options, char *favorites, char *regions, unsign
 /* bwtool_distrib - main for distribution program */
 {
     struct metaBig *mb = metaBigOpen_check(bigfile, tmp_dir, regions);
-    FILE *output = mustOpen(outputfile, "w");
+    FILE *output;
     struct bed *section;
     int low = 0;
     int high = 0;
@@ -54,9 +55,12 @@ void bwtool_distrib(struct hash *options, char *favorites, char *regions, unsign
     AllocArray(counts, size);
     for (section = mb->sections; section != NULL; section = section->next)
     {
+	unsigned long long prof_start = PROFILE_START();
 	struct perBaseWig *pbwList = perBaseWigLoadContinue(mb, section->chrom, section->chromStart,
 							      section->chromEnd);
 	struct perBaseWig *pbw;
+	PROFILE_STOP(prof_load, prof_start);
+	PROFILE_COUNT(prof_sections, 1);
 	for (pbw = pbwList; pbw != NULL; pbw = pbw->next)
 	{
 	    int len = pbw->chromEnd - pbw->chromStart;
@@ -65,11 +69,11 @@ void bwtool_distrib(struct hash *options, char *favorites, char *regions, unsign
 	}
 	perBaseWigFreeList(&pbwList);
     }
-    output = mustOpen(outputfile, "w");
+    output = mustOpen_tracked(outputfile, "w");
     j = low;
     for (i = 0; i < size; i++)
 	fprintf(output, "%d\t%ld\n", j++, counts[i]);
-    carefulClose(&output);
+    carefulClose_tracked(&output);
     freeMem(counts);
-    metaBigClose(&mb);
+    metaBigRelease(&mb);
 }
@@ -13,6 +13,9 @@
 #include <jkweb/bigWig.h>
 #include <beato/bigs.h>
 #include "bwtool.h"
+#include "bwtool_shared.h"
+#include "blockcache.h"
+#include "prefetch.h"
 
 #include <math.h>
 
@@ -105,10 +108,11 @@ void bwtool_extract(struct hash *options, char *regions, unsigned decimals, doub
     boolean locus_name = (hashFindVal(options, "locus-name") != NULL) ? TRUE : FALSE;
     int orig_size = 0;
     struct bed6 *region_list = readBed6SoftAndSize(regions, &orig_size);
-    struct metaBig *mb = metaBigOpenWithTmpDir(bigfile, tmp_dir, NULL);
+    struct metaBig *mb = metaBigOpen_cached(bigfile, tmp_dir, NULL);
     if (!mb)
 	errAbort("problem opening %s", bigfile);
-    FILE *out = mustOpen(outputfile, "w");
+    prefetch_regions(mb, region_list, 0, tmp_dir, get_prefetch_connections(options));
+    FILE *out = mustOpen_tracked(outputfile, "w");
     struct bed6 *section;
     enum style_type style = nothing;
     if (sameWord(style_s, "bed"))
@@ -121,8 +125,8 @@ void bwtool_extract(struct hash *options, char *regions, unsigned decimals, doub
     /* loop through each region */
     for (section = region_list; section != NULL; section = section->next)
     {
-	struct perBaseWig *pbw = perBaseWigLoadSingleContinue(mb, section->chrom, section->chromStart,
-							      section->chromEnd, (section->strand[0] == '-') ? TRUE : FALSE, fill);
+	struct perBaseWig *pbw = perBaseWigLoad_cached(mb, section->chrom, section->chromStart,
+						       section->chromEnd, (section->strand[0] == '-') ? TRUE : FALSE, fill);
 	if (style == bed)
 	    /* for bed there is no name manipulation */
 	    extractOutBed(out, section, orig_size, decimals, pbw, tabs);
@@ -149,7 +153,7 @@ void bwtool_extract(struct hash *options, char *regions, unsigned decimals, doub
 	perBaseWigFree(&pbw);
 	section_num++;
     }
-    metaBigClose(&mb);
+    metaBigRelease(&mb);
     bed6FreeList(&region_list);
-    carefulClose(&out);
+    carefulClose_tracked(&out);
 }
@@ -14,6 +14,7 @@
 #include <beato/bigs.h>
 #include "bwtool.h"
 #include "bwtool_shared.h"
+#include "profile.h"
 
 void usage_fill()
 /* Explain usage and exit. */
@@ -34,18 +35,23 @@ void bwtool_fill(struct hash *options, char *favorites, char *regions, unsigned
     struct metaBig *mb = metaBigOpen_check(bigfile, tmp_dir, regions);
     char wigfile[512];
     safef(wigfile, sizeof(wigfile), "%s.tmp.wig", outputfile);
-    FILE *out = mustOpen(wigfile, "w");
+    FILE *out = mustOpen_tracked(wigfile, "w");
     struct bed *section;
     int i;
     for (section = mb->sections; section != NULL; section = section->next)
     {
+	unsigned long long prof_start = PROFILE_START();
 	struct perBaseWig *pbw = perBaseWigLoadSingleContinue(mb, section->chrom, section->chromStart,
 							      section->chromEnd, FALSE, val);
+	PROFILE_STOP(prof_load, prof_start);
+	PROFILE_COUNT(prof_sections, 1);
+	prof_start = PROFILE_START();
 	perBaseWigOutput(pbw, out, wot, decimals, NULL, FALSE, condense);
+	PROFILE_STOP(prof_format, prof_start);
 	perBaseWigFree(&pbw);
     }
-    carefulClose(&out);
+    carefulClose_tracked(&out);
     writeBw(wigfile, outputfile, mb->chromSizeHash);
     remove(wigfile);
-    metaBigClose(&mb);
+    metaBigRelease(&mb);
 }
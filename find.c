@@ -14,11 +14,14 @@
 #include <beato/bigs.h>
 #include "bwtool.h"
 #include "bwtool_shared.h"
+#include "profile.h"
 #include <jkweb/rangeTree.h>
 #include <beato/extrema.h>
 
 #include <float.h>
 
+#define NANUM sqrt(-1)
+
 void usage_find()
 /* Explain usage and exit. */
 {
@@ -40,6 +43,8 @@ errAbort(
   "        -with-max         output the maximum value just after the bed12.\n"
   "        -median-base      if there are multiple tied maxima, output the median base location\n"
   "                          instead of all of them.\n"
+  "        -threads=n        look through the regions using n threads.  Output is in the\n"
+  "                          same order as the bed regardless.\n"
   );
 }
 
@@ -90,10 +95,10 @@ void bwtool_find_extrema(struct hash *options, char *favorites, char *regions, u
 	other_list = extrema_find(other_big, min_sep, rem);
 	extrema_find_shifts(main_list, other_list, shift);
     }
-    metaBigClose(&main_big);
+    metaBigRelease(&main_big);
     if (other_big)
-	metaBigClose(&other_big);
-    out = mustOpen(outputfile, "w");
+	metaBigRelease(&other_big);
+    out = mustOpen_tracked(outputfile, "w");
     if (other_bigfile)
 	for (ex = main_list; ex != NULL; ex = ex->next)
 	    fprintf(out, "%s\t%d\t%d\t%d\t1000\t%c\n", ex->chrom, ex->chromStart, ex->chromStart+1, (int)ex->val, ex->min_or_max);
@@ -103,7 +108,7 @@ void bwtool_find_extrema(struct hash *options, char *favorites, char *regions, u
 	for (ex = main_list; ex != NULL; ex = ex->next)
 	    fprintf(out, "%s\t%d\t%d\t%0.*f\t1000\t%c\n", ex->chrom, ex->chromStart, ex->chromStart+1, decimals, ex->val, ex->min_or_max);
     }
-    carefulClose(&out);
+    carefulClose_tracked(&out);
     extrema_free_list(&main_list);
 }
 
@@ -165,15 +170,18 @@ void bwtool_find_thresh(struct hash *options, char *favorites, char *regions, do
     enum bw_op_type op= get_bw_op_type(thresh_type, inverse);
     struct metaBig *mb = metaBigOpen_check(bigfile, tmp_dir, regions);
     double thresh = sqlDouble(thresh_s);
-    FILE *out = mustOpen(outputfile, "w");
+    FILE *out = mustOpen_tracked(outputfile, "w");
     struct bed out_bed;
     struct bed *section;
     for (section = mb->sections; section != NULL; section = section->next)
     {
+	unsigned long long prof_start = PROFILE_START();
 	struct perBaseWig *pbwList = perBaseWigLoadContinue(mb, section->chrom, section->chromStart,
 							      section->chromEnd);
 	struct perBaseWig *pbw;
 	int i, len;
+	PROFILE_STOP(prof_load, prof_start);
+	PROFILE_COUNT(prof_sections, 1);
 	if (pbwList)
 	{
 	    out_bed.chrom = pbwList->chrom;
@@ -197,8 +205,8 @@ void bwtool_find_thresh(struct hash *options, char *favorites, char *regions, do
 	perBaseWigFree(&pbwList);
 	}
     }
-    metaBigClose(&mb);
-    carefulClose(&out);
+    metaBigRelease(&mb);
+    carefulClose_tracked(&out);
 }
 
 static struct bed *bed12FromBed6(struct bed6 **pList)
@@ -227,105 +235,230 @@ static struct bed *bed12FromBed6(struct bed6 **pList)
     return list;
 }
 
-static int median_base_calc(struct slInt **pList)
-/* in a list of ints, find the median.  straight-forward enough. */
+/* regions are split into bins of about this many bases when using the zoom levels */
+/* to skip parts that can't contain the maximum */
+#define MAXIMA_BIN_SIZE 4096
+/* regions are handled this many at a time so tied positions don't pile up in memory */
+#define MAXIMA_BATCH 1024
+
+struct region_max
+/* the maximum of one region and all the bases it's found at */
+{
+    double max;
+    int num_pos;
+    int alloc_pos;
+    int *pos;             /* offsets from the start of the region */
+};
+
+struct max_bin
+/* a part of a region with an upper bound on its values from the zoom summary */
+{
+    int start;
+    int end;
+    double bound;
+};
+
+static int max_bin_cmp(const void *va, const void *vb)
+/* sort bins highest bound first */
 {
-    struct slInt *list;
-    if (!pList || !*pList)
+    const struct max_bin *a = (struct max_bin *)va;
+    const struct max_bin *b = (struct max_bin *)vb;
+    if (a->bound > b->bound)
 	return -1;
-    int size = slCount(*pList);
-    list = *pList;
-    if (size == 1)
-	return list->val;
-    int i = 0;
-    struct slInt *cur;
-    slSort(pList, slIntCmp);
-    list = *pList;
-    if (size % 2 == 0)
-    {	
-	for (cur = list, i = 0; ((cur != NULL) && (i < (size/2)-1)); cur = cur->next, i++)
-	     ;
-	return (cur->val + cur->next->val)/2;
-    } 
-    for (cur = list, i = 0; ((cur != NULL) && (i < (size/2))); cur = cur->next, i++)
-	;
-    return cur->val;
+    if (a->bound < b->bound)
+	return 1;
+    return a->start - b->start;
 }
 
-void bwtool_find_max(struct hash *options, char *favorites, char *regions, double fill,
-		     char *bigfile, char *tmp_dir, char *outputfile)
-/* find max points in a range */
+static int int_cmp(const void *va, const void *vb)
+/* compare ints for qsort */
 {
-    boolean med_base = (hashFindVal(options, "median-base") != NULL) ? TRUE : FALSE;
-    boolean with_max = (hashFindVal(options, "with-max") != NULL) ? TRUE : FALSE;
-    struct metaBig *mb = metaBigOpen_check(bigfile, tmp_dir, NULL);
-    FILE *out = mustOpen(outputfile, "w");
-    struct bed6 *sections6 = readBed6Soft(regions);
-    struct bed *sections = bed12FromBed6(&sections6);
-    struct bed *section;
-    for (section = sections; section != NULL; section = section->next)
+    const int *a = (int *)va;
+    const int *b = (int *)vb;
+    return *a - *b;
+}
+
+static void add_max_pos(struct region_max *rm, int pos)
+/* add a position to the growable array of tied positions */
+{
+    if (rm->num_pos == rm->alloc_pos)
     {
-	struct perBaseWig *pbwList = perBaseWigLoadContinue(mb, section->chrom, section->chromStart,
-							      section->chromEnd);
-	struct perBaseWig *pbw;
-	struct slInt *ii;
-	int i, size;
-	double max = -DBL_MAX;
-	struct slInt *list = NULL;
-	for (pbw = pbwList; pbw != NULL; pbw = pbw->next)
+	int new_alloc = (rm->alloc_pos == 0) ? 16 : rm->alloc_pos * 2;
+	ExpandArray(rm->pos, rm->alloc_pos, new_alloc);
+	rm->alloc_pos = new_alloc;
+    }
+    rm->pos[rm->num_pos++] = pos;
+}
+
+static void scan_for_max(struct metaBig *mb, struct bed *section, int start, int end, struct region_max *rm)
+/* decode start-end of the section and update the running maximum */
+{
+    unsigned long long prof_start = PROFILE_START();
+    struct perBaseWig *pbwList = perBaseWigLoadContinue(mb, section->chrom, start, end);
+    struct perBaseWig *pbw;
+    PROFILE_STOP(prof_load, prof_start);
+    PROFILE_COUNT(prof_sections, 1);
+    for (pbw = pbwList; pbw != NULL; pbw = pbw->next)
+    {
+	int pbw_off = pbw->chromStart - section->chromStart;
+	int lo = (start > pbw->chromStart) ? start - pbw->chromStart : 0;
+	int hi = (end < pbw->chromStart + pbw->len) ? end - pbw->chromStart : pbw->len;
+	int i;
+	for (i = lo; i < hi; i++)
 	{
-	    int pbw_off = pbw->chromStart - section->chromStart;
-	    for (i = 0; i < pbw->len; i++)
+	    if (pbw->data[i] > rm->max)
 	    {
-		if (pbw->data[i] > max)
-		{
-		    slFreeList(&list);
-		    struct slInt *new_int = slIntNew(i + pbw_off);
-		    slAddHead(&list, new_int);
-		    max = pbw->data[i];
-		}
-		else if (pbw->data[i] == max)
-		{
-		    struct slInt *new_int = slIntNew(i + pbw_off);
-		    slAddHead(&list, new_int);
-		}
+		rm->max = pbw->data[i];
+		rm->num_pos = 0;
+		add_max_pos(rm, i + pbw_off);
 	    }
+	    else if (pbw->data[i] == rm->max)
+		add_max_pos(rm, i + pbw_off);
 	}
-	slReverse(&list);
-	if (list)
+    }
+    perBaseWigFreeList(&pbwList);
+}
+
+static void find_region_max(struct metaBig *mb, struct bed *section, struct region_max *rm)
+/* find the max of a region.  for bigger regions, get the max of each bin from the zoom */
+/* levels first and only decode the bins that could still hold (or tie) the maximum */
+{
+    int len = section->chromEnd - section->chromStart;
+    int num_bins = len / MAXIMA_BIN_SIZE;
+    rm->max = -DBL_MAX;
+    rm->num_pos = 0;
+    if ((num_bins < 2) || (mb->type != isaBigWig))
+	scan_for_max(mb, section, section->chromStart, section->chromEnd, rm);
+    else
+    {
+	struct bbiSummaryElement *sums;
+	struct max_bin *bins;
+	int i, num_used = 0;
+	AllocArray(sums, num_bins);
+	AllocArray(bins, num_bins);
+	if (bigWigSummaryArrayExtended(mb->big.bbi, section->chrom, section->chromStart, section->chromEnd, num_bins, sums))
 	{
-	    size = slCount(list);
-	    if (med_base)
-	    {
-		section->blockCount = 1;
-		AllocArray(section->blockSizes, sizeof(int));
-		AllocArray(section->chromStarts, sizeof(int));
-		section->blockSizes[0] = 1;
-		section->chromStarts[0] = median_base_calc(&list);
-	    }
-	    else
-	    {
-		section->blockCount = size;
-		AllocArray(section->blockSizes, sizeof(int) * size);
-		AllocArray(section->chromStarts, sizeof(int) * size);
-		for (i = 0, ii = list; (i < size) && (ii != NULL); i++, ii = ii->next)
+	    for (i = 0; i < num_bins; i++)
+		/* the summary zeroes the array, so a bin without data has no valid bases */
+		if (sums[i].validCount > 0)
 		{
-		    section->blockSizes[i] = 1;
-		    section->chromStarts[i] = ii->val;
+		    /* same bin boundaries as the summary uses */
+		    bins[num_used].start = section->chromStart + (int)(((long long)len * i) / num_bins);
+		    bins[num_used].end = section->chromStart + (int)(((long long)len * (i+1)) / num_bins);
+		    bins[num_used].bound = sums[i].maxVal;
+		    num_used++;
 		}
-	    }
-	    if (!with_max)
-		bedTabOutN(section, 12, out);
-	    else
-	    {
-		bedOutputN(section, 12, out, '\t', '\t');
-		fprintf(out, "%f\n", max);
-	    }
-	    slFreeList(&list);
+	    qsort(bins, num_used, sizeof(bins[0]), max_bin_cmp);
+	    for (i = 0; (i < num_used) && (bins[i].bound >= rm->max); i++)
+		scan_for_max(mb, section, bins[i].start, bins[i].end, rm);
 	}
-	perBaseWigFree(&pbwList);
+	freeMem(sums);
+	freeMem(bins);
+    }
+    if (rm->num_pos > 1)
+	qsort(rm->pos, rm->num_pos, sizeof(int), int_cmp);
+}
+
+static int median_base_calc(struct region_max *rm)
+/* in the sorted positions, find the median.  straight-forward enough. */
+{
+    int size = rm->num_pos;
+    if (size == 0)
+	return -1;
+    if (size % 2 == 0)
+	return (rm->pos[size/2 - 1] + rm->pos[size/2])/2;
+    return rm->pos[size/2];
+}
+
+static void output_region_max(struct bed *section, struct region_max *rm, boolean med_base, boolean with_max, FILE *out)
+/* output the region as a bed12 with a block for each maximum */
+{
+    int i;
+    if (rm->num_pos == 0)
+	return;
+    if (med_base)
+    {
+	section->blockCount = 1;
+	AllocArray(section->blockSizes, 1);
+	AllocArray(section->chromStarts, 1);
+	section->blockSizes[0] = 1;
+	section->chromStarts[0] = median_base_calc(rm);
+    }
+    else
+    {
+	section->blockCount = rm->num_pos;
+	AllocArray(section->blockSizes, rm->num_pos);
+	AllocArray(section->chromStarts, rm->num_pos);
+	for (i = 0; i < rm->num_pos; i++)
+	{
+	    section->blockSizes[i] = 1;
+	    section->chromStarts[i] = rm->pos[i];
+	}
+    }
+    if (!with_max)
+	bedTabOutN(section, 12, out);
+    else
+    {
+	bedOutputN(section, 12, out, '\t', '\t');
+	fprintf(out, "%f\n", rm->max);
+    }
+}
+
+struct find_max_batch
+/* a batch of regions worked on by the threads */
+{
+    struct metaBig **mbs;           /* one open bigWig per thread */
+    struct bed **sections;
+    struct region_max *results;
+};
+
+static void find_max_job(void *data, int job_ix, int thread_ix)
+/* parallel_for() job: one region */
+{
+    struct find_max_batch *batch = (struct find_max_batch *)data;
+    find_region_max(batch->mbs[thread_ix], batch->sections[job_ix], &batch->results[job_ix]);
+}
+
+void bwtool_find_max(struct hash *options, char *favorites, char *regions, double fill,
+		     char *bigfile, char *tmp_dir, char *outputfile)
+/* find max points in a range */
+{
+    boolean med_base = (hashFindVal(options, "median-base") != NULL) ? TRUE : FALSE;
+    boolean with_max = (hashFindVal(options, "with-max") != NULL) ? TRUE : FALSE;
+    int num_threads = get_num_threads(options);
+    struct bed6 *sections6 = readBed6Soft_cached(regions);
+    struct bed *sections = bed12FromBed6(&sections6);
+    int num_sections = slCount(sections);
+    struct find_max_batch batch;
+    struct bed **section_array;
+    struct bed *section;
+    int i, j;
+    if (num_threads > num_sections)
+	num_threads = (num_sections > 0) ? num_sections : 1;
+    AllocArray(batch.mbs, num_threads);
+    for (i = 0; i < num_threads; i++)
+	batch.mbs[i] = metaBigOpen_check(bigfile, tmp_dir, NULL);
+    FILE *out = mustOpen_tracked(outputfile, "w");
+    AllocArray(section_array, num_sections);
+    for (section = sections, i = 0; section != NULL; section = section->next, i++)
+	section_array[i] = section;
+    AllocArray(batch.results, MAXIMA_BATCH);
+    for (i = 0; i < num_sections; i += MAXIMA_BATCH)
+    {
+	int batch_size = (num_sections - i < MAXIMA_BATCH) ? num_sections - i : MAXIMA_BATCH;
+	batch.sections = section_array + i;
+	parallel_for(num_threads, batch_size, find_max_job, &batch);
+	/* output in the same order as the bed */
+	for (j = 0; j < batch_size; j++)
+	    output_region_max(batch.sections[j], &batch.results[j], med_base, with_max, out);
     }
-    metaBigClose(&mb);
+    for (i = 0; i < MAXIMA_BATCH; i++)
+	freeMem(batch.results[i].pos);
+    freeMem(batch.results);
+    freeMem(section_array);
+    for (i = 0; i < num_threads; i++)
+	metaBigRelease(&batch.mbs[i]);
+    freeMem(batch.mbs);
     bedFreeList(&sections);
-    carefulClose(&out);
+    carefulClose_tracked(&out);
 }
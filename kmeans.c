@@ -0,0 +1,653 @@
+/* k-means clustering for matrix and aggregate */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <jkweb/common.h>
+#include <jkweb/hash.h>
+#include <jkweb/sqlNum.h>
+#include <beato/bigs.h>
+#include <beato/cluster.h>
+#include "bwtool_shared.h"
+#include "kmeans.h"
+#include "profile.h"
+#include "memtrack.h"
+#include "resample.h"
+
+#include <stdint.h>
+#include <math.h>
+
+#define NANUM sqrt(-1)
+
+/* rows handed to each thread at a time */
+#define KMEANS_CHUNK 1024
+
+/* iterations if -cluster-max-iter isn't given */
+#define KMEANS_MAX_ITER 300
+
+void kmeans_params_from_options(struct hash *options, int k, struct kmeans_params *params)
+/* fill in the params from -seed, -cluster-mini-batch, -cluster-max-iter, -cluster-reduce, */
+/* and -threads */
+{
+    char *reduce_s = (char *)hashFindVal(options, "cluster-reduce");
+    params->k = k;
+    params->seed = sqlUnsignedLong((char *)hashOptionalVal(options, "seed", "0"));
+    params->num_threads = get_num_threads(options);
+    char *max_iter_s = (char *)hashFindVal(options, "cluster-max-iter");
+    params->max_iter = (max_iter_s) ? (int)sqlUnsigned(max_iter_s) : KMEANS_MAX_ITER;
+    params->batch_size = (int)sqlUnsigned((char *)hashOptionalVal(options, "cluster-mini-batch", "0"));
+    if (params->max_iter < 1)
+	errAbort("-cluster-max-iter should be at least 1");
+    params->reduce = reduce_none;
+    params->reduce_dim = 0;
+    if (reduce_s)
+    {
+	char *colon = strchr(reduce_s, ':');
+	if (!colon)
+	    errAbort("-cluster-reduce should be paa:n or random:n");
+	*colon = '\0';
+	if (sameString(reduce_s, "paa"))
+	    params->reduce = reduce_paa;
+	else if (sameString(reduce_s, "random"))
+	    params->reduce = reduce_random;
+	else
+	    errAbort("-cluster-reduce should be paa:n or random:n");
+	params->reduce_dim = (int)sqlUnsigned(colon + 1);
+	*colon = ':';
+	if (params->reduce_dim < 1)
+	    errAbort("-cluster-reduce needs n to be at least 1");
+    }
+}
+
+static uint64_t rng_next(uint64_t *state)
+/* splitmix64, so the same seed gives the same numbers everywhere */
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double rng_uniform(uint64_t *state)
+/* uniform in [0,1) */
+{
+    return (rng_next(state) >> 11) * (1.0/9007199254740992.0);
+}
+
+static double sq_dist(const double *a, const double *b, int dim)
+/* squared euclidean distance.  four sums so the loop pipelines and vectorizes */
+/* without needing to reorder the additions */
+{
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i;
+    for (i = 0; i + 4 <= dim; i += 4)
+    {
+	double d0 = a[i] - b[i];
+	double d1 = a[i+1] - b[i+1];
+	double d2 = a[i+2] - b[i+2];
+	double d3 = a[i+3] - b[i+3];
+	s0 += d0 * d0;
+	s1 += d1 * d1;
+	s2 += d2 * d2;
+	s3 += d3 * d3;
+    }
+    for (; i < dim; i++)
+    {
+	double d = a[i] - b[i];
+	s0 += d * d;
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+struct kmeans_state
+/* everything the threads share while clustering */
+{
+    double **rows;
+    int n;
+    int dim;
+    int k;
+    double *centroids;          /* k x dim */
+    int *labels;
+    double *upper;              /* Upper bound on the distance to the row's centroid. */
+    double *lower;              /* Lower bound on the distance to any other centroid. */
+    double *half_gap;           /* Half the distance from each centroid to its nearest other one. */
+    double *min_sq;             /* For seeding: squared distance to the nearest centroid so far. */
+    int new_centroid;           /* For seeding: the centroid just added. */
+    int *batch;                 /* For mini-batch: the rows in the batch. */
+    int *batch_labels;
+    int batch_size;
+    int *changed;               /* Per chunk, how many rows changed cluster. */
+};
+
+static int num_chunks(int n)
+/* chunks of rows for parallel_for() */
+{
+    return (n + KMEANS_CHUNK - 1) / KMEANS_CHUNK;
+}
+
+static int nearest(struct kmeans_state *st, const double *row, double *pD1, double *pD2)
+/* find the nearest centroid, with the distance to it and to the second nearest */
+{
+    double d1 = INFINITY, d2 = INFINITY;
+    int best = 0;
+    int j;
+    for (j = 0; j < st->k; j++)
+    {
+	double d = sq_dist(row, st->centroids + (size_t)j * st->dim, st->dim);
+	if (d < d1)
+	{
+	    d2 = d1;
+	    d1 = d;
+	    best = j;
+	}
+	else if (d < d2)
+	    d2 = d;
+    }
+    if (pD1)
+	*pD1 = sqrt(d1);
+    if (pD2)
+	*pD2 = sqrt(d2);
+    return best;
+}
+
+static void seed_job(void *data, int job_ix, int thread_ix)
+/* parallel_for() job: bring the nearest-centroid distances up to date with the new one */
+{
+    struct kmeans_state *st = (struct kmeans_state *)data;
+    const double *c = st->centroids + (size_t)st->new_centroid * st->dim;
+    int end = (job_ix + 1) * KMEANS_CHUNK;
+    int i;
+    if (end > st->n)
+	end = st->n;
+    for (i = job_ix * KMEANS_CHUNK; i < end; i++)
+    {
+	double d = sq_dist(st->rows[i], c, st->dim);
+	if (d < st->min_sq[i])
+	    st->min_sq[i] = d;
+    }
+}
+
+static void seed_plus_plus(struct kmeans_state *st, uint64_t *rng, int num_threads)
+/* k-means++: each centroid after the first is a row picked with probability */
+/* proportional to its squared distance from the centroids already picked */
+{
+    int i, j;
+    int first = (int)(rng_uniform(rng) * st->n);
+    AllocArray(st->min_sq, st->n);
+    for (i = 0; i < st->n; i++)
+	st->min_sq[i] = INFINITY;
+    memcpy(st->centroids, st->rows[first], st->dim * sizeof(double));
+    for (j = 1; j < st->k; j++)
+    {
+	double total = 0, target, cum = 0;
+	int pick = st->n - 1;
+	st->new_centroid = j - 1;
+	parallel_for(num_threads, num_chunks(st->n), seed_job, st);
+	for (i = 0; i < st->n; i++)
+	    total += st->min_sq[i];
+	if (total > 0)
+	{
+	    target = rng_uniform(rng) * total;
+	    for (i = 0; i < st->n; i++)
+	    {
+		cum += st->min_sq[i];
+		if (cum > target)
+		{
+		    pick = i;
+		    break;
+		}
+	    }
+	}
+	else
+	    /* fewer distinct rows than clusters */
+	    pick = (int)(rng_uniform(rng) * st->n);
+	memcpy(st->centroids + (size_t)j * st->dim, st->rows[pick], st->dim * sizeof(double));
+    }
+    freez(&st->min_sq);
+}
+
+static void assign_job(void *data, int job_ix, int thread_ix)
+/* parallel_for() job: Hamerly's assignment step for one chunk of rows.  the full scan */
+/* over the centroids is only done when the bounds can't rule a change out */
+{
+    struct kmeans_state *st = (struct kmeans_state *)data;
+    int end = (job_ix + 1) * KMEANS_CHUNK;
+    int changed = 0;
+    int i;
+    if (end > st->n)
+	end = st->n;
+    for (i = job_ix * KMEANS_CHUNK; i < end; i++)
+    {
+	int a = st->labels[i];
+	double m = (st->half_gap[a] > st->lower[i]) ? st->half_gap[a] : st->lower[i];
+	if (st->upper[i] <= m)
+	    continue;
+	st->upper[i] = sqrt(sq_dist(st->rows[i], st->centroids + (size_t)a * st->dim, st->dim));
+	if (st->upper[i] <= m)
+	    continue;
+	st->labels[i] = nearest(st, st->rows[i], &st->upper[i], &st->lower[i]);
+	if (st->labels[i] != a)
+	    changed++;
+    }
+    st->changed[job_ix] = changed;
+}
+
+static void batch_job(void *data, int job_ix, int thread_ix)
+/* parallel_for() job: nearest centroid for one chunk of a mini-batch */
+{
+    struct kmeans_state *st = (struct kmeans_state *)data;
+    int end = (job_ix + 1) * KMEANS_CHUNK;
+    int i;
+    if (end > st->batch_size)
+	end = st->batch_size;
+    for (i = job_ix * KMEANS_CHUNK; i < end; i++)
+	st->batch_labels[i] = nearest(st, st->rows[st->batch[i]], NULL, NULL);
+}
+
+static void update_half_gaps(struct kmeans_state *st)
+/* half the distance from each centroid to the closest other one.  a row closer than */
+/* that to its centroid can't be closer to any other */
+{
+    int j, jj;
+    for (j = 0; j < st->k; j++)
+	st->half_gap[j] = INFINITY;
+    for (j = 0; j < st->k; j++)
+	for (jj = j + 1; jj < st->k; jj++)
+	{
+	    double d = 0.5 * sqrt(sq_dist(st->centroids + (size_t)j * st->dim, st->centroids + (size_t)jj * st->dim, st->dim));
+	    if (d < st->half_gap[j])
+		st->half_gap[j] = d;
+	    if (d < st->half_gap[jj])
+		st->half_gap[jj] = d;
+	}
+}
+
+static void move_centroids(struct kmeans_state *st)
+/* put each centroid at the mean of its rows and loosen the bounds by how far the */
+/* centroids moved.  a centroid with no rows stays where it is */
+{
+    double *sums, *moved;
+    int *sizes;
+    double max_moved = 0, second_moved = 0;
+    int max_ix = -1;
+    int i, j, d;
+    AllocArray(sums, (size_t)st->k * st->dim);
+    AllocArray(sizes, st->k);
+    AllocArray(moved, st->k);
+    for (i = 0; i < st->n; i++)
+    {
+	double *sum = sums + (size_t)st->labels[i] * st->dim;
+	const double *row = st->rows[i];
+	for (d = 0; d < st->dim; d++)
+	    sum[d] += row[d];
+	sizes[st->labels[i]]++;
+    }
+    for (j = 0; j < st->k; j++)
+    {
+	double *c = st->centroids + (size_t)j * st->dim;
+	double *sum = sums + (size_t)j * st->dim;
+	if (sizes[j] == 0)
+	    continue;
+	for (d = 0; d < st->dim; d++)
+	    sum[d] /= sizes[j];
+	moved[j] = sqrt(sq_dist(c, sum, st->dim));
+	memcpy(c, sum, st->dim * sizeof(double));
+	if (moved[j] > max_moved)
+	{
+	    second_moved = max_moved;
+	    max_moved = moved[j];
+	    max_ix = j;
+	}
+	else if (moved[j] > second_moved)
+	    second_moved = moved[j];
+    }
+    for (i = 0; i < st->n; i++)
+    {
+	st->upper[i] += moved[st->labels[i]];
+	st->lower[i] -= (st->labels[i] == max_ix) ? second_moved : max_moved;
+    }
+    freeMem(sums);
+    freeMem(sizes);
+    freeMem(moved);
+}
+
+static void mini_batch(struct kmeans_state *st, struct kmeans_params *params, uint64_t *rng)
+/* Sculley's mini-batch k-means: each iteration nudges the centroids toward a random */
+/* batch of rows, with a per-centroid learning rate that shrinks as it sees more rows */
+{
+    int *counts;
+    int iter, i, d;
+    st->batch_size = (params->batch_size < st->n) ? params->batch_size : st->n;
+    AllocArray(st->batch, st->batch_size);
+    AllocArray(st->batch_labels, st->batch_size);
+    AllocArray(counts, st->k);
+    for (iter = 0; iter < params->max_iter; iter++)
+    {
+	for (i = 0; i < st->batch_size; i++)
+	    st->batch[i] = (int)(rng_uniform(rng) * st->n);
+	parallel_for(params->num_threads, num_chunks(st->batch_size), batch_job, st);
+	for (i = 0; i < st->batch_size; i++)
+	{
+	    int j = st->batch_labels[i];
+	    double *c = st->centroids + (size_t)j * st->dim;
+	    const double *row = st->rows[st->batch[i]];
+	    double eta = 1.0 / ++counts[j];
+	    for (d = 0; d < st->dim; d++)
+		c[d] += eta * (row[d] - c[d]);
+	}
+    }
+    freez(&st->batch);
+    freez(&st->batch_labels);
+    freeMem(counts);
+}
+
+int *kmeans(double **rows, int n, int dim, struct kmeans_params *params)
+/* cluster n rows of dim values (with no NA) and return the cluster of each row.  */
+/* seeding is k-means++ and the iterations use Hamerly's bounds to skip most of the */
+/* distance computations */
+{
+    struct kmeans_state st;
+    uint64_t rng = params->seed;
+    size_t state_size;
+    int iter, i;
+    if (params->k > n)
+	errAbort("can't make %d clusters from %d rows", params->k, n);
+    ZeroVar(&st);
+    st.rows = rows;
+    st.n = n;
+    st.dim = dim;
+    st.k = params->k;
+    AllocArray(st.centroids, (size_t)st.k * dim);
+    AllocArray(st.labels, n);
+    AllocArray(st.upper, n);
+    AllocArray(st.lower, n);
+    AllocArray(st.half_gap, st.k);
+    AllocArray(st.changed, num_chunks(n));
+    state_size = ((size_t)st.k * dim + st.k + 2 * (size_t)n) * sizeof(double) + (size_t)n * sizeof(int);
+    memTrackAdd(mem_cluster, state_size);
+    seed_plus_plus(&st, &rng, params->num_threads);
+    if (params->batch_size > 0)
+	mini_batch(&st, params, &rng);
+    /* no bounds yet, so every row gets a full look the first time */
+    for (i = 0; i < n; i++)
+	st.upper[i] = INFINITY;
+    for (iter = 0; iter < params->max_iter; iter++)
+    {
+	int changed = 0;
+	update_half_gaps(&st);
+	parallel_for(params->num_threads, num_chunks(n), assign_job, &st);
+	for (i = 0; i < num_chunks(n); i++)
+	    changed += st.changed[i];
+	verbose(2, "k-means iteration %d: %d rows changed cluster\n", iter + 1, changed);
+	/* mini-batch only needs the one pass to put the rows with their centroids */
+	if ((params->batch_size > 0) || ((iter > 0) && (changed == 0)))
+	    break;
+	move_centroids(&st);
+    }
+    freeMem(st.centroids);
+    freeMem(st.upper);
+    freeMem(st.lower);
+    freeMem(st.half_gap);
+    freeMem(st.changed);
+    memTrackSub(mem_cluster, state_size);
+    return st.labels;
+}
+
+struct sparse_projection
+/* Achlioptas' sparse projection: each entry is +-sqrt(3/dim) with probability 1/6 each */
+/* and 0 otherwise, so distances are kept roughly.  only the nonzero entries are kept, */
+/* so about two thirds of the products are never done */
+{
+    int dim;
+    double scale;
+    int *start;                 /* dim+1 offsets into cols. */
+    int *cols;                  /* Column d of a + entry, or -(d+1) of a - one. */
+};
+
+static struct sparse_projection *random_projection(int len, int dim, unsigned long seed)
+/* draw the projection from the seed, dim rows of len */
+{
+    uint64_t rng = seed ^ 0x5deece66dULL;
+    struct sparse_projection *proj;
+    int alloc_cols = len / 2 + 16;
+    int num_cols = 0;
+    int j, d;
+    AllocVar(proj);
+    proj->dim = dim;
+    proj->scale = sqrt(3.0 / dim);
+    AllocArray(proj->start, dim + 1);
+    AllocArray(proj->cols, alloc_cols);
+    for (j = 0; j < dim; j++)
+    {
+	proj->start[j] = num_cols;
+	for (d = 0; d < len; d++)
+	{
+	    double u = rng_uniform(&rng);
+	    if (u >= 1.0/3)
+		continue;
+	    if (num_cols == alloc_cols)
+	    {
+		ExpandArray(proj->cols, alloc_cols, alloc_cols * 2);
+		alloc_cols *= 2;
+	    }
+	    proj->cols[num_cols++] = (u < 1.0/6) ? d : -(d + 1);
+	}
+    }
+    proj->start[dim] = num_cols;
+    return proj;
+}
+
+static void sparse_projection_free(struct sparse_projection **pProj)
+/* free the projection */
+{
+    struct sparse_projection *proj = *pProj;
+    if (!proj)
+	return;
+    freeMem(proj->start);
+    freeMem(proj->cols);
+    freez(pProj);
+}
+
+struct reduce_job
+/* what the threads need to reduce the rows */
+{
+    double **rows;
+    double **reduced;
+    int n;
+    int len;
+    int dim;
+    enum kmeans_reduce how;
+    struct sparse_projection *proj;
+    struct resample_plan *paa;
+};
+
+static void reduce_rows_job(void *data, int job_ix, int thread_ix)
+/* parallel_for() job: reduce one chunk of rows */
+{
+    struct reduce_job *rj = (struct reduce_job *)data;
+    int end = (job_ix + 1) * KMEANS_CHUNK;
+    int i, j;
+    if (end > rj->n)
+	end = rj->n;
+    for (i = job_ix * KMEANS_CHUNK; i < end; i++)
+    {
+	/* piecewise aggregate approximation: the mean of each of dim equal segments, */
+	/* with bases on a segment boundary split by how much falls on each side */
+	if (rj->how == reduce_paa)
+	    resample_row(rj->paa, rj->rows[i], rj->reduced[i]);
+	else
+	    for (j = 0; j < rj->dim; j++)
+	    {
+		const struct sparse_projection *proj = rj->proj;
+		const double *row = rj->rows[i];
+		double sum = 0;
+		int c;
+		for (c = proj->start[j]; c < proj->start[j+1]; c++)
+		{
+		    int d = proj->cols[c];
+		    if (d >= 0)
+			sum += row[d];
+		    else
+			sum -= row[-d - 1];
+		}
+		rj->reduced[i][j] = sum * proj->scale;
+	    }
+    }
+}
+
+static double *reduce_rows(double **rows, int n, int len, struct kmeans_params *params, double ***pReduced)
+/* make shorter copies of the rows to cluster.  returns the block they're in */
+{
+    struct reduce_job rj;
+    struct resample_plan paa;
+    double *block;
+    int i;
+    AllocArray(block, (size_t)n * params->reduce_dim);
+    AllocArray(*pReduced, n);
+    for (i = 0; i < n; i++)
+	(*pReduced)[i] = block + (size_t)i * params->reduce_dim;
+    rj.rows = rows;
+    rj.reduced = *pReduced;
+    rj.n = n;
+    rj.len = len;
+    rj.dim = params->reduce_dim;
+    rj.how = params->reduce;
+    rj.proj = (params->reduce == reduce_random) ? random_projection(len, rj.dim, params->seed) : NULL;
+    ZeroVar(&paa);
+    if (params->reduce == reduce_paa)
+	resample_plan_set(&paa, len, rj.dim);
+    rj.paa = &paa;
+    parallel_for(params->num_threads, num_chunks(n), reduce_rows_job, &rj);
+    sparse_projection_free(&rj.proj);
+    resample_plan_free(&paa);
+    return block;
+}
+
+static boolean row_has_na(double *row, int ncol)
+/* rows with NA are left out of the clustering */
+{
+    int i;
+    for (i = 0; i < ncol; i++)
+	if (isnan(row[i]))
+	    return TRUE;
+    return FALSE;
+}
+
+struct cluster_order
+/* a row and where it was, for sorting */
+{
+    struct perBaseWig *pbw;
+    int ix;
+};
+
+static int cluster_order_cmp(const void *va, const void *vb)
+/* NA rows (label -1) first, then by cluster, then closest to the centroid first, */
+/* then the original order so the sort always comes out the same */
+{
+    const struct cluster_order *a = (struct cluster_order *)va;
+    const struct cluster_order *b = (struct cluster_order *)vb;
+    if (a->pbw->label != b->pbw->label)
+	return a->pbw->label - b->pbw->label;
+    if (!isnan(a->pbw->cent_distance) && !isnan(b->pbw->cent_distance))
+    {
+	if (a->pbw->cent_distance < b->pbw->cent_distance)
+	    return -1;
+	if (a->pbw->cent_distance > b->pbw->cent_distance)
+	    return 1;
+    }
+    return a->ix - b->ix;
+}
+
+void kmeans_cluster_cbm(struct cluster_bed_matrix *cbm, struct kmeans_params *params)
+/* cluster the rows of cbm->pbm, fill in the centroids, sizes, labels, and centroid */
+/* distances, and sort the rows: those with NA first, then by cluster and distance */
+/* to the centroid */
+{
+    struct perBaseMatrix *pbm = cbm->pbm;
+    int ncol = pbm->ncol;
+    struct cluster_order *order;
+    double **rows;
+    int *row_ix;
+    int *labels;
+    int n = 0;
+    int i, j, d;
+    unsigned long long prof_start = PROFILE_START();
+    size_t work_size = (size_t)pbm->nrow * (sizeof(double *) + sizeof(int));
+    AllocArray(rows, pbm->nrow);
+    AllocArray(row_ix, pbm->nrow);
+    memTrackAdd(mem_cluster, work_size);
+    for (i = 0; i < pbm->nrow; i++)
+    {
+	struct perBaseWig *pbw = pbm->array[i];
+	if (row_has_na(pbm->matrix[i], ncol))
+	{
+	    pbw->label = -1;
+	    pbw->cent_distance = NANUM;
+	    continue;
+	}
+	rows[n] = pbm->matrix[i];
+	row_ix[n++] = i;
+    }
+    if ((params->reduce != reduce_none) && (params->reduce_dim < ncol))
+    {
+	double **reduced;
+	size_t reduced_size = (size_t)n * (params->reduce_dim * sizeof(double) + sizeof(double *));
+	double *block;
+	memTrackAdd(mem_cluster, reduced_size);
+	block = reduce_rows(rows, n, ncol, params, &reduced);
+	verbose(2, "clustering on rows reduced from %d to %d\n", ncol, params->reduce_dim);
+	labels = kmeans(reduced, n, params->reduce_dim, params);
+	freeMem(reduced);
+	freeMem(block);
+	memTrackSub(mem_cluster, reduced_size);
+    }
+    else
+	labels = kmeans(rows, n, ncol, params);
+    /* the centroids and distances are always at full resolution */
+    for (j = 0; j < params->k; j++)
+    {
+	cbm->cluster_sizes[j] = 0;
+	for (d = 0; d < ncol; d++)
+	    cbm->centroids[j][d] = 0;
+    }
+    for (i = 0; i < n; i++)
+    {
+	double *c = cbm->centroids[labels[i]];
+	for (d = 0; d < ncol; d++)
+	    c[d] += rows[i][d];
+	cbm->cluster_sizes[labels[i]]++;
+    }
+    for (j = 0; j < params->k; j++)
+	if (cbm->cluster_sizes[j] > 0)
+	    for (d = 0; d < ncol; d++)
+		cbm->centroids[j][d] /= cbm->cluster_sizes[j];
+    for (i = 0; i < n; i++)
+    {
+	struct perBaseWig *pbw = pbm->array[row_ix[i]];
+	pbw->label = labels[i];
+	pbw->cent_distance = sqrt(sq_dist(rows[i], cbm->centroids[labels[i]], ncol));
+    }
+    cbm->k = params->k;
+    cbm->m = ncol;
+    cbm->n = pbm->nrow;
+    cbm->num_na = pbm->nrow - n;
+    AllocArray(order, pbm->nrow);
+    for (i = 0; i < pbm->nrow; i++)
+    {
+	order[i].pbw = pbm->array[i];
+	order[i].ix = i;
+    }
+    qsort(order, pbm->nrow, sizeof(struct cluster_order), cluster_order_cmp);
+    for (i = 0; i < pbm->nrow; i++)
+    {
+	pbm->array[i] = order[i].pbw;
+	pbm->matrix[i] = order[i].pbw->data;
+    }
+    freeMem(order);
+    freeMem(rows);
+    freeMem(row_ix);
+    freeMem(labels);
+    memTrackSub(mem_cluster, work_size);
+    PROFILE_STOP(prof_stats, prof_start);
+}
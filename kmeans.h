@@ -0,0 +1,44 @@
+#ifndef KMEANS_H
+#define KMEANS_H
+
+#include <jkweb/common.h>
+#include <jkweb/hash.h>
+#include <beato/bigs.h>
+#include <beato/cluster.h>
+
+enum kmeans_reduce
+/* how rows are shortened before clustering */
+{
+    reduce_none = 0,
+    reduce_paa = 1,             /* Piecewise aggregate approximation: segment means. */
+    reduce_random = 2,          /* Sparse random projection. */
+};
+
+struct kmeans_params
+/* how to cluster */
+{
+    int k;
+    unsigned long seed;         /* Same seed, same clusters, whatever the thread count. */
+    int num_threads;
+    int max_iter;
+    int batch_size;             /* If > 0, do mini-batch k-means with batches this big. */
+    enum kmeans_reduce reduce;
+    int reduce_dim;             /* Length of the rows after reducing. */
+};
+
+void kmeans_params_from_options(struct hash *options, int k, struct kmeans_params *params);
+/* fill in the params from -seed, -cluster-mini-batch, -cluster-max-iter, -cluster-reduce, */
+/* and -threads */
+
+int *kmeans(double **rows, int n, int dim, struct kmeans_params *params);
+/* cluster n rows of dim values (with no NA) and return the cluster of each row.  */
+/* seeding is k-means++ and the iterations use Hamerly's bounds to skip most of the */
+/* distance computations */
+
+void kmeans_cluster_cbm(struct cluster_bed_matrix *cbm, struct kmeans_params *params);
+/* cluster the rows of cbm->pbm, fill in the centroids, sizes, labels, and centroid */
+/* distances, and sort the rows: those with NA first, then by cluster and distance */
+/* to the centroid.  if the params say to, the clustering is done on reduced rows but */
+/* the centroids and distances are still at full resolution */
+
+#endif /* KMEANS_H */
@@ -8,23 +8,47 @@
 #include <jkweb/obscure.h>
 #include <jkweb/linefile.h>
 #include <jkweb/hash.h>
+#include <jkweb/dystring.h>
 #include <jkweb/options.h>
 #include <jkweb/sqlNum.h>
 #include <jkweb/basicBed.h>
 #include <jkweb/chain.h>
 #include <jkweb/binRange.h>
+#include <jkweb/rangeTree.h>
+#include <jkweb/localmem.h>
 #include <jkweb/bigWig.h>
 #include <beato/bigs.h>
 #include "bwtool.h"
 #include "bwtool_shared.h"
+#include "profile.h"
+#include "memtrack.h"
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #define NANUM sqrt(-1)
 
+struct liftChain
+/* a chain with its ungapped blocks laid out in arrays so they can be binary-searched */
+{
+    char *qName;                /* Destination chromosome. */
+    int qSize;
+    char qStrand;
+    int blockCount;
+    int *tStarts;               /* Block starts in the source (the chain's target). */
+    int *qStarts;               /* Block starts in the destination (the chain's query). */
+    int *sizes;
+};
+
 struct liftOverChromMap
 /* Remapping information for one (old) chromosome */
 {
     char *name;                 /* Chromosome name. */
-    struct binKeeper *bk;       /* Keyed by old position, values are chains. */
+    struct binKeeper *bk;       /* Keyed by old position, values are liftChains. */
+    struct lm *lm;              /* Where the liftChains live. */
 };
 
 void usage_lift()
@@ -40,48 +64,434 @@ errAbort(
   "                          gathering the size information from the chain.\n"
   "                          This is one way to restrict the chromosomes lifted to\n"
   "                          in the output.\n"
-  "   -unlifted=file.bed     save all the regions from the input not lifted\n"
+  "   -unlifted=file.bed     save all the regions from the input not lifted as a bed6\n"
+  "                          with the reason in the name.  Neighbouring bases not\n"
+  "                          lifted for the same reason are one region.  Every\n"
+  "                          source base with data is either lifted or in here,\n"
+  "                          including those going to a chrom missing from -sizes\n"
+  "                          or past the end of its size there.  Regions\n"
+  "                          landing on bases that other data lands on too are\n"
+  "                          named multi_mapped_chrom_pos, pos being where the first\n"
+  "                          base went, and the strand says which way the rest went.\n"
+  "   -unlifted-binary       save the -unlifted regions in a binary form instead of\n"
+  "                          a bed.\n"
+  "   -no-chain-index        don't save or reuse a chain index.  By default the\n"
+  "                          chain file is parsed once into a binary index saved as\n"
+  "                          chain.bwtidx next to it (or in /tmp if that's not\n"
+  "                          writable, or in -tmp-dir if that's given) and later\n"
+  "                          lifts with the same chain file skip the parsing.\n"
+  "   -threads=n             lift the source regions using n threads.  The output\n"
+  "                          is the same regardless.\n"
+  "lifted data is held as runs of the same value until it's written, so memory\n"
+  "used is proportional to how often the lifted data changes value, not the size\n"
+  "of the new assembly.\n"
   );
 }
 
-struct hash *qSizeHash(char *chainfile)
-/* read the chain file and figure out what the chromosome sizes are on the query end */
+/* bwtool chain index magic bytes:
+     BwtChain
+     42 77 74 43 68 61 69 6e
+*/
+const uint64_t LIFT_INDEX_MAGIC = 0x6e69616843747742;
+
+/* bwtool chain index file format version number. */
+const uint64_t LIFT_INDEX_VERSION = 2;
+
+struct lift_index_header
+/* start of the index file.  everything after it is in native byte order */
+{
+    /* Magic bytes: LIFT_INDEX_MAGIC */
+    uint64_t magic;
+    /* File format version: LIFT_INDEX_VERSION */
+    uint64_t version;
+    /* Size, modification time, and inode of the chain file the index was made from. */
+    uint64_t chain_file_size;
+    uint64_t chain_file_mtime;
+    uint64_t chain_file_inode;
+    /* Number of names, chains, and blocks following the header in that order. */
+    uint64_t num_names;
+    uint64_t num_chains;
+    uint64_t num_blocks;
+    /* Bytes of zero-terminated names at the end of the file. */
+    uint64_t names_size;
+};
+
+struct lift_index_name
+/* a chrom name seen in the chain file */
+{
+    bits32 offset;              /* Where the name is in the names at the end. */
+    bits32 tSize;               /* Size as a source (target) chrom, 0 if never one. */
+    bits32 qSize;               /* Size as a destination (query) chrom, 0 if never one. */
+    bits32 reserved;
+};
+
+struct lift_index_chain
+/* one chain.  its blocks are blockStart to blockStart+blockCount in the block arrays */
+{
+    bits32 tName;
+    bits32 tStart;
+    bits32 tEnd;
+    bits32 qName;
+    bits32 qSize;
+    bits32 qStrand;
+    bits32 blockStart;
+    bits32 blockCount;
+};
+
+struct liftIndex
+/* the chain file laid out flat, either mmap'd from the index file or built in memory */
+{
+    char *data;
+    size_t size;
+    boolean mapped;
+    struct lift_index_header *header;
+    struct lift_index_name *names;
+    struct lift_index_chain *chains;
+    int *tStarts;
+    int *qStarts;
+    int *sizes;
+    char *name_chars;
+};
+
+static size_t lift_index_size(struct lift_index_header *header)
+/* how big the whole index is according to the header */
+{
+    return sizeof(struct lift_index_header) + header->num_names * sizeof(struct lift_index_name)
+	+ header->num_chains * sizeof(struct lift_index_chain) + 3 * header->num_blocks * sizeof(int)
+	+ header->names_size;
+}
+
+static void lift_index_set_pointers(struct liftIndex *li)
+/* point into the data according to the header */
+{
+    struct lift_index_header *header = (struct lift_index_header *)li->data;
+    char *pt = li->data + sizeof(struct lift_index_header);
+    li->header = header;
+    li->names = (struct lift_index_name *)pt;
+    pt += header->num_names * sizeof(struct lift_index_name);
+    li->chains = (struct lift_index_chain *)pt;
+    pt += header->num_chains * sizeof(struct lift_index_chain);
+    li->tStarts = (int *)pt;
+    pt += header->num_blocks * sizeof(int);
+    li->qStarts = (int *)pt;
+    pt += header->num_blocks * sizeof(int);
+    li->sizes = (int *)pt;
+    pt += header->num_blocks * sizeof(int);
+    li->name_chars = pt;
+}
+
+static bits32 lift_index_name_ix(struct hash *nameHash, struct lift_index_name **pNames, int *pNum, int *pAlloc,
+				 struct dyString *name_chars, char *name)
+/* find the name or add it */
+{
+    struct hashEl *hel = hashLookup(nameHash, name);
+    if (hel)
+	return (bits32)ptToInt(hel->val);
+    if (*pNum == *pAlloc)
+    {
+	int new_alloc = (*pAlloc == 0) ? 64 : *pAlloc * 2;
+	ExpandArray(*pNames, *pAlloc, new_alloc);
+	*pAlloc = new_alloc;
+    }
+    (*pNames)[*pNum].offset = name_chars->stringSize;
+    dyStringAppendN(name_chars, name, strlen(name) + 1);
+    hashAddInt(nameHash, name, *pNum);
+    return (bits32)(*pNum)++;
+}
+
+static struct liftIndex *lift_index_build(char *chainfile, struct stat *chain_stat)
+/* parse the chain file (the only time it's parsed) into a flat index in memory */
 {
+    struct hash *nameHash = hashNew(10);
+    struct dyString *name_chars = dyStringNew(0);
     struct lineFile *lf = lineFileOpen(chainfile, TRUE);
-    struct chain *ch;
-    struct hash *csizes = hashNew(10);
-    while ((ch = chainRead(lf)) != NULL)
+    struct lift_index_name *names = NULL;
+    struct lift_index_chain *chains = NULL;
+    int *tStarts = NULL, *qStarts = NULL, *sizes = NULL;
+    int num_names = 0, alloc_names = 0;
+    int num_chains = 0, alloc_chains = 0;
+    int num_blocks = 0, alloc_blocks = 0;
+    struct lift_index_header header;
+    struct liftIndex *li;
+    struct chain *chain;
+    char *pt;
+    verbose(2, "indexing %s\n", chainfile);
+    while ((chain = chainRead(lf)) != NULL)
     {
-	char *chrom = ch->qName;
-	int size = ch->qSize;
-	if (!hashLookup(csizes, chrom))
-	    hashAddInt(csizes, chrom, size);
-	chainFree(&ch);
+	struct lift_index_chain *ic;
+	struct cBlock *block;
+	bits32 t = lift_index_name_ix(nameHash, &names, &num_names, &alloc_names, name_chars, chain->tName);
+	bits32 q = lift_index_name_ix(nameHash, &names, &num_names, &alloc_names, name_chars, chain->qName);
+	if (names[t].tSize == 0)
+	    names[t].tSize = chain->tSize;
+	if (names[q].qSize == 0)
+	    names[q].qSize = chain->qSize;
+	if (num_chains == alloc_chains)
+	{
+	    int new_alloc = (alloc_chains == 0) ? 1024 : alloc_chains * 2;
+	    ExpandArray(chains, alloc_chains, new_alloc);
+	    alloc_chains = new_alloc;
+	}
+	ic = &chains[num_chains++];
+	ic->tName = t;
+	ic->tStart = chain->tStart;
+	ic->tEnd = chain->tEnd;
+	ic->qName = q;
+	ic->qSize = chain->qSize;
+	ic->qStrand = chain->qStrand;
+	ic->blockStart = num_blocks;
+	ic->blockCount = 0;
+	for (block = chain->blockList; block != NULL; block = block->next)
+	{
+	    if (num_blocks == alloc_blocks)
+	    {
+		int new_alloc = (alloc_blocks == 0) ? 16384 : alloc_blocks * 2;
+		ExpandArray(tStarts, alloc_blocks, new_alloc);
+		ExpandArray(qStarts, alloc_blocks, new_alloc);
+		ExpandArray(sizes, alloc_blocks, new_alloc);
+		alloc_blocks = new_alloc;
+	    }
+	    tStarts[num_blocks] = block->tStart;
+	    qStarts[num_blocks] = block->qStart;
+	    sizes[num_blocks] = block->tEnd - block->tStart;
+	    num_blocks++;
+	    ic->blockCount++;
+	}
+	chainFree(&chain);
     }
     lineFileClose(&lf);
+    ZeroVar(&header);
+    header.magic = LIFT_INDEX_MAGIC;
+    header.version = LIFT_INDEX_VERSION;
+    header.chain_file_size = (uint64_t)chain_stat->st_size;
+    header.chain_file_mtime = (uint64_t)chain_stat->st_mtime;
+    header.chain_file_inode = (uint64_t)chain_stat->st_ino;
+    header.num_names = num_names;
+    header.num_chains = num_chains;
+    header.num_blocks = num_blocks;
+    header.names_size = name_chars->stringSize;
+    AllocVar(li);
+    li->size = lift_index_size(&header);
+    li->data = needLargeMem(li->size);
+    pt = li->data;
+    memcpy(pt, &header, sizeof(header));
+    pt += sizeof(header);
+    memcpy(pt, names, num_names * sizeof(struct lift_index_name));
+    pt += num_names * sizeof(struct lift_index_name);
+    memcpy(pt, chains, num_chains * sizeof(struct lift_index_chain));
+    pt += num_chains * sizeof(struct lift_index_chain);
+    memcpy(pt, tStarts, num_blocks * sizeof(int));
+    pt += num_blocks * sizeof(int);
+    memcpy(pt, qStarts, num_blocks * sizeof(int));
+    pt += num_blocks * sizeof(int);
+    memcpy(pt, sizes, num_blocks * sizeof(int));
+    pt += num_blocks * sizeof(int);
+    memcpy(pt, name_chars->string, name_chars->stringSize);
+    lift_index_set_pointers(li);
+    freeMem(names);
+    freeMem(chains);
+    freeMem(tStarts);
+    freeMem(qStarts);
+    freeMem(sizes);
+    dyStringFree(&name_chars);
+    hashFree(&nameHash);
+    return li;
+}
+
+static boolean lift_index_header_ok(struct lift_index_header *header, struct stat *chain_stat, size_t file_size)
+/* the header is for this version and chain file, and its counts add up to the file size */
+{
+    if ((header->magic != LIFT_INDEX_MAGIC) || (header->version != LIFT_INDEX_VERSION)
+	|| (header->chain_file_size != (uint64_t)chain_stat->st_size)
+	|| (header->chain_file_mtime != (uint64_t)chain_stat->st_mtime)
+	|| (header->chain_file_inode != (uint64_t)chain_stat->st_ino))
+	return FALSE;
+    /* keep the counts small enough that adding up the size can't overflow */
+    if ((header->num_names > file_size) || (header->num_chains > file_size) || (header->num_blocks > file_size)
+	|| (header->names_size > file_size))
+	return FALSE;
+    return (lift_index_size(header) == file_size);
+}
+
+static boolean lift_index_contents_ok(struct liftIndex *li)
+/* every chain's names and blocks are inside the index, so a corrupt one is never read */
+/* past its end */
+{
+    struct lift_index_header *header = li->header;
+    uint64_t i;
+    if ((header->names_size > 0) && (li->name_chars[header->names_size - 1] != '\0'))
+	return FALSE;
+    for (i = 0; i < header->num_names; i++)
+	if (li->names[i].offset >= header->names_size)
+	    return FALSE;
+    for (i = 0; i < header->num_chains; i++)
+    {
+	struct lift_index_chain *ic = &li->chains[i];
+	if ((ic->tName >= header->num_names) || (ic->qName >= header->num_names) || (ic->tStart > ic->tEnd)
+	    || (ic->tEnd > li->names[ic->tName].tSize)
+	    || ((uint64_t)ic->blockStart + ic->blockCount > header->num_blocks))
+	    return FALSE;
+    }
+    return TRUE;
+}
+
+static struct liftIndex *lift_index_map(char *index_file, struct stat *chain_stat)
+/* mmap the index file if it's there, was made from the chain file as it is now, and */
+/* holds together.  otherwise it's rebuilt */
+{
+    struct lift_index_header *header;
+    struct liftIndex *li;
+    struct stat st;
+    void *data;
+    int fd = open(index_file, O_RDONLY);
+    if (fd < 0)
+	return NULL;
+    if ((fstat(fd, &st) != 0) || (st.st_size < sizeof(struct lift_index_header)))
+    {
+	close(fd);
+	return NULL;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+	return NULL;
+    header = (struct lift_index_header *)data;
+    if (!lift_index_header_ok(header, chain_stat, (size_t)st.st_size))
+    {
+	verbose(2, "%s is stale, not using it\n", index_file);
+	munmap(data, st.st_size);
+	return NULL;
+    }
+    AllocVar(li);
+    li->data = (char *)data;
+    li->size = st.st_size;
+    li->mapped = TRUE;
+    lift_index_set_pointers(li);
+    if (!lift_index_contents_ok(li))
+    {
+	verbose(2, "%s is corrupt, not using it\n", index_file);
+	munmap(data, st.st_size);
+	freeMem(li);
+	return NULL;
+    }
+    verbose(2, "using chain index %s\n", index_file);
+    return li;
+}
+
+static boolean lift_index_write(struct liftIndex *li, char *index_file)
+/* write the index beside where it's going and rename it into place so other */
+/* lifts never see half of one.  return FALSE if it can't be written there. */
+{
+    char tmp_file[PATH_LEN];
+    FILE *f;
+    safef(tmp_file, sizeof(tmp_file), "%s.%d.tmp", index_file, (int)getpid());
+    f = fopen(tmp_file, "wb");
+    if (!f)
+	return FALSE;
+    if ((fwrite(li->data, 1, li->size, f) != li->size) || (fclose(f) != 0) || (rename(tmp_file, index_file) != 0))
+    {
+	remove(tmp_file);
+	return FALSE;
+    }
+    verbose(2, "wrote chain index %s\n", index_file);
+    return TRUE;
+}
+
+struct liftIndex *liftIndexOpen(char *chainfile, char *tmp_dir, boolean use_index_file)
+/* get the chains as a flat index.  a fresh index is reused, otherwise the chain file is */
+/* parsed and the index saved.  with tmp_dir the index is only kept there, otherwise */
+/* it's next to the chain file or if that's not writable, in /tmp.  the names in a */
+/* temporary directory carry a hash of the chain file's full path so chain files */
+/* with the same name in different places don't share one. */
+{
+    char next_to[PATH_LEN];
+    char in_tmp[PATH_LEN];
+    char *full_path;
+    char *base = strrchr(chainfile, '/');
+    struct liftIndex *li = NULL;
+    struct stat chain_stat;
+    if (stat(chainfile, &chain_stat) != 0)
+	errAbort("%s wasn't found", chainfile);
+    if (!use_index_file)
+	return lift_index_build(chainfile, &chain_stat);
+    base = (base) ? base + 1 : chainfile;
+    full_path = realpath(chainfile, NULL);
+    safef(next_to, sizeof(next_to), "%s.bwtidx", chainfile);
+    safef(in_tmp, sizeof(in_tmp), "%s/%s.%08x.bwtidx", (tmp_dir) ? tmp_dir : "/tmp", base,
+	  hashString((full_path) ? full_path : chainfile));
+    free(full_path);
+    if ((!tmp_dir) && ((li = lift_index_map(next_to, &chain_stat)) != NULL))
+	return li;
+    if ((li = lift_index_map(in_tmp, &chain_stat)) != NULL)
+	return li;
+    li = lift_index_build(chainfile, &chain_stat);
+    if (tmp_dir)
+    {
+	if (!lift_index_write(li, in_tmp))
+	    warn("couldn't save the chain index in %s", tmp_dir);
+    }
+    else if (!lift_index_write(li, next_to) && !lift_index_write(li, in_tmp))
+	warn("couldn't save the chain index next to %s or in /tmp", chainfile);
+    return li;
+}
+
+void liftIndexFree(struct liftIndex **pLi)
+/* unmap or free the index */
+{
+    struct liftIndex *li = *pLi;
+    if (!li)
+	return;
+    if (li->mapped)
+	munmap(li->data, li->size);
+    else
+	freeMem(li->data);
+    freez(pLi);
+}
+
+struct hash *liftIndexQSizes(struct liftIndex *li)
+/* the chromosome sizes on the query end */
+{
+    struct hash *csizes = hashNew(10);
+    uint64_t i;
+    for (i = 0; i < li->header->num_names; i++)
+	if (li->names[i].qSize > 0)
+	    hashAddInt(csizes, li->name_chars + li->names[i].offset, li->names[i].qSize);
     return csizes;
 }
 
-struct hash *readLiftOverMapChainHash(char *fileName)
-/* taken from kent/src/hg/lib/liftOver.c */
-/* Read map file into hashes. */
+struct hash *liftIndexChainHash(struct liftIndex *li)
+/* make the hash of binKeepers keyed on source chrom.  the liftChains point straight */
+/* into the index so it has to outlive the hash. */
 {
     struct hash *chainHash = hashNew(10);
-    struct lineFile *lf = lineFileOpen(fileName, TRUE);
-    struct chain *chain;
-    struct liftOverChromMap *map;
-
-    while ((chain = chainRead(lf)) != NULL)
+    struct liftOverChromMap *map = NULL;
+    uint64_t i;
+    for (i = 0; i < li->header->num_chains; i++)
     {
-	if ((map = hashFindVal(chainHash, chain->tName)) == NULL)
+	struct lift_index_chain *ic = &li->chains[i];
+	struct lift_index_name *tName = &li->names[ic->tName];
+	char *chrom = li->name_chars + tName->offset;
+	struct liftChain *lc;
+	if ((map == NULL) || !sameString(map->name, chrom))
 	{
-	    AllocVar(map);
-	    map->bk = binKeeperNew(0, chain->tSize);
-	    hashAddSaveName(chainHash, chain->tName, map, &map->name);
+	    if ((map = hashFindVal(chainHash, chrom)) == NULL)
+	    {
+		AllocVar(map);
+		map->bk = binKeeperNew(0, tName->tSize);
+		map->lm = lmInit(0);
+		hashAddSaveName(chainHash, chrom, map, &map->name);
+	    }
 	}
-	binKeeperAdd(map->bk, chain->tStart, chain->tEnd, chain);
+	lmAllocVar(map->lm, lc);
+	lc->qName = li->name_chars + li->names[ic->qName].offset;
+	lc->qSize = ic->qSize;
+	lc->qStrand = (char)ic->qStrand;
+	lc->blockCount = ic->blockCount;
+	lc->tStarts = li->tStarts + ic->blockStart;
+	lc->qStarts = li->qStarts + ic->blockStart;
+	lc->sizes = li->sizes + ic->blockStart;
+	binKeeperAdd(map->bk, ic->tStart, ic->tEnd, lc);
     }
-    lineFileClose(&lf);
     return chainHash;
 }
 
@@ -91,32 +501,10 @@ void freeChainHashMap(void **pHashMapVal)
     struct liftOverChromMap **p = (struct liftOverChromMap **)pHashMapVal;
     struct liftOverChromMap *map = *p;
     binKeeperFree(&map->bk);
+    lmCleanup(&map->lm);
     freez(p);
 }
 
-struct hash *genomePbw(struct hash *qSizes)
-/* make a parallel hash of pbws given the size hash, also keyed on chrom name */
-{
-    struct hash *pbwHash = newHash(10);
-    struct hashEl *list = hashElListHash(qSizes);
-    struct hashEl *el;
-    const double na = NANUM;
-    int i;
-    for (el = list; el != NULL; el = el->next)
-    {
-	int size = ptToInt(el->val);
-	struct perBaseWig *pbw = alloc_perBaseWig(el->name, 0, size);
-	for (i = 0; i < pbw->len; i++)
-	    pbw->data[i] = na;
-	pbw->name = cloneString(el->name);
-	pbw->strand[0] = '+';
-	pbw->strand[1] = '\0';
-	hashAdd(pbwHash, el->name, pbw);
-    }
-    hashElFreeList(&list);
-    return pbwHash;
-}
-
 struct hash *readCsizeHash(char *filename)
 /* read in a chrom sizes file */
 {
@@ -134,244 +522,855 @@ enum remapResult
     problem = 0,
     deleted = 1,
     duplicated = 2,
-    lifted = 3
+    lifted = 3,
+    multi_mapped = 4,
+    dest_not_sized = 5,
+    past_dest_end = 6
 };
 
-static int chainAliSize(struct chain *chain)
-/* Return size of all blocks in chain. */
+struct lift_run
+/* bases in a row with the same value.  bigWigs hold floats, so nothing is lost */
 {
-struct cBlock *b;
-int total = 0;
-for (b = chain->blockList; b != NULL; b = b->next)
-    total += b->qEnd - b->qStart;
-return total;
-}
+    float val;
+    int len;
+};
+
+/* bases expanded at a time when writing a piece out */
+#define LIFT_OUTPUT_WINDOW (1 << 20)
+
+struct liftPiece
+/* an ungapped stretch of the source landing in one place in the destination */
+{
+    struct liftPiece *next;
+    char *srcChrom;
+    int srcIx;                  /* Which data span of the source this came from. */
+    int srcStart;
+    int srcEnd;
+    char *destChrom;
+    int destStart;              /* Destination coordinates are always on the + strand, */
+    int destEnd;                /* so with strand '-' srcStart goes to destEnd-1. */
+    char strand;
+    struct lift_run *runs;      /* The data in destination order, as runs of one value. */
+    int num_runs;
+};
 
-static boolean mapThroughChain(struct chain *chain, double minRatio,
-	int *pStart, int *pEnd, struct chain **retSubChain,
-	struct chain **retChainToFree)
-/* Map interval from start to end from target to query side of chain.
- * Return FALSE if not possible, otherwise update *pStart, *pEnd. */
+struct unliftedRun
+/* a run of source bases that didn't make it into the destination */
 {
-    struct chain *subChain = NULL;
-    struct chain *freeChain = NULL;
-    int s = *pStart, e = *pEnd;
-    int oldSize = e - s;
-    int newCover = 0;
-    int ok = TRUE;
+    struct unliftedRun *next;
+    char *chrom;
+    int srcIx;                  /* Which data span of the source this came from. */
+    int start;
+    int end;
+    enum remapResult why;
+    char *destChrom;            /* For multi_mapped, where start went to and */
+    int destStart;              /* which direction the rest of the run goes. */
+    char strand;
+};
 
-    chainSubsetOnT(chain, s, e, &subChain, &freeChain);
-    if (subChain == NULL)
+static void add_unlifted(struct unliftedRun **pList, int start, int end, enum remapResult why)
+/* add a run to the head of the list, extending the head if it's the same kind and adjacent */
+{
+    struct unliftedRun *run = *pList;
+    if (end <= start)
+	return;
+    if (run && (run->why == why) && (run->end == start) && (why != multi_mapped))
+	run->end = end;
+    else
     {
-	*retSubChain = NULL;
-	*retChainToFree = NULL;
-	return FALSE;
+	AllocVar(run);
+	run->start = start;
+	run->end = end;
+	run->why = why;
+	slAddHead(pList, run);
     }
-    newCover = chainAliSize(subChain);
-    if (newCover < oldSize * minRatio)
-	ok = FALSE;
-    else if (chain->qStrand == '+')
+}
+
+static int first_block_ending_after(struct liftChain *lc, int pos)
+/* binary search for the first block that ends after pos */
+{
+    int lo = 0, hi = lc->blockCount;
+    while (lo < hi)
     {
-	*pStart = subChain->qStart;
-	*pEnd = subChain->qEnd;
+	int mid = (lo + hi)/2;
+	if (lc->tStarts[mid] + lc->sizes[mid] <= pos)
+	    lo = mid + 1;
+	else
+	    hi = mid;
     }
-    else
+    return lo;
+}
+
+static void lift_through_chain(struct liftChain *lc, int start, int end, struct liftPiece **pPieces,
+			       struct unliftedRun **pBad)
+/* intersect start-end with the chain's blocks.  each overlapping part of a block is one */
+/* piece, and anything falling in a gap is a problem lifting. */
+{
+    int pos = start;
+    int i;
+    for (i = first_block_ending_after(lc, start); (i < lc->blockCount) && (lc->tStarts[i] < end); i++)
     {
-	*pStart = subChain->qSize - subChain->qEnd;
-	*pEnd = subChain->qSize - subChain->qStart;
+	int bs = (lc->tStarts[i] > start) ? lc->tStarts[i] : start;
+	int be = (lc->tStarts[i] + lc->sizes[i] < end) ? lc->tStarts[i] + lc->sizes[i] : end;
+	int qs = lc->qStarts[i] + bs - lc->tStarts[i];
+	int qe = qs + be - bs;
+	struct liftPiece *piece;
+	add_unlifted(pBad, pos, bs, problem);
+	AllocVar(piece);
+	piece->srcStart = bs;
+	piece->srcEnd = be;
+	piece->destChrom = lc->qName;
+	piece->strand = lc->qStrand;
+	if (lc->qStrand == '+')
+	{
+	    piece->destStart = qs;
+	    piece->destEnd = qe;
+	}
+	else
+	{
+	    piece->destStart = lc->qSize - qe;
+	    piece->destEnd = lc->qSize - qs;
+	}
+	slAddHead(pPieces, piece);
+	pos = be;
     }
-    *retSubChain = subChain;
-    *retChainToFree = freeChain;
-    return ok;
+    add_unlifted(pBad, pos, end, problem);
 }
 
-enum remapResult remapBase(struct hash *chainHash, char *orig_chrom, int orig_base, char **dest_chrom, int *dest_base)
+struct chain_event
+/* where a chain starts or stops covering the span being lifted */
 {
-    struct liftOverChromMap *map = hashFindVal(chainHash, orig_chrom);
-    struct binElement *list = NULL;
-    struct chain *chainHit = NULL;
-    struct chain *toFree;
-    struct chain *subChain;
-    int start = orig_base, end = start+1;
-    if (map)
-	list = binKeeperFind(map->bk, start, start+1);
+    int pos;
+    int delta;                  /* +1 for a start, -1 for an end. */
+    int ix;                     /* Which chain. */
+};
+
+static int chain_event_cmp(const void *va, const void *vb)
+/* sort events on position for qsort */
+{
+    const struct chain_event *a = (struct chain_event *)va;
+    const struct chain_event *b = (struct chain_event *)vb;
+    return a->pos - b->pos;
+}
+
+static void lift_segment(struct liftChain **chains, int num_active, long long ix_sum, int s, int e,
+			 struct liftPiece **pPieces, struct unliftedRun **pBad)
+/* lift s-e, covered throughout by the same num_active chains.  with one active, ix_sum */
+/* is that chain's index */
+{
+    if (s >= e)
+	return;
+    if (num_active == 0)
+	add_unlifted(pBad, s, e, deleted);
+    else if (num_active > 1)
+	add_unlifted(pBad, s, e, duplicated);
+    else
+	lift_through_chain(chains[ix_sum], s, e, pPieces, pBad);
+}
+
+static void lift_span(struct hash *chainHash, char *chrom, int start, int end, struct liftPiece **pPieces,
+		      struct unliftedRun **pBad)
+/* work out where a span of the source goes.  the span is split wherever a chain starts or */
+/* ends.  parts covered by no chain are deleted, parts covered by several are duplicated, */
+/* and the rest goes through the one chain block by block.  the starts and ends are swept */
+/* in order keeping count of the chains covering each part, and the sum of their indices */
+/* says which one it is when there's only one.  pieces and unlifted runs are returned in */
+/* source order. */
+{
+    struct liftOverChromMap *map = hashFindVal(chainHash, chrom);
+    struct binElement *list = (map) ? binKeeperFind(map->bk, start, end) : NULL;
+    struct binElement *el;
+    struct liftChain **chains;
+    struct chain_event *events;
+    int num_chains = slCount(list);
+    int num_events = 0;
+    int num_active = 0;
+    long long ix_sum = 0;
+    int pos = start;
+    int i;
+    *pPieces = NULL;
+    *pBad = NULL;
     if (!list)
-	return deleted;
-    else if (list->next != NULL)
     {
-	slFreeList(&list);
-	return duplicated;
+	add_unlifted(pBad, start, end, deleted);
+	return;
     }
-    chainHit = list->val;
-    if (!mapThroughChain(chainHit, 1, &start, &end, &subChain, &toFree))
+    AllocArray(chains, num_chains);
+    AllocArray(events, 2*num_chains);
+    for (el = list, i = 0; el != NULL; el = el->next, i++)
     {
-	slFreeList(&list);
-	return problem;
+	chains[i] = (struct liftChain *)el->val;
+	events[num_events].pos = (el->start > start) ? el->start : start;
+	events[num_events].delta = 1;
+	events[num_events++].ix = i;
+	events[num_events].pos = (el->end < end) ? el->end : end;
+	events[num_events].delta = -1;
+	events[num_events++].ix = i;
     }
-    chainFree(&toFree);
-    *dest_base = start;
-    *dest_chrom = chainHit->qName;
+    qsort(events, num_events, sizeof(events[0]), chain_event_cmp);
+    for (i = 0; i < num_events; )
+    {
+	int here = events[i].pos;
+	lift_segment(chains, num_active, ix_sum, pos, here, pPieces, pBad);
+	for (; (i < num_events) && (events[i].pos == here); i++)
+	{
+	    num_active += events[i].delta;
+	    ix_sum += events[i].delta * events[i].ix;
+	}
+	pos = here;
+    }
+    lift_segment(chains, num_active, ix_sum, pos, end, pPieces, pBad);
+    slReverse(pPieces);
+    slReverse(pBad);
+    freeMem(chains);
+    freeMem(events);
     slFreeList(&list);
-    return lifted;
 }
 
-void do_pass1(struct metaBig *mb, struct hash *chainHash, struct hash *gpbw)
-/* do the first pass in the destination pbws */
-/* remap all the origen bases and increment from zero in */
-/* the destination the number of times the base in the */
-/* destination is mapped to. For the second pass we'll */
-/* only use the ones that are 1 here.  Ones that are > 1 */
-/* will be considered places where the destination is */
-/* repeated */
+static int liftPieceDestCmp(const void *va, const void *vb)
+/* sort pieces on destination start, then source order so ties always sort the same way */
 {
-    struct bed *section;
-    for (section = mb->sections; section != NULL; section = section->next)
+    const struct liftPiece *a = *((struct liftPiece **)va);
+    const struct liftPiece *b = *((struct liftPiece **)vb);
+    if (a->destStart != b->destStart)
+	return a->destStart - b->destStart;
+    if (a->srcIx != b->srcIx)
+	return a->srcIx - b->srcIx;
+    return a->srcStart - b->srcStart;
+}
+
+static int unliftedRunCmp(const void *va, const void *vb)
+/* sort runs back into source order */
+{
+    const struct unliftedRun *a = *((struct unliftedRun **)va);
+    const struct unliftedRun *b = *((struct unliftedRun **)vb);
+    if (a->srcIx != b->srcIx)
+	return a->srcIx - b->srcIx;
+    return a->start - b->start;
+}
+
+static boolean clip_piece(struct liftPiece *piece, int dest_size, struct unliftedRun **pBad)
+/* keep the piece inside the destination chromosome, adding the source bases landing past */
+/* its end to pBad.  return FALSE if nothing is left */
+{
+    if (piece->destEnd > dest_size)
     {
-	struct perBaseWig *pbwList = perBaseWigLoadContinue(mb, section->chrom, section->chromStart, section->chromEnd);
-	struct perBaseWig *pbw;
-	for (pbw = pbwList; pbw != NULL; pbw = pbw->next)
+	int over = piece->destEnd - ((piece->destStart > dest_size) ? piece->destStart : dest_size);
+	if (piece->strand == '+')
 	{
-	    int i;
-	    for (i = 0; i < pbw->len; i++)
-	    {
-		char *dest_chrom = NULL;
-		int dest_start = 0;
-		enum remapResult rmr = remapBase(chainHash, pbw->chrom, pbw->chromStart + i, &dest_chrom, &dest_start);
-		if (rmr == lifted)
-		{
-		    struct perBaseWig *dest_chrom_pbw = (struct perBaseWig *)hashFindVal(gpbw, dest_chrom);
-		    if (dest_chrom_pbw)
-		    {
-			if (isnan(dest_chrom_pbw->data[dest_start]))
-			    dest_chrom_pbw->data[dest_start] = 1.0;
-			else
-			    dest_chrom_pbw->data[dest_start] += 1.0;
-		    }
-		}
-	    }
+	    add_unlifted(pBad, piece->srcEnd - over, piece->srcEnd, past_dest_end);
+	    piece->srcEnd -= over;
+	}
+	else
+	{
+	    add_unlifted(pBad, piece->srcStart, piece->srcStart + over, past_dest_end);
+	    piece->srcStart += over;
 	}
-	perBaseWigFreeList(&pbwList);
+	piece->destEnd -= over;
     }
+    return (piece->destEnd > piece->destStart);
 }
 
-void do_pass2(struct metaBig *mb, struct hash *chainHash, struct hash *gpbw)
-/* so now that everything is either zero, 1.0, or more, make everything that isn't 1.0 an NA */
+static boolean same_val(float a, float b)
+/* equal, counting NA as equal to NA */
+{
+    return (a == b) || (isnan(a) && isnan(b));
+}
+
+static void add_run(struct lift_run *runs, int *pNum, float val, int len)
+/* add len bases of val after the last run, extending it if it's the same value */
+{
+    if (len <= 0)
+	return;
+    if ((*pNum > 0) && same_val(runs[*pNum - 1].val, val))
+	runs[*pNum - 1].len += len;
+    else
+    {
+	runs[*pNum].val = val;
+	runs[*pNum].len = len;
+	(*pNum)++;
+    }
+}
+
+static size_t lift_piece_size(struct liftPiece *piece)
+/* bytes held by a piece and its runs */
+{
+    return sizeof(struct liftPiece) + (size_t)piece->num_runs * sizeof(struct lift_run);
+}
+
+static void copy_piece(struct perBaseWig *pbw, struct liftPiece *piece)
+/* copy the piece's data out of the source as runs, reversed for '-' chains.  the runs */
+/* are counted first so the array is only as big as it needs to be */
+{
+    double *from = pbw->data + piece->srcStart - pbw->chromStart;
+    int len = piece->destEnd - piece->destStart;
+    int num_runs = 0;
+    int i;
+    for (i = 0; i < len; i++)
+    {
+	float val = (piece->strand == '+') ? from[i] : from[len - 1 - i];
+	if ((i == 0) || !same_val(val, (piece->strand == '+') ? from[i - 1] : from[len - i]))
+	    num_runs++;
+    }
+    AllocArray(piece->runs, num_runs);
+    piece->num_runs = 0;
+    for (i = 0; i < len; i++)
+	add_run(piece->runs, &piece->num_runs, (piece->strand == '+') ? from[i] : from[len - 1 - i], 1);
+}
+
+static void lift_piece_set_na(struct liftPiece *piece, int start, int end)
+/* make destination bases start-end of the piece NA, splitting runs as needed */
 {
     const double na = NANUM;
-    struct bed *section;
-    for (section = mb->sections; section != NULL; section = section->next)
+    struct lift_run *runs;
+    int num_runs = 0;
+    int pos = piece->destStart;
+    int i;
+    AllocArray(runs, piece->num_runs + 2);
+    for (i = 0; i < piece->num_runs; i++)
+    {
+	struct lift_run *run = &piece->runs[i];
+	int run_end = pos + run->len;
+	int ms = (start > pos) ? start : pos;
+	int me = (end < run_end) ? end : run_end;
+	if (ms < me)
+	{
+	    add_run(runs, &num_runs, run->val, ms - pos);
+	    add_run(runs, &num_runs, na, me - ms);
+	    add_run(runs, &num_runs, run->val, run_end - me);
+	}
+	else
+	    add_run(runs, &num_runs, run->val, run->len);
+	pos = run_end;
+    }
+    freeMem(piece->runs);
+    piece->runs = runs;
+    piece->num_runs = num_runs;
+}
+
+static void output_lift_piece(struct liftPiece *piece, FILE *out, enum wigOutType wot, unsigned decimals)
+/* write the piece out, expanding only a window of it to bases at a time */
+{
+    int run_ix = 0;
+    int run_used = 0;
+    int pos;
+    for (pos = piece->destStart; pos < piece->destEnd; pos += LIFT_OUTPUT_WINDOW)
     {
-	struct perBaseWig *pbwList = perBaseWigLoadContinue(mb, section->chrom, section->chromStart, section->chromEnd);
-	struct perBaseWig *pbw;
-	for (pbw = pbwList; pbw != NULL; pbw = pbw->next)
+	int end = (pos + LIFT_OUTPUT_WINDOW < piece->destEnd) ? pos + LIFT_OUTPUT_WINDOW : piece->destEnd;
+	struct perBaseWig *pbw = alloc_perBaseWig(piece->destChrom, pos, end);
+	int i = 0;
+	while (i < end - pos)
 	{
-	    int i;
-	    for (i = 0; i < pbw->len; i++)
+	    struct lift_run *run = &piece->runs[run_ix];
+	    int take = run->len - run_used;
+	    int j;
+	    if (take > end - pos - i)
+		take = end - pos - i;
+	    for (j = 0; j < take; j++)
+		pbw->data[i++] = run->val;
+	    run_used += take;
+	    if (run_used == run->len)
 	    {
-		char *dest_chrom = NULL;
-		int dest_start = 0;
-		enum remapResult rmr = remapBase(chainHash, pbw->chrom, pbw->chromStart + i, &dest_chrom, &dest_start);
-		if (rmr == lifted)
-		{
-		    struct perBaseWig *dest_chrom_pbw = (struct perBaseWig *)hashFindVal(gpbw, dest_chrom);
-		    if (dest_chrom_pbw && ((int)dest_chrom_pbw->data[dest_start] != 1))
-			dest_chrom_pbw->data[dest_start] = na;
-		}
+		run_ix++;
+		run_used = 0;
 	    }
 	}
-	perBaseWigFreeList(&pbwList);
+	pbw->strand[0] = '+';
+	pbw->strand[1] = '\0';
+	perBaseWigOutputNASkip(pbw, out, wot, decimals, NULL, FALSE, FALSE);
+	perBaseWigFree(&pbw);
     }
 }
 
-void do_final_pass(struct metaBig *mb, struct hash *chainHash, struct hash *gpbw, char *bad_file)
-/* now everything is 1.0 or NA.  copy data into destination */
+void liftPieceFreeList(struct liftPiece **pList)
+/* free the pieces and their data */
 {
-    struct bed *section;
-    FILE *bad = NULL;
-    if (bad_file)
-	bad = mustOpen(bad_file, "w");
-    for (section = mb->sections; section != NULL; section = section->next)
+    struct liftPiece *piece;
+    while ((piece = slPopHead(pList)) != NULL)
     {
-	struct perBaseWig *pbwList = perBaseWigLoadContinue(mb, section->chrom, section->chromStart, section->chromEnd);
-	struct perBaseWig *pbw;
-	for (pbw = pbwList; pbw != NULL; pbw = pbw->next)
+	freeMem(piece->runs);
+	freeMem(piece);
+    }
+}
+
+void freeLiftPieceList(void **pVal)
+/* for hashFreeWithVals */
+{
+    struct liftPiece **pList = (struct liftPiece **)pVal;
+    liftPieceFreeList(pList);
+}
+
+struct lift_section
+/* what lifting one section of the source gives */
+{
+    struct liftPiece *pieces;   /* In source order, with data. */
+    struct unliftedRun *bad;    /* Only kept with -unlifted. */
+    int num_spans;              /* How many data spans the section had, for numbering them. */
+};
+
+static void lift_section(struct metaBig *mb, struct bed *section, struct hash *chainHash, struct hash *sizeHash,
+			 boolean keep_bad, struct lift_section *result)
+/* lift the data of one section.  spans are numbered from zero within the section.  only */
+/* reads the hashes so several of these can run at once, each with its own metaBig */
+{
+    unsigned long long prof_start = PROFILE_START();
+    struct perBaseWig *pbwList = perBaseWigLoadContinue(mb, section->chrom, section->chromStart, section->chromEnd);
+    struct perBaseWig *pbw;
+    size_t loaded_size = perBaseWigListSize(pbwList);
+    PROFILE_STOP(prof_load, prof_start);
+    PROFILE_COUNT(prof_sections, 1);
+    memTrackAdd(mem_pbw, loaded_size);
+    result->pieces = NULL;
+    result->bad = NULL;
+    result->num_spans = 0;
+    for (pbw = pbwList; pbw != NULL; pbw = pbw->next)
+    {
+	struct liftPiece *pieces, *piece;
+	struct unliftedRun *bad, *run;
+	lift_span(chainHash, pbw->chrom, pbw->chromStart, pbw->chromStart + pbw->len, &pieces, &bad);
+	while ((piece = slPopHead(&pieces)) != NULL)
+	{
+	    struct hashEl *size_el = hashLookup(sizeHash, piece->destChrom);
+	    if (!size_el)
+		add_unlifted(&bad, piece->srcStart, piece->srcEnd, dest_not_sized);
+	    if (!size_el || !clip_piece(piece, ptToInt(size_el->val), &bad))
+	    {
+		freeMem(piece);
+		continue;
+	    }
+	    piece->srcChrom = section->chrom;
+	    piece->srcIx = result->num_spans;
+	    copy_piece(pbw, piece);
+	    memTrackAdd(mem_pbw, lift_piece_size(piece));
+	    slAddHead(&result->pieces, piece);
+	}
+	if (keep_bad)
 	{
-	    int i;
-	    for (i = 0; i < pbw->len; i++)
+	    while ((run = slPopHead(&bad)) != NULL)
 	    {
-		char *dest_chrom = NULL;
-		int dest_start = 0;
-		enum remapResult rmr = remapBase(chainHash, pbw->chrom, pbw->chromStart + i, &dest_chrom, &dest_start);
-		if (rmr == lifted)
-		{
-		    struct perBaseWig *dest_chrom_pbw = (struct perBaseWig *)hashFindVal(gpbw, dest_chrom);
-		    if (dest_chrom_pbw && (!isnan(dest_chrom_pbw->data[dest_start])))
-			dest_chrom_pbw->data[dest_start] = pbw->data[i];
-		    else if (bad && isnan(dest_chrom_pbw->data[dest_start]))
-			fprintf(bad, "%s\t%d\tmulti_mapped_%s_%d\n", pbw->chrom, pbw->chromStart+i, dest_chrom, dest_start);
-		}
-		else if (bad)
-		{
-		    if (rmr == duplicated)
-			fprintf(bad, "%s\t%d\tduplicated_in_destination\n", pbw->chrom, pbw->chromStart+i);
-		    else if (rmr == deleted)
-			fprintf(bad, "%s\t%d\tdeleted_in_destination\n", pbw->chrom, pbw->chromStart+i);
-		    else
-			fprintf(bad, "%s\t%d\tproblem_lifting\n", pbw->chrom, pbw->chromStart+i);
-		}
+		run->chrom = section->chrom;
+		run->srcIx = result->num_spans;
+		slAddHead(&result->bad, run);
 	    }
 	}
-	perBaseWigFreeList(&pbwList);
+	else
+	    slFreeList(&bad);
+	result->num_spans++;
+    }
+    perBaseWigFreeList(&pbwList);
+    memTrackSub(mem_pbw, loaded_size);
+}
+
+struct lift_batch
+/* the sections worked on by the threads */
+{
+    struct metaBig **mbs;           /* one open bigWig per thread */
+    struct bed **sections;
+    struct hash *chainHash;
+    struct hash *sizeHash;
+    boolean keep_bad;
+    struct lift_section *results;
+};
+
+static void lift_section_job(void *data, int job_ix, int thread_ix)
+/* parallel_for() job: one section */
+{
+    struct lift_batch *batch = (struct lift_batch *)data;
+    lift_section(batch->mbs[thread_ix], batch->sections[job_ix], batch->chainHash, batch->sizeHash,
+		 batch->keep_bad, &batch->results[job_ix]);
+}
+
+struct unliftedRun *lift_sections(struct metaBig *mb, char *bigfile, char *tmp_dir, int num_threads,
+				  struct hash *chainHash, struct hash *sizeHash, struct hash *destHash,
+				  boolean keep_bad)
+/* lift the data of every section using num_threads threads.  the lifted pieces (with */
+/* their data) are put into destHash, a list per destination chrom, so memory only goes */
+/* to data actually lifted.  the results are gathered in section order so the pieces and */
+/* their numbering come out the same however many threads there are.  if keep_bad, return */
+/* what couldn't be lifted. */
+{
+    struct unliftedRun *badList = NULL;
+    int num_sections = slCount(mb->sections);
+    struct lift_batch batch;
+    struct bed *section;
+    int src_ix = 0;
+    int i;
+    if (num_threads > num_sections)
+	num_threads = (num_sections > 0) ? num_sections : 1;
+    AllocArray(batch.mbs, num_threads);
+    batch.mbs[0] = mb;
+    for (i = 1; i < num_threads; i++)
+	batch.mbs[i] = metaBigOpen_check(bigfile, tmp_dir, NULL);
+    AllocArray(batch.sections, num_sections);
+    for (section = mb->sections, i = 0; section != NULL; section = section->next, i++)
+	batch.sections[i] = section;
+    AllocArray(batch.results, num_sections);
+    batch.chainHash = chainHash;
+    batch.sizeHash = sizeHash;
+    batch.keep_bad = keep_bad;
+    parallel_for(num_threads, num_sections, lift_section_job, &batch);
+    for (i = 0; i < num_sections; i++)
+    {
+	struct lift_section *result = &batch.results[i];
+	struct liftPiece *piece;
+	struct unliftedRun *run;
+	while ((piece = slPopHead(&result->pieces)) != NULL)
+	{
+	    struct hashEl *hel = hashLookup(destHash, piece->destChrom);
+	    if (!hel)
+		hel = hashAdd(destHash, piece->destChrom, NULL);
+	    piece->srcIx += src_ix;
+	    piece->next = (struct liftPiece *)hel->val;
+	    hel->val = piece;
+	}
+	while ((run = slPopHead(&result->bad)) != NULL)
+	{
+	    run->srcIx += src_ix;
+	    slAddHead(&badList, run);
+	}
+	src_ix += result->num_spans;
+    }
+    for (i = 1; i < num_threads; i++)
+	metaBigRelease(&batch.mbs[i]);
+    freeMem(batch.mbs);
+    freeMem(batch.sections);
+    freeMem(batch.results);
+    return badList;
+}
+
+static void add_multi_run(struct unliftedRun **pBad, struct liftPiece *piece, int dest_start, int dest_end)
+/* the source bases landing on dest_start-dest_end also land somewhere else */
+{
+    struct unliftedRun *run;
+    AllocVar(run);
+    run->why = multi_mapped;
+    run->chrom = piece->srcChrom;
+    run->srcIx = piece->srcIx;
+    run->destChrom = piece->destChrom;
+    run->strand = piece->strand;
+    if (piece->strand == '+')
+    {
+	run->start = piece->srcStart + dest_start - piece->destStart;
+	run->destStart = dest_start;
+    }
+    else
+    {
+	run->start = piece->srcStart + piece->destEnd - dest_end;
+	run->destStart = dest_end - 1;
+    }
+    run->end = run->start + dest_end - dest_start;
+    slAddHead(pBad, run);
+}
+
+void mark_multi_mapped(struct liftPiece **pPieces, struct unliftedRun **pBad)
+/* sort one destination chrom's pieces and NA out wherever more than one source base lands. */
+/* if pBad is given, add the source bases involved to it. */
+{
+    struct rbTree *multi = NULL;
+    struct liftPiece *piece;
+    int max_end = 0;
+    slSort(pPieces, liftPieceDestCmp);
+    for (piece = *pPieces; piece != NULL; piece = piece->next)
+    {
+	if (piece->destStart < max_end)
+	{
+	    if (!multi)
+		multi = rangeTreeNew();
+	    rangeTreeAdd(multi, piece->destStart, (piece->destEnd < max_end) ? piece->destEnd : max_end);
+	}
+	if (piece->destEnd > max_end)
+	    max_end = piece->destEnd;
+    }
+    if (!multi)
+	return;
+    for (piece = *pPieces; piece != NULL; piece = piece->next)
+    {
+	struct range *range;
+	for (range = rangeTreeAllOverlapping(multi, piece->destStart, piece->destEnd); range != NULL; range = range->next)
+	{
+	    int ms = (range->start > piece->destStart) ? range->start : piece->destStart;
+	    int me = (range->end < piece->destEnd) ? range->end : piece->destEnd;
+	    lift_piece_set_na(piece, ms, me);
+	    if (pBad)
+		add_multi_run(pBad, piece, ms, me);
+	}
+    }
+    rangeTreeFree(&multi);
+}
+
+static void collapse_unlifted(struct unliftedRun *list)
+/* merge runs (already in source order) that touch, have the same reason, and for */
+/* multi_mapped, carry on to the next destination base the same way */
+{
+    struct unliftedRun *run = list;
+    while ((run != NULL) && (run->next != NULL))
+    {
+	struct unliftedRun *next = run->next;
+	boolean same = sameString(next->chrom, run->chrom) && (next->start == run->end) && (next->why == run->why);
+	if (same && (run->why == multi_mapped))
+	{
+	    int len = run->end - run->start;
+	    same = sameString(next->destChrom, run->destChrom) && (next->strand == run->strand) &&
+		(next->destStart == ((run->strand == '-') ? run->destStart - len : run->destStart + len));
+	}
+	if (same)
+	{
+	    run->end = next->end;
+	    run->next = next->next;
+	    freeMem(next);
+	}
+	else
+	    run = next;
     }
-    if (bad_file)
-	carefulClose(&bad);
 }
 
-int pbwHashElCmp(const void *va, const void *vb)
+static char *unlifted_reason(struct unliftedRun *run, char *buf, size_t size)
+/* the name given to the run in the bed */
 {
-    const struct perBaseWig *pbwa = (struct perBaseWig *)(*((struct hashEl **)va))->val;
-    const struct perBaseWig *pbwb = (struct perBaseWig *)(*((struct hashEl **)vb))->val;
-    return pbwb->len - pbwa->len;
+    if (run->why == multi_mapped)
+	safef(buf, size, "multi_mapped_%s_%d", run->destChrom, run->destStart);
+    else if (run->why == duplicated)
+	safef(buf, size, "duplicated_in_destination");
+    else if (run->why == deleted)
+	safef(buf, size, "deleted_in_destination");
+    else if (run->why == dest_not_sized)
+	safef(buf, size, "destination_chrom_not_in_sizes");
+    else if (run->why == past_dest_end)
+	safef(buf, size, "past_end_of_destination_chrom");
+    else
+	safef(buf, size, "problem_lifting");
+    return buf;
+}
+
+static void output_unlifted_bed(char *bad_file, struct unliftedRun *list)
+/* one bed6 line per run.  for multi_mapped the name has where the first base went and */
+/* the strand is the direction the rest of the run goes in the destination */
+{
+    FILE *bad = mustOpen_tracked(bad_file, "w");
+    struct unliftedRun *run;
+    char name[512];
+    for (run = list; run != NULL; run = run->next)
+	fprintf(bad, "%s\t%d\t%d\t%s\t0\t%c\n", run->chrom, run->start, run->end,
+		unlifted_reason(run, name, sizeof(name)), (run->why == multi_mapped) ? run->strand : '.');
+    carefulClose_tracked(&bad);
+}
+
+/* bwtool unlifted magic bytes:
+     BwtUnlft
+     42 77 74 55 6e 6c 66 74
+*/
+const uint64_t UNLIFTED_MAGIC = 0x74666c6e55747742;
+
+/* bwtool unlifted file format version number. */
+const uint64_t UNLIFTED_VERSION = 1;
+
+struct unlifted_header
+/* start of the binary unlifted file.  everything after it is in native byte order: */
+/* the source chrom table, the runs, then the zero-terminated names */
+{
+    /* Magic bytes: UNLIFTED_MAGIC */
+    uint64_t magic;
+    /* File format version: UNLIFTED_VERSION */
+    uint64_t version;
+    uint64_t num_chroms;
+    uint64_t num_runs;
+    uint64_t names_size;
+};
+
+struct unlifted_chrom
+/* a source chrom and where its runs are, so one chrom can be read without the rest */
+{
+    bits32 name_offset;
+    bits32 first_run;
+    bits32 num_runs;
+    bits32 reserved;
+};
+
+struct unlifted_record
+/* one run.  the dest fields are only used for multi_mapped */
+{
+    bits32 start;
+    bits32 end;
+    bits32 why;                 /* enum remapResult */
+    bits32 dest_name_offset;
+    bits32 dest_start;
+    bits32 strand;
+};
+
+static bits32 unlifted_name_offset(struct hash *nameHash, struct dyString *names, char *name)
+/* find the name or add it */
+{
+    struct hashEl *hel = hashLookup(nameHash, name);
+    if (hel)
+	return (bits32)ptToInt(hel->val);
+    hashAddInt(nameHash, name, names->stringSize);
+    dyStringAppendN(names, name, strlen(name) + 1);
+    return (bits32)(names->stringSize - strlen(name) - 1);
+}
+
+static void output_unlifted_binary(char *bad_file, struct unliftedRun *list)
+/* the same runs in a fixed-size record form that's quicker to load downstream */
+{
+    struct hash *nameHash = hashNew(10);
+    struct dyString *names = dyStringNew(0);
+    struct unlifted_header header;
+    struct unlifted_chrom *chroms;
+    struct unlifted_record *records;
+    struct unliftedRun *run;
+    int num_runs = slCount(list);
+    char *prev_chrom = NULL;
+    int num_chroms = 0;
+    int i;
+    FILE *bad;
+    AllocArray(chroms, num_runs + 1);
+    AllocArray(records, num_runs + 1);
+    for (run = list, i = 0; run != NULL; run = run->next, i++)
+    {
+	struct unlifted_record *rec = &records[i];
+	if ((i == 0) || !sameString(run->chrom, prev_chrom))
+	{
+	    prev_chrom = run->chrom;
+	    chroms[num_chroms].name_offset = unlifted_name_offset(nameHash, names, run->chrom);
+	    chroms[num_chroms].first_run = i;
+	    num_chroms++;
+	}
+	chroms[num_chroms-1].num_runs++;
+	rec->start = run->start;
+	rec->end = run->end;
+	rec->why = run->why;
+	if (run->why == multi_mapped)
+	{
+	    rec->dest_name_offset = unlifted_name_offset(nameHash, names, run->destChrom);
+	    rec->dest_start = run->destStart;
+	    rec->strand = run->strand;
+	}
+    }
+    ZeroVar(&header);
+    header.magic = UNLIFTED_MAGIC;
+    header.version = UNLIFTED_VERSION;
+    header.num_chroms = num_chroms;
+    header.num_runs = num_runs;
+    header.names_size = names->stringSize;
+    bad = mustOpen_tracked(bad_file, "wb");
+    mustWrite(bad, &header, sizeof(header));
+    mustWrite(bad, chroms, num_chroms * sizeof(struct unlifted_chrom));
+    mustWrite(bad, records, num_runs * sizeof(struct unlifted_record));
+    mustWrite(bad, names->string, names->stringSize);
+    carefulClose_tracked(&bad);
+    freeMem(chroms);
+    freeMem(records);
+    dyStringFree(&names);
+    hashFree(&nameHash);
+}
+
+int sizeHashElCmp(const void *va, const void *vb)
+/* biggest chroms first */
+{
+    const struct hashEl *a = *((struct hashEl **)va);
+    const struct hashEl *b = *((struct hashEl **)vb);
+    return ptToInt(b->val) - ptToInt(a->val);
+}
+
+struct lift_dest
+/* one destination chrom's pieces, checked for multi-mapping by the threads */
+{
+    struct liftPiece *pieces;
+    struct unliftedRun *multi;
+};
+
+struct lift_dest_batch
+/* all the destination chroms with something lifted to them, biggest first */
+{
+    struct lift_dest *dests;
+    boolean keep_bad;
+};
+
+static void mark_multi_mapped_job(void *data, int job_ix, int thread_ix)
+/* parallel_for() job: one destination chrom.  chroms don't share any bases so */
+/* each one's conflicts are found on its own */
+{
+    struct lift_dest_batch *batch = (struct lift_dest_batch *)data;
+    struct lift_dest *dest = &batch->dests[job_ix];
+    mark_multi_mapped(&dest->pieces, (batch->keep_bad) ? &dest->multi : NULL);
 }
 
 void bwtool_lift(struct hash *options, char *favorites, char *regions, unsigned decimals,
 		 enum wigOutType wot, char *bigfile, char *tmp_dir, char *chainfile, char *outputfile)
 /* bwtool_lift - main for lifting program */
 {
+    boolean use_index_file = (hashFindVal(options, "no-chain-index") == NULL) ? TRUE : FALSE;
+    struct liftIndex *li = liftIndexOpen(chainfile, tmp_dir, use_index_file);
     struct hash *sizeHash = NULL;
-    struct hash *chainHash = readLiftOverMapChainHash(chainfile);
-    struct hash *gpbw = NULL;
+    struct hash *chainHash = liftIndexChainHash(li);
+    struct hash *destHash = hashNew(10);
+    struct unliftedRun *badList = NULL;
+    struct lift_dest_batch dest_batch;
+    int num_threads = get_num_threads(options);
+    int num_dests = 0;
+    int i;
     char *size_file = hashFindVal(options, "sizes");
     char *bad_file = hashFindVal(options, "unlifted");
     if (size_file)
 	sizeHash = readCsizeHash(size_file);
     else
-	sizeHash = qSizeHash(chainfile);
-    gpbw = genomePbw(sizeHash);
+	sizeHash = liftIndexQSizes(li);
     struct metaBig *mb = metaBigOpen_check(bigfile, tmp_dir, regions);
     char wigfile[512];
     safef(wigfile, sizeof(wigfile), "%s.tmp.wig", outputfile);
-    FILE *out = mustOpen(wigfile, "w");
-    struct hashEl *elList = hashElListHash(gpbw);
+    FILE *out = mustOpen_tracked(wigfile, "w");
+    struct hashEl *elList = hashElListHash(sizeHash);
     struct hashEl *el;
-    verbose(2,"starting first pass\n");
-    do_pass1(mb, chainHash, gpbw);
-    verbose(2, "starting second pass\n");
-    do_pass2(mb, chainHash, gpbw);
-    verbose(2,"starting final pass\n");
-    do_final_pass(mb, chainHash, gpbw, bad_file);
-    slSort(&elList, pbwHashElCmp);
+    verbose(2,"lifting\n");
+    badList = lift_sections(mb, bigfile, tmp_dir, num_threads, chainHash, sizeHash, destHash,
+			    (bad_file) ? TRUE : FALSE);
+    /* check each destination chrom for multi-mapping, then write them out biggest first */
+    slSort(&elList, sizeHashElCmp);
+    AllocArray(dest_batch.dests, slCount(elList));
+    dest_batch.keep_bad = (bad_file) ? TRUE : FALSE;
     for (el = elList; el != NULL; el = el->next)
     {
-	struct perBaseWig *pbw = (struct perBaseWig *)el->val;
-	perBaseWigOutputNASkip(pbw, out, wot, decimals, NULL, FALSE, FALSE);
+	struct hashEl *hel = hashLookup(destHash, el->name);
+	if (!hel || !hel->val)
+	    continue;
+	dest_batch.dests[num_dests++].pieces = (struct liftPiece *)hel->val;
+	hel->val = NULL;
+    }
+    parallel_for(num_threads, num_dests, mark_multi_mapped_job, &dest_batch);
+    for (i = 0; i < num_dests; i++)
+    {
+	struct lift_dest *dest = &dest_batch.dests[i];
+	struct liftPiece *piece;
+	size_t lifted_size = 0;
+	unsigned long long prof_start = PROFILE_START();
+	for (piece = dest->pieces; piece != NULL; piece = piece->next)
+	{
+	    output_lift_piece(piece, out, wot, decimals);
+	    lifted_size += lift_piece_size(piece);
+	}
+	PROFILE_STOP(prof_format, prof_start);
+	liftPieceFreeList(&dest->pieces);
+	memTrackSub(mem_pbw, lifted_size);
+	badList = slCat(dest->multi, badList);
     }
+    freeMem(dest_batch.dests);
     hashElFreeList(&elList);
-    carefulClose(&out);
+    hashFreeWithVals(&destHash, freeLiftPieceList);
+    carefulClose_tracked(&out);
+    if (bad_file)
+    {
+	slSort(&badList, unliftedRunCmp);
+	collapse_unlifted(badList);
+	if (hashFindVal(options, "unlifted-binary"))
+	    output_unlifted_binary(bad_file, badList);
+	else
+	    output_unlifted_bed(bad_file, badList);
+	slFreeList(&badList);
+    }
+    /* the destination chrom names of the pieces were in here */
     hashFreeWithVals(&chainHash, freeChainHashMap);
-    hashFreeWithVals(&gpbw, perBaseWigFree);
+    liftIndexFree(&li);
     writeBw(wigfile, outputfile, sizeHash);
     hashFree(&sizeHash);
     remove(wigfile);
-    metaBigClose(&mb);
+    metaBigRelease(&mb);
 }
@@ -18,6 +18,11 @@
 #include "bwtool.h"
 #include <beato/cluster.h>
 #include "bwtool_shared.h"
+#include "blockcache.h"
+#include "prefetch.h"
+#include "kmeans.h"
+#include "profile.h"
+#include "memtrack.h"
 
 /* bwtool binary matrix magic bytes:
      BwTool\x91\x90
@@ -155,10 +160,22 @@ errAbort(
   "   -long-form=labels\n"
   "   -long-form-header\n"
   "   -cluster=k      cluster regions with k-means where k is the number of\n"
-  "                   clusters\n"
+  "                   clusters.  Rows with NA aren't clustered and come first.\n"
+  "   -seed=s         seed for picking the starting centroids (default 0).  The\n"
+  "                   same seed gives the same clusters.\n"
+  "   -cluster-max-iter=n\n"
+  "                   stop k-means after n iterations (default 300)\n"
+  "   -cluster-reduce=paa:n or random:n\n"
+  "                   shorten the rows to n values before clustering, with\n"
+  "                   piecewise aggregate approximation (segment means) or a\n"
+  "                   random projection.  The output rows are still full length.\n"
+  "   -cluster-mini-batch=b\n"
+  "                   do mini-batch k-means, moving the centroids with random\n"
+  "                   batches of b regions, which is much faster for many regions\n"
   "   -cluster-centroids=file\n"
   "                   store the calculated cluster centroids in a file additional\n"
   "                   to output.txt\n"
+  "   -threads=n      read n bigWigs at a time and cluster using n threads\n"
   );
 }
 
@@ -174,7 +191,7 @@ void na_or_num(FILE *out, double num, int decimals)
 void output_centroids(struct cluster_bed_matrix *cbm, char *centroid_file, int decimals)
 /* strictly the centroids */
 {
-    FILE *out2 = mustOpen(centroid_file, "w");
+    FILE *out2 = mustOpen_tracked(centroid_file, "w");
     int i, j, k = cbm->k;
     int total = cbm->n - cbm->num_na;
     fprintf(out2, "# num NA = %d, num total = %d\n", cbm->num_na, total);
@@ -184,13 +201,13 @@ void output_centroids(struct cluster_bed_matrix *cbm, char *centroid_file, int d
 	for (j = 0; j < cbm->m; j++)
 	    fprintf(out2, "%f%c", cbm->centroids[i][j], (j == cbm->m-1) ? '\n' : ',');
     }
-    carefulClose(&out2);
+    carefulClose_tracked(&out2);
 }
 
 void output_cluster_matrix(struct cluster_bed_matrix *cbm, int decimals, boolean keep_bed, char *outputfile)
 /* non-long output */
 {
-    FILE *out = mustOpen(outputfile, "w");
+    FILE *out = mustOpen_tracked(outputfile, "w");
     int i, j;
     for (i = 0; i < cbm->pbm->nrow; i++)
     {
@@ -205,13 +222,13 @@ void output_cluster_matrix(struct cluster_bed_matrix *cbm, int decimals, boolean
 	    fprintf(out, "%c", (j == pbw->len-1) ? '\n' : '\t');
 	}
     }
-    carefulClose(&out);
+    carefulClose_tracked(&out);
 }
 
 void output_binary_cluster_matrix(struct cluster_bed_matrix *cbm, boolean keep_bed, char *outputfile)
 /* Binary cluster matrix output */
 {
-    FILE *out = mustOpen(outputfile, "w");
+    FILE *out = mustOpen_tracked(outputfile, "w");
     int i;
 
     /* Write the header. */
@@ -221,12 +238,15 @@ void output_binary_cluster_matrix(struct cluster_bed_matrix *cbm, boolean keep_b
     /* Put binary cluster matrix at offset 4096. */
     fseek(out, 4096, SEEK_SET);
 
-    /* Write the binary cluster matrix. */
-    for (i = 0; i < cbm->pbm->nrow; i++)
-    {
-	struct perBaseWig *pbw = cbm->pbm->array[i];
-	fwrite(pbw->data, sizeof(double), pbw->len, out);
-    }
+    /* Write the binary cluster matrix, in one go if clustering left the rows in one block. */
+    if ((cbm->pbm->nrow > 0) && perBaseMatrixIsPacked(cbm->pbm))
+	fwrite(cbm->pbm->matrix[0], sizeof(double), (size_t)cbm->pbm->nrow * cbm->pbm->ncol, out);
+    else
+	for (i = 0; i < cbm->pbm->nrow; i++)
+	{
+	    struct perBaseWig *pbw = cbm->pbm->array[i];
+	    fwrite(pbw->data, sizeof(double), pbw->len, out);
+	}
 
     /* Put the text metadata at a multiple of 4096. */
     fseek(out, binary_matrix_header_instance.text_metadata_offset, SEEK_SET);
@@ -242,13 +262,13 @@ void output_binary_cluster_matrix(struct cluster_bed_matrix *cbm, boolean keep_b
 	fprintf(out, "%d\t", pbw->label);
 	fprintf(out, "%f\n", pbw->cent_distance);
     }
-    carefulClose(&out);
+    carefulClose_tracked(&out);
 }
 
 void output_cluster_matrix_long(struct cluster_bed_matrix *cbm, struct slName *labels, boolean keep_bed, char *outputfile, boolean header)
 /* For handling long-form cluster output */
 {
-    FILE *out = mustOpen(outputfile, "w");
+    FILE *out = mustOpen_tracked(outputfile, "w");
     int i, j, l;
     char **labels_array;
     int *subpos_array;
@@ -295,7 +315,7 @@ void output_cluster_matrix_long(struct cluster_bed_matrix *cbm, struct slName *l
     }
     freeMem(labels_array);
     freeMem(subpos_array);
-    carefulClose(&out);
+    carefulClose_tracked(&out);
 }
 
 void output_matrix_long(struct perBaseMatrix *pbm, int decimals, struct slName *labels, boolean keep_bed, int left,
@@ -303,7 +323,7 @@ void output_matrix_long(struct perBaseMatrix *pbm, int decimals, struct slName *
 /* long output.  right this is just patching things up.  this and some other stuff could be combined */
 /* with aggregate some day. */
 {
-    FILE *out = mustOpen(outputfile, "w");
+    FILE *out = mustOpen_tracked(outputfile, "w");
     int i,j,k, lr_pos;
     int n_labels = slCount(labels);
     int unfused_cols = pbm->ncol / n_labels;
@@ -345,13 +365,13 @@ void output_matrix_long(struct perBaseMatrix *pbm, int decimals, struct slName *
 	    }
 	}
     }
-    carefulClose(&out);
+    carefulClose_tracked(&out);
 }
 
 void output_matrix(struct perBaseMatrix *pbm, int decimals, boolean keep_bed, char *outputfile)
 /* the simplest output */
 {
-    FILE *out = mustOpen(outputfile, "w");
+    FILE *out = mustOpen_tracked(outputfile, "w");
     int i,j;
     for (i = 0; i < pbm->nrow; i++)
     {
@@ -364,13 +384,13 @@ void output_matrix(struct perBaseMatrix *pbm, int decimals, boolean keep_bed, ch
 	    fprintf(out, "%c", (j == pbw->len-1) ? '\n' : '\t');
 	}
     }
-    carefulClose(&out);
+    carefulClose_tracked(&out);
 }
 
 void output_binary_matrix(struct perBaseMatrix *pbm, boolean keep_bed, char *outputfile)
 /* Binary matrix output */
 {
-    FILE *out = mustOpen(outputfile, "w");
+    FILE *out = mustOpen_tracked(outputfile, "w");
     int i;
 
     /* Write the header. */
@@ -380,12 +400,15 @@ void output_binary_matrix(struct perBaseMatrix *pbm, boolean keep_bed, char *out
     /* Put matrix at offset 4096. */
     fseek(out, 4096, SEEK_SET);
 
-    /* Write the binary matrix. */
-    for (i = 0; i < pbm->nrow; i++)
-    {
-	struct perBaseWig *pbw = pbm->array[i];
-        fwrite(pbw->data, sizeof(double), pbw->len, out);
-    }
+    /* Write the binary matrix, in one go if it's in one block. */
+    if ((pbm->nrow > 0) && perBaseMatrixIsPacked(pbm))
+	fwrite(pbm->matrix[0], sizeof(double), (size_t)pbm->nrow * pbm->ncol, out);
+    else
+	for (i = 0; i < pbm->nrow; i++)
+	{
+	    struct perBaseWig *pbw = pbm->array[i];
+	    fwrite(pbw->data, sizeof(double), pbw->len, out);
+	}
 
     /* Write the BED file after the matrix, if requested. */
     if (keep_bed){
@@ -398,7 +421,7 @@ void output_binary_matrix(struct perBaseMatrix *pbm, boolean keep_bed, char *out
 	    fprintf(out, "%s\t%d\t%d\t%s\t%d\t%c\n", pbw->chrom, pbw->chromStart, pbw->chromEnd, pbw->name, pbw->score, pbw->strand[0]);
 	}
     }
-    carefulClose(&out);
+    carefulClose_tracked(&out);
 }
 
 static struct slName *setup_labels(char *long_form, struct slName *bw_list, struct slName **labels_from_bw_list)
@@ -435,6 +458,139 @@ void check_list(struct bed6 *list)
 	uglyf("   %s\t%d\t%d\n", one->chrom, one->chromStart, one->chromEnd);
 }
 
+struct matrix_fetch
+/* what the threads need to load each bigWig's part of the matrix */
+{
+    char **bw_names;
+    struct metaBig **mbs;           /* Opened up front, in the same order. */
+    char *tmp_dir;
+    double fill;
+    boolean do_meta;
+    boolean do_tile;
+    int tile;
+    int meta;
+    int left;
+    int right;
+    int prefetch;                   /* Range requests at once for remote bigWigs. */
+    struct bed6 *regs;              /* With meta, the regions as they are in the bed. */
+    int ncol;                       /* Columns each bigWig gives. */
+    struct perBaseMatrix *wide;     /* Every bigWig's columns side by side. */
+};
+
+static void copy_into_columns(struct perBaseMatrix *wide, struct perBaseMatrix *one, int col, char *bw_name)
+/* put one bigWig's matrix into its columns of the wide one */
+{
+    int i;
+    if ((one->nrow != wide->nrow) || (col + one->ncol > wide->ncol))
+	errAbort("the matrix from %s doesn't line up with the others", bw_name);
+    for (i = 0; i < wide->nrow; i++)
+	memcpy(wide->matrix[i] + col, one->matrix[i], one->ncol * sizeof(double));
+}
+
+static boolean fetch_copies(struct matrix_fetch *fetch, struct metaBig *mb)
+/* if the bigWig's part has to be made as a matrix of its own and copied in: tiled */
+/* averages, and files other than bigWigs when not doing meta */
+{
+    return (fetch->do_tile || (!fetch->do_meta && (mb->type != isaBigWig)));
+}
+
+static void matrix_fetch_job(void *data, int job_ix, int thread_ix)
+/* parallel_for() job: load one bigWig's columns of the matrix.  bigWigs are read */
+/* straight into their columns, other things are made into a matrix then copied in */
+{
+    struct matrix_fetch *fetch = (struct matrix_fetch *)data;
+    struct metaBig *mb = fetch->mbs[job_ix];
+    int col = job_ix * fetch->ncol;
+    int pad = (!fetch->do_meta) ? 0 : (fetch->left > fetch->right) ? fetch->left : fetch->right;
+    prefetch_regions(mb, fetch->regs, pad, fetch->tmp_dir, fetch->prefetch);
+    if (fetch->do_meta)
+	load_meta_span_rows(mb, fetch->regs, fetch->left, fetch->meta, fetch->right, fetch->fill,
+			    fetch->wide->matrix, col);
+    else if (!fetch_copies(fetch, mb))
+	load_rows_cached(mb, fetch->regs, fetch->fill, fetch->wide->matrix, col);
+    else
+    {
+	struct perBaseMatrix *one_pbm = (fetch->do_tile) ? load_ave_perBaseMatrix(mb, fetch->regs, fetch->tile, fetch->fill) :
+	    load_perBaseMatrix_cached(mb, fetch->regs, fetch->fill);
+	size_t one_size = perBaseMatrixSize(one_pbm);
+	memTrackAdd(mem_pbm, one_size);
+	copy_into_columns(fetch->wide, one_pbm, col, fetch->bw_names[job_ix]);
+	free_perBaseMatrix(&one_pbm);
+	memTrackSub(mem_pbm, one_size);
+    }
+}
+
+static struct perBaseMatrix *alloc_wide_pbm(struct matrix_fetch *fetch, int ncol, boolean keep_score, double **pBlock)
+/* make the matrix every bigWig's columns go into, with a row per region labelled the */
+/* way the loaders label them (with the score only kept for one bigWig, like */
+/* fuse_pbm()).  the rows are made straight into one packed block, returned in pBlock */
+{
+    struct perBaseMatrix *wide;
+    struct bed6 *bed;
+    double *block;
+    int i;
+    AllocVar(wide);
+    wide->nrow = slCount(fetch->regs);
+    wide->ncol = ncol;
+    block = alloc_packed_block(wide->nrow, ncol);
+    AllocArray(wide->array, wide->nrow);
+    AllocArray(wide->matrix, wide->nrow);
+    for (bed = fetch->regs, i = 0; bed != NULL; bed = bed->next, i++)
+    {
+	struct perBaseWig *row;
+	AllocVar(row);
+	row->chrom = cloneString(bed->chrom);
+	if (fetch->do_meta)
+	    meta_span_coords(bed, fetch->left, fetch->right, &row->chromStart, &row->chromEnd);
+	else
+	{
+	    row->chromStart = bed->chromStart;
+	    row->chromEnd = bed->chromEnd;
+	}
+	row->data = block + (size_t)i * ncol;
+	row->len = ncol;
+	row->name = cloneString(bed->name);
+	row->score = (keep_score) ? bed->score : 0;
+	row->strand[0] = bed->strand[0];
+	wide->array[i] = row;
+	wide->matrix[i] = row->data;
+    }
+    *pBlock = block;
+    return wide;
+}
+
+static struct perBaseMatrix *load_wide_pbm(struct matrix_fetch *fetch, int num_bigwigs, int num_threads, double **pBlock)
+/* load every bigWig's columns side by side, num_threads bigWigs at a time.  the width */
+/* is each bigWig's width times the number of bigWigs, and the result is in one packed */
+/* block, returned in pBlock.  bigWigs are read straight into their columns; only tiled */
+/* averages and non-bigWig files need a matrix of their own first (and fewer threads */
+/* are used for those if -mem-limit can't fit one per thread) */
+{
+    struct perBaseMatrix *pbm;
+    int nrow = slCount(fetch->regs);
+    size_t wide_size = matrixSize(nrow, fetch->ncol * num_bigwigs);
+    size_t one_size = 0;
+    int i;
+    for (i = 0; i < num_bigwigs; i++)
+	if (fetch_copies(fetch, fetch->mbs[i]))
+	    one_size = matrixSize(nrow, fetch->ncol);
+    memTrackNeed(wide_size + one_size, "the matrix");
+    if (num_threads > num_bigwigs)
+	num_threads = num_bigwigs;
+    if ((one_size > 0) && ((memTrackAvailable() - wide_size) / one_size < (size_t)num_threads))
+    {
+	num_threads = (int)((memTrackAvailable() - wide_size) / one_size);
+	verbose(2, "loading %d bigWig%s at a time to stay under -mem-limit\n", num_threads,
+		(num_threads > 1) ? "s" : "");
+    }
+    pbm = alloc_wide_pbm(fetch, fetch->ncol * num_bigwigs, (num_bigwigs == 1) && !fetch->do_meta, pBlock);
+    memTrackAdd(mem_pbm, perBaseMatrixSize(pbm));
+    fetch->wide = pbm;
+    parallel_for(num_threads, num_bigwigs, matrix_fetch_job, fetch);
+    fetch->wide = NULL;
+    return pbm;
+}
+
 void bwtool_matrix(struct hash *options, char *favorites, char *regions, unsigned decimals,
 		   double fill, char *range_s, char *bigfile, char *tmp_dir, char *outputfile)
 /* bwtool_matrix - main for matrix-creation program */
@@ -455,8 +611,9 @@ void bwtool_matrix(struct hash *options, char *favorites, char *regions, unsigne
     boolean do_meta = (num_parse == 3);
     int k = (int)sqlUnsigned((char *)hashOptionalVal(options, "cluster", "0"));
     int tile = (int)sqlUnsigned((char *)hashOptionalVal(options, "tiled-averages", "1"));
-    if ((do_k) && ((k < 2) || (k > 10)))
-	errAbort("k should be between 2 and 10\n");
+    unsigned long long prof_start;
+    if ((do_k) && (k < 2))
+	errAbort("k should be at least 2\n");
     if ((do_tile) && (tile < 2))
 	errAbort("tiling should be done for larger regions");
     if ((left % tile != 0) || (right % tile != 0))
@@ -471,12 +628,16 @@ void bwtool_matrix(struct hash *options, char *favorites, char *regions, unsigne
 	errAbort("Writing binary matrix is not compatible with -long-form... yet");
     struct slName *bw_names = slNameListFromComma(bigfile);
     struct slName *bw_name;
+    struct matrix_fetch fetch;
+    struct metaBig *mb_list, *mb;
+    double *block = NULL;
+    int num_threads = get_num_threads(options);
     struct slName *labels_from_file = NULL;
     int num_bigwigs = check_for_list_files(&bw_names, &labels_from_file, 0);
     struct slName *labels = setup_labels(long_form, bw_names, &labels_from_file);
     struct bed6 *regs = NULL;
-    struct bed6 *regions_left = NULL, *regions_right = NULL, *regions_meta = NULL;
     struct perBaseMatrix *pbm = NULL;
+    size_t regs_size, pbm_size;
     int i;
     if (do_meta)
     {
@@ -485,41 +646,47 @@ void bwtool_matrix(struct hash *options, char *favorites, char *regions, unsigne
 	    meta = calculate_meta_file(regions);
 	    fprintf(stderr, "calculated meta = %d bases\n", meta);
 	}
-	regions_left = load_and_recalculate_coords(regions, left, 0, FALSE, TRUE, FALSE);
-	regions_right = load_and_recalculate_coords(regions, 0, right, FALSE, FALSE, TRUE);
-	regions_meta = (meta > 0) ? readBed6Soft(regions) : NULL;
+	regs = readBed6Soft_cached(regions);
     }
     else
 	regs = load_and_recalculate_coords(regions, left, right, FALSE, starts, ends);
-    for (bw_name = bw_names; bw_name != NULL; bw_name = bw_name->next)
+    regs_size = bed6ListSize(regs);
+    memTrackAdd(mem_beds, regs_size);
+    ZeroVar(&fetch);
+    AllocArray(fetch.bw_names, num_bigwigs);
+    AllocArray(fetch.mbs, num_bigwigs);
+    mb_list = metaBigOpenList(bw_names, tmp_dir, NULL, NULL);
+    for (bw_name = bw_names, mb = mb_list, i = 0; bw_name != NULL; bw_name = bw_name->next, mb = mb->next, i++)
     {
-	struct metaBig *mb = metaBigOpenWithTmpDir(bw_name->name, tmp_dir, NULL);
-	if (do_meta)
-	{
-	    struct perBaseMatrix *one_pbm = load_perBaseMatrix(mb, regions_left, fill);
-	    struct perBaseMatrix *right_pbm = load_perBaseMatrix(mb, regions_right, fill);
-	    if (meta > 0)
-	    {
-		struct perBaseMatrix *meta_pbm = load_meta_perBaseMatrix(mb, regions_meta, meta, fill);
-		fuse_pbm(&one_pbm, &meta_pbm, TRUE);
-	    }
-	    fuse_pbm(&one_pbm, &right_pbm, TRUE);
-	    fuse_pbm(&pbm, &one_pbm, FALSE);
-	}
-	else
-	{
-	    struct perBaseMatrix *one_pbm = (do_tile) ? load_ave_perBaseMatrix(mb, regs, tile, fill) :
-		load_perBaseMatrix(mb, regs, fill);
-	    fuse_pbm(&pbm, &one_pbm, FALSE);
-	}
-	metaBigClose(&mb);
+	fetch.bw_names[i] = bw_name->name;
+	fetch.mbs[i] = mb;
     }
+    fetch.tmp_dir = tmp_dir;
+    fetch.fill = fill;
+    fetch.do_meta = do_meta;
+    fetch.do_tile = do_tile;
+    fetch.tile = tile;
+    fetch.meta = meta;
+    fetch.regs = regs;
+    fetch.left = left;
+    fetch.right = right;
+    fetch.prefetch = get_prefetch_connections(options);
+    fetch.ncol = (do_meta) ? left + meta + right : (left + right) / tile;
+    pbm = load_wide_pbm(&fetch, num_bigwigs, num_threads, &block);
+    pbm_size = perBaseMatrixSize(pbm);
+    while ((mb = slPopHead(&mb_list)) != NULL)
+	metaBigRelease(&mb);
+    freeMem(fetch.mbs);
+    freeMem(fetch.bw_names);
     if (do_k)
     {
 	struct cluster_bed_matrix *cbm = NULL;
 	/* ordered by cluster with label in first column */
+	struct kmeans_params params;
+	kmeans_params_from_options(options, k, &params);
 	cbm = init_cbm_from_pbm(pbm, k);
-	do_kmeans_sort(cbm, 0.001, TRUE);
+	kmeans_cluster_cbm(cbm, &params);
+	prof_start = PROFILE_START();
 	if (do_long_form)
 	{
 	    output_cluster_matrix_long(cbm, labels, keep_bed, outputfile, lf_header);
@@ -539,10 +706,14 @@ void bwtool_matrix(struct hash *options, char *favorites, char *regions, unsigne
 	{
 	    output_centroids(cbm, centroid_file, decimals);
 	}
+	PROFILE_STOP((do_binary_matrix) ? prof_write : prof_format, prof_start);
+	unpack_perBaseMatrix(pbm, &block);
 	free_cbm(&cbm);
+	memTrackSub(mem_pbm, pbm_size);
     }
     else
     {
+	prof_start = PROFILE_START();
 	if (do_long_form)
 	{
 	    output_matrix_long(pbm, decimals, labels, keep_bed, left, right, tile, lf_header, outputfile);
@@ -558,16 +729,12 @@ void bwtool_matrix(struct hash *options, char *favorites, char *regions, unsigne
 		output_matrix(pbm, decimals, keep_bed, outputfile);
 	    }
 	}
+	PROFILE_STOP((do_binary_matrix) ? prof_write : prof_format, prof_start);
 	/* unordered, no label  */
+	unpack_perBaseMatrix(pbm, &block);
 	free_perBaseMatrix(&pbm);
+	memTrackSub(mem_pbm, pbm_size);
     }
-    if (do_meta)
-    {
-	bed6FreeList(&regions_left);
-	bed6FreeList(&regions_right);
-	if (meta > 0)
-	    bed6FreeList(&regions_meta);
-    }
-    else
-	bed6FreeList(&regs);
+    bed6FreeList(&regs);
+    memTrackSub(mem_beds, regs_size);
 }
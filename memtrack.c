@@ -0,0 +1,227 @@
+/* accounting for the big structures, for -mem-report and -mem-limit */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <jkweb/common.h>
+#include <jkweb/hash.h>
+#include <beato/bigs.h>
+#include "memtrack.h"
+
+#include <pthread.h>
+
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t mem_limit = 0;
+static size_t live[MEM_KINDS];
+static size_t peak[MEM_KINDS];
+static size_t at_peak[MEM_KINDS];      /* What was held when the total peaked. */
+static size_t total_live = 0;
+static size_t total_peak = 0;
+
+static char *kind_names[MEM_KINDS] = {
+    "perBaseWig", "perBaseMatrix", "agg_data", "clusters", "beds", "chunks",
+};
+
+static void format_bytes(size_t bytes, char *buf, int size)
+/* bytes in the biggest unit that keeps it over 1 */
+{
+    if (bytes >= (size_t)1 << 30)
+	safef(buf, size, "%.2f GB", (double)bytes / ((size_t)1 << 30));
+    else if (bytes >= (size_t)1 << 20)
+	safef(buf, size, "%.1f MB", (double)bytes / ((size_t)1 << 20));
+    else if (bytes >= (size_t)1 << 10)
+	safef(buf, size, "%.1f KB", (double)bytes / ((size_t)1 << 10));
+    else
+	safef(buf, size, "%llu bytes", (unsigned long long)bytes);
+}
+
+static size_t parse_size(char *s)
+/* megabytes, or a number with a K, M, or G after it */
+{
+    char *end;
+    double num = strtod(s, &end);
+    int shift = 20;
+    if ((end == s) || (num < 0))
+	errAbort("-mem-limit should be a size like 4000, 500M, or 8G");
+    if (*end != '\0')
+    {
+	char unit = toupper(*end);
+	if (unit == 'K')
+	    shift = 10;
+	else if (unit == 'M')
+	    shift = 20;
+	else if (unit == 'G')
+	    shift = 30;
+	else
+	    errAbort("-mem-limit should be a size like 4000, 500M, or 8G");
+	end++;
+	if ((toupper(*end) == 'B') && (end[1] == '\0'))
+	    end++;
+	if (*end != '\0')
+	    errAbort("-mem-limit should be a size like 4000, 500M, or 8G");
+    }
+    return (size_t)(num * ((size_t)1 << shift));
+}
+
+boolean memTrackSetup(struct hash *options)
+/* set the limit from -mem-limit=size (megabytes, or with a K, M, or G suffix).  */
+/* returns TRUE if -mem-report is given, so whoever called this does the report */
+{
+    char *limit_s = (char *)hashFindVal(options, "mem-limit");
+    int i;
+    mem_limit = (limit_s) ? parse_size(limit_s) : 0;
+    if (hashFindVal(options, "mem-report") == NULL)
+	return FALSE;
+    pthread_mutex_lock(&mem_lock);
+    for (i = 0; i < MEM_KINDS; i++)
+	peak[i] = at_peak[i] = live[i];
+    total_peak = total_live;
+    pthread_mutex_unlock(&mem_lock);
+    return TRUE;
+}
+
+void memTrackAdd(enum mem_kind kind, size_t bytes)
+/* count bytes as held.  if that goes over -mem-limit, stop with a message saying */
+/* what was being loaded */
+{
+    size_t total, of_kind;
+    pthread_mutex_lock(&mem_lock);
+    of_kind = live[kind] += bytes;
+    total = total_live += bytes;
+    if (live[kind] > peak[kind])
+	peak[kind] = live[kind];
+    if (total > total_peak)
+    {
+	total_peak = total;
+	memcpy(at_peak, live, sizeof(live));
+    }
+    pthread_mutex_unlock(&mem_lock);
+    if ((mem_limit > 0) && (total > mem_limit))
+    {
+	char total_s[32], limit_s[32], kind_s[32];
+	format_bytes(total, total_s, sizeof(total_s));
+	format_bytes(mem_limit, limit_s, sizeof(limit_s));
+	format_bytes(of_kind, kind_s, sizeof(kind_s));
+	errAbort("stopping: holding %s of data (%s of it %s) is over the -mem-limit of %s", total_s, kind_s,
+		 kind_names[kind], limit_s);
+    }
+}
+
+void memTrackSub(enum mem_kind kind, size_t bytes)
+/* count bytes as given back */
+{
+    pthread_mutex_lock(&mem_lock);
+    live[kind] = (live[kind] > bytes) ? live[kind] - bytes : 0;
+    total_live = (total_live > bytes) ? total_live - bytes : 0;
+    pthread_mutex_unlock(&mem_lock);
+}
+
+void memTrackNeed(size_t bytes, char *what)
+/* before making something of about bytes, stop now if it won't fit under */
+/* -mem-limit, rather than part way through */
+{
+    size_t held;
+    char need_s[32], limit_s[32], held_s[32];
+    if (mem_limit == 0)
+	return;
+    pthread_mutex_lock(&mem_lock);
+    held = total_live;
+    pthread_mutex_unlock(&mem_lock);
+    if (held + bytes <= mem_limit)
+	return;
+    format_bytes(bytes, need_s, sizeof(need_s));
+    format_bytes(mem_limit, limit_s, sizeof(limit_s));
+    format_bytes(held, held_s, sizeof(held_s));
+    errAbort("%s would take about %s, which with the %s already held is over the -mem-limit of %s", what,
+	     need_s, held_s, limit_s);
+}
+
+void memTrackClear()
+/* forget what's held.  for after a command ends with errAbort, when what it had */
+/* is never given back */
+{
+    int i;
+    pthread_mutex_lock(&mem_lock);
+    for (i = 0; i < MEM_KINDS; i++)
+	live[i] = 0;
+    total_live = 0;
+    pthread_mutex_unlock(&mem_lock);
+}
+
+size_t memTrackLimit()
+/* the -mem-limit in bytes, 0 if there isn't one */
+{
+    return mem_limit;
+}
+
+size_t memTrackAvailable()
+/* bytes that can still be taken before the limit, or (size_t)-1 without one */
+{
+    size_t avail;
+    if (mem_limit == 0)
+	return (size_t)-1;
+    pthread_mutex_lock(&mem_lock);
+    avail = (mem_limit > total_live) ? mem_limit - total_live : 0;
+    pthread_mutex_unlock(&mem_lock);
+    return avail;
+}
+
+void memTrackReport(char *command)
+/* print live and peak usage of each kind, and what was held at the overall peak, */
+/* to stderr */
+{
+    char live_s[32], peak_s[32], at_s[32];
+    int i;
+    pthread_mutex_lock(&mem_lock);
+    format_bytes(total_peak, peak_s, sizeof(peak_s));
+    fprintf(stderr, "memory of bwtool %s: peak %s", command, peak_s);
+    if (mem_limit > 0)
+    {
+	format_bytes(mem_limit, live_s, sizeof(live_s));
+	fprintf(stderr, " (limit %s)", live_s);
+    }
+    fprintf(stderr, "\n   %-14s %12s %12s %12s\n", "", "at peak", "own peak", "at end");
+    for (i = 0; i < MEM_KINDS; i++)
+    {
+	if (peak[i] == 0)
+	    continue;
+	format_bytes(at_peak[i], at_s, sizeof(at_s));
+	format_bytes(peak[i], peak_s, sizeof(peak_s));
+	format_bytes(live[i], live_s, sizeof(live_s));
+	fprintf(stderr, "   %-14s %12s %12s %12s\n", kind_names[i], at_s, peak_s, live_s);
+    }
+    pthread_mutex_unlock(&mem_lock);
+}
+
+size_t perBaseWigListSize(struct perBaseWig *list)
+/* bytes held by a list of perBaseWigs and their data */
+{
+    size_t size = 0;
+    struct perBaseWig *pbw;
+    for (pbw = list; pbw != NULL; pbw = pbw->next)
+	size += sizeof(struct perBaseWig) + (size_t)pbw->len * sizeof(double);
+    return size;
+}
+
+size_t matrixSize(int nrow, int ncol)
+/* bytes a perBaseMatrix of nrow rows and ncol columns holds */
+{
+    return (size_t)nrow * (sizeof(struct perBaseWig) + 2 * sizeof(void *) + (size_t)ncol * sizeof(double));
+}
+
+size_t perBaseMatrixSize(struct perBaseMatrix *pbm)
+/* bytes held by a matrix's rows */
+{
+    return (pbm) ? matrixSize(pbm->nrow, pbm->ncol) : 0;
+}
+
+size_t bed6ListSize(struct bed6 *list)
+/* bytes held by a list of bed6s */
+{
+    size_t size = 0;
+    struct bed6 *bed;
+    for (bed = list; bed != NULL; bed = bed->next)
+	size += sizeof(struct bed6) + strlen(bed->chrom) + 1 + ((bed->name) ? strlen(bed->name) + 1 : 0);
+    return size;
+}
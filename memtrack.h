@@ -0,0 +1,61 @@
+#ifndef MEMTRACK_H
+#define MEMTRACK_H
+
+#include <jkweb/common.h>
+#include <jkweb/hash.h>
+#include <beato/bigs.h>
+
+enum mem_kind
+/* the big things bwtool holds in memory */
+{
+    mem_pbw,            /* perBaseWigs loaded on their own. */
+    mem_pbm,            /* perBaseMatrix rows. */
+    mem_agg,            /* aggregate's results. */
+    mem_cluster,        /* k-means working copies and centroids. */
+    mem_beds,           /* Region lists. */
+    mem_chunks,         /* paste's chunk buffers. */
+    MEM_KINDS,
+};
+
+boolean memTrackSetup(struct hash *options);
+/* set the limit from -mem-limit=size (megabytes, or with a K, M, or G suffix).  */
+/* returns TRUE if -mem-report is given, so whoever called this does the report */
+
+void memTrackAdd(enum mem_kind kind, size_t bytes);
+/* count bytes as held.  if that goes over -mem-limit, stop with a message saying */
+/* what was being loaded */
+
+void memTrackSub(enum mem_kind kind, size_t bytes);
+/* count bytes as given back */
+
+void memTrackNeed(size_t bytes, char *what);
+/* before making something of about bytes, stop now if it won't fit under */
+/* -mem-limit, rather than part way through */
+
+void memTrackClear();
+/* forget what's held.  for after a command ends with errAbort, when what it had */
+/* is never given back */
+
+size_t memTrackLimit();
+/* the -mem-limit in bytes, 0 if there isn't one */
+
+size_t memTrackAvailable();
+/* bytes that can still be taken before the limit, or (size_t)-1 without one */
+
+void memTrackReport(char *command);
+/* print live and peak usage of each kind, and what was held at the overall peak, */
+/* to stderr */
+
+size_t perBaseWigListSize(struct perBaseWig *list);
+/* bytes held by a list of perBaseWigs and their data */
+
+size_t matrixSize(int nrow, int ncol);
+/* bytes a perBaseMatrix of nrow rows and ncol columns holds */
+
+size_t perBaseMatrixSize(struct perBaseMatrix *pbm);
+/* bytes held by a matrix's rows */
+
+size_t bed6ListSize(struct bed6 *list);
+/* bytes held by a list of bed6s */
+
+#endif /* MEMTRACK_H */
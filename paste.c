@@ -12,10 +12,23 @@
 #include <jkweb/sqlNum.h>
 #include <jkweb/basicBed.h>
 #include <jkweb/bigWig.h>
+#include <jkweb/errCatch.h>
 #include <beato/bigs.h>
 #include "bwtool.h"
 #include <beato/cluster.h>
 #include "bwtool_shared.h"
+#include "profile.h"
+#include "memtrack.h"
+
+#include <jkweb/dystring.h>
+#include <jkweb/zlibFace.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* how many bases of every file are held at once by default */
+#define PASTE_CHUNK_SIZE 1048576
+
+#define NANUM sqrt(-1)
 
 void usage_paste()
 /* Explain usage of paste program and exit. */
@@ -37,72 +50,330 @@ errAbort(
   "                     precision corresponds to a threshold.  E.g. if two decimal\n"
   "                     places is the output (the default), then instead of using\n"
   "                     -min=0, use -min=0.01\n"
+  "   -binary=out.bcol  write the output in a binary column format instead of text.\n"
+  "                     Each stretch of output bases is a block holding every\n"
+  "                     bigWig's values as 32-bit floats one bigWig after the\n"
+  "                     other, and an index of the blocks' chrom, start, and end\n"
+  "                     at the end of the file allows reading any region.  The\n"
+  "                     header keeps the labels and the constants.\n"
+  "   -binary-compress  zlib-compress each block of the -binary output\n"
+  "   -chunk-size=n     read the regions from the bigWigs n bases at a time (default\n"
+  "                     1048576).  Memory used is about 16 x n x the number of\n"
+  "                     bigWigs, since the next chunk is read while the current one\n"
+  "                     is written out.  With -mem-limit it's made smaller if need\n"
+  "                     be.\n"
   );
 }
 
-void print_line(struct perBaseWig *pbw_list, struct slDouble *c_list, int decimals, enum wigOutType wot, int i, FILE *out)
+struct paste_chunk
+/* every file's data over one stretch of a section.  the data is column-major: */
+/* file f's values are data[f*alloc] to data[f*alloc+len-1] */
+{
+    struct bed *section;
+    int start;
+    int end;
+    int num_files;
+    int alloc;                  /* Bases allocated per file (the chunk size). */
+    double *data;
+    unsigned char *keep;        /* Row mask: whether each base gets output. */
+};
+
+static size_t chunk_bytes(int num_files, int chunk_size)
+/* what one chunk's buffers take */
+{
+    return (size_t)chunk_size * ((size_t)num_files * sizeof(double) + 1);
+}
+
+static void alloc_chunk(struct paste_chunk *chunk, int num_files, int chunk_size)
+/* make the buffers once so they're reused for every chunk */
+{
+    ZeroVar(chunk);
+    chunk->num_files = num_files;
+    chunk->alloc = chunk_size;
+    chunk->data = needLargeMem((size_t)num_files * chunk_size * sizeof(double));
+    chunk->keep = needLargeMem((size_t)chunk_size);
+    memTrackAdd(mem_chunks, chunk_bytes(num_files, chunk_size));
+}
+
+static void free_chunk(struct paste_chunk *chunk)
+/* free the buffers */
+{
+    freez(&chunk->data);
+    freez(&chunk->keep);
+    memTrackSub(mem_chunks, chunk_bytes(chunk->num_files, chunk->alloc));
+}
+
+static int fit_chunk_size(int chunk_size, int num_files, boolean binary)
+/* with -mem-limit, make the chunks smaller if two of them (the one being written and */
+/* the one being read), a bigWig's worth of loading, and the binary output buffers */
+/* don't fit at the size asked for */
+{
+    size_t per_base = 2 * chunk_bytes(num_files, 1) + sizeof(double);
+    size_t avail = memTrackAvailable();
+    if (binary)
+	per_base += 2 * (size_t)num_files * sizeof(float);
+    if ((size_t)chunk_size * per_base <= avail)
+	return chunk_size;
+    memTrackNeed(per_base, "pasting even one base at a time");
+    chunk_size = (int)(avail / per_base);
+    verbose(2, "pasting %d bases at a time to stay under -mem-limit\n", chunk_size);
+    return chunk_size;
+}
+
+void print_line(struct paste_chunk *chunk, struct slDouble *c_list, int decimals, enum wigOutType wot, int i, FILE *out)
 {
-    struct perBaseWig *pbw;
     struct slDouble *c;
+    double *val = chunk->data + i;
+    int f;
     if (wot == bedGraphOut)
-	fprintf(out, "%s\t%d\t%d\t", pbw_list->chrom, pbw_list->chromStart+i, pbw_list->chromStart+i+1);
+	fprintf(out, "%s\t%d\t%d\t", chunk->section->chrom, chunk->start+i, chunk->start+i+1);
     else if (wot == varStepOut)
-	fprintf(out, "%d\t", pbw_list->chromStart+i+1);
-    for (pbw = pbw_list; pbw != NULL; pbw = pbw->next)
+	fprintf(out, "%d\t", chunk->start+i+1);
+    for (f = 0; f < chunk->num_files; f++, val += chunk->alloc)
     {
-	if (isnan(pbw->data[i]))
+	if (isnan(*val))
 	    fprintf(out, "NA");
 	else
-	    fprintf(out, "%0.*f", decimals, pbw->data[i]);
-	fprintf(out, "%c", (c_list == NULL) && (pbw->next == NULL) ? '\n' : '\t');
+	    fprintf(out, "%0.*f", decimals, *val);
+	fprintf(out, "%c", (c_list == NULL) && (f == chunk->num_files - 1) ? '\n' : '\t');
     }
     for (c = c_list; c != NULL; c = c->next)
 	fprintf(out, "%0.*f%c", decimals, c->val, (c->next == NULL) ? '\n' : '\t');
 }
 
-boolean has_na(struct perBaseWig *pbw_list, int i)
+static void mask_na(struct paste_chunk *chunk)
+/* drop rows where any file is NA.  one straight pass per column with no */
+/* branches so the compiler can vectorize it */
+{
+    int len = chunk->end - chunk->start;
+    unsigned char *keep = chunk->keep;
+    int f, i;
+    for (f = 0; f < chunk->num_files; f++)
+    {
+	const double *col = chunk->data + (size_t)f * chunk->alloc;
+	for (i = 0; i < len; i++)
+	    keep[i] &= (col[i] == col[i]);
+    }
+}
+
+static void mask_under(struct paste_chunk *chunk, double m)
+/* drop rows where any file is < m.  NA isn't under anything */
+{
+    int len = chunk->end - chunk->start;
+    unsigned char *keep = chunk->keep;
+    int f, i;
+    for (f = 0; f < chunk->num_files; f++)
+    {
+	const double *col = chunk->data + (size_t)f * chunk->alloc;
+	for (i = 0; i < len; i++)
+	    keep[i] &= !(col[i] < m);
+    }
+}
+
+/* bwtool binary column magic bytes:
+     BwtBcol\0
+     42 77 74 42 63 6f 6c 00
+*/
+const uint64_t BCOL_MAGIC = 0x006c6f6342747742;
+
+/* bwtool binary column file format version number. */
+const uint64_t BCOL_VERSION = 1;
+
+struct bcol_header
+/* start of the -binary file.  after it come the labels (zero-terminated), then the */
+/* constants as doubles, then the blocks.  the block index and the chrom names it */
+/* refers to are at index_offset.  everything is in native byte order. */
+{
+    /* Magic bytes: BCOL_MAGIC */
+    uint64_t magic;
+    /* File format version: BCOL_VERSION */
+    uint64_t version;
+    uint64_t num_files;
+    uint64_t num_consts;
+    uint64_t labels_size;
+    /* 1 if blocks are zlib compressed */
+    uint64_t compressed;
+    uint64_t num_blocks;
+    uint64_t index_offset;
+    uint64_t names_size;
+};
+
+struct bcol_index
+/* where one block is.  a block has (end-start) floats for each file in turn */
+{
+    bits32 name_offset;         /* Chrom, in the names following the index. */
+    bits32 start;
+    bits32 end;
+    bits32 reserved;
+    uint64_t offset;            /* Where the block is in the file. */
+    uint64_t size;              /* Bytes it takes up, after compressing. */
+};
+
+struct bcol_writer
+/* state for writing -binary output */
+{
+    FILE *f;
+    struct bcol_header header;
+    struct bcol_index *index;
+    int alloc_index;
+    struct hash *names;
+    struct dyString *name_chars;
+    float *buf;
+    char *comp_buf;
+    size_t comp_buf_size;
+};
+
+struct bcol_writer *bcol_writer_open(char *file, struct slName *labels, struct metaBig *mb_list,
+				     struct slDouble *c_list, boolean compress, int chunk_size)
+/* open the file and write out the header, labels, and constants.  the header is */
+/* written again with the block count once everything is done */
+{
+    struct bcol_writer *bw;
+    struct dyString *label_chars = dyStringNew(0);
+    struct slDouble *c;
+    AllocVar(bw);
+    bw->f = mustOpen_tracked(file, "wb");
+    bw->names = hashNew(8);
+    bw->name_chars = dyStringNew(0);
+    if (labels)
+    {
+	struct slName *label;
+	for (label = labels; label != NULL; label = label->next)
+	    dyStringAppendN(label_chars, label->name, strlen(label->name) + 1);
+    }
+    else
+    {
+	struct metaBig *mb;
+	for (mb = mb_list; mb != NULL; mb = mb->next)
+	    dyStringAppendN(label_chars, mb->fileName, strlen(mb->fileName) + 1);
+    }
+    bw->header.magic = BCOL_MAGIC;
+    bw->header.version = BCOL_VERSION;
+    bw->header.num_files = slCount(mb_list);
+    bw->header.num_consts = slCount(c_list);
+    bw->header.labels_size = label_chars->stringSize;
+    bw->header.compressed = (compress) ? 1 : 0;
+    bw->buf = needLargeMem(bw->header.num_files * chunk_size * sizeof(float));
+    if (compress)
+    {
+	bw->comp_buf_size = zCompBufSize(bw->header.num_files * chunk_size * sizeof(float));
+	bw->comp_buf = needLargeMem(bw->comp_buf_size);
+    }
+    mustWrite(bw->f, &bw->header, sizeof(bw->header));
+    mustWrite(bw->f, label_chars->string, label_chars->stringSize);
+    for (c = c_list; c != NULL; c = c->next)
+	mustWrite(bw->f, &c->val, sizeof(double));
+    dyStringFree(&label_chars);
+    return bw;
+}
+
+static void bcol_write_block(struct bcol_writer *bw, struct paste_chunk *chunk, int s, int e)
+/* write rows s to e (exclusive) of the chunk as one block */
 {
-    struct perBaseWig *pbw;
-    for (pbw = pbw_list; pbw != NULL; pbw = pbw->next)
-	if (isnan(pbw->data[i]))
-	    return TRUE;
-    return FALSE;
+    struct hashEl *hel = hashLookup(bw->names, chunk->section->chrom);
+    struct bcol_index *ix;
+    int len = e - s;
+    size_t size = (size_t)len * chunk->num_files * sizeof(float);
+    float *to = bw->buf;
+    int f, i;
+    if (!hel)
+    {
+	hel = hashAddInt(bw->names, chunk->section->chrom, bw->name_chars->stringSize);
+	dyStringAppendN(bw->name_chars, chunk->section->chrom, strlen(chunk->section->chrom) + 1);
+    }
+    if (bw->header.num_blocks == bw->alloc_index)
+    {
+	int new_alloc = (bw->alloc_index == 0) ? 1024 : bw->alloc_index * 2;
+	ExpandArray(bw->index, bw->alloc_index, new_alloc);
+	bw->alloc_index = new_alloc;
+    }
+    ix = &bw->index[bw->header.num_blocks++];
+    ix->name_offset = (bits32)ptToInt(hel->val);
+    ix->start = chunk->start + s;
+    ix->end = chunk->start + e;
+    ix->offset = ftell(bw->f);
+    for (f = 0; f < chunk->num_files; f++)
+    {
+	const double *col = chunk->data + (size_t)f * chunk->alloc + s;
+	for (i = 0; i < len; i++)
+	    *to++ = (float)col[i];
+    }
+    if (bw->header.compressed)
+    {
+	size = zCompress(bw->buf, size, bw->comp_buf, bw->comp_buf_size);
+	mustWrite(bw->f, bw->comp_buf, size);
+    }
+    else
+	mustWrite(bw->f, bw->buf, size);
+    ix->size = size;
 }
 
-boolean has_under(struct perBaseWig *pbw_list, int i, double m)
+void bcol_writer_close(struct bcol_writer **pBw)
+/* write the index and names, fill in the header, and close the file */
 {
-    struct perBaseWig *pbw;
-    for (pbw = pbw_list; pbw != NULL; pbw = pbw->next)
-	if (pbw->data[i] < m)
-	    return TRUE;
-    return FALSE;
+    struct bcol_writer *bw = *pBw;
+    if (!bw)
+	return;
+    bw->header.index_offset = ftell(bw->f);
+    bw->header.names_size = bw->name_chars->stringSize;
+    mustWrite(bw->f, bw->index, bw->header.num_blocks * sizeof(struct bcol_index));
+    mustWrite(bw->f, bw->name_chars->string, bw->name_chars->stringSize);
+    if (fseek(bw->f, 0, SEEK_SET) != 0)
+	errnoAbort("couldn't go back to write the -binary header");
+    mustWrite(bw->f, &bw->header, sizeof(bw->header));
+    carefulClose_tracked(&bw->f);
+    freeMem(bw->index);
+    freeMem(bw->buf);
+    freeMem(bw->comp_buf);
+    dyStringFree(&bw->name_chars);
+    hashFree(&bw->names);
+    freez(pBw);
 }
 
-void output_pbws(struct perBaseWig *pbw_list, struct slDouble *c_list, int decimals, enum wigOutType wot, boolean skip_NA, boolean skip_min, double min, FILE *out)
-/* outputs one set of perBaseWigs all at the same section */
+void output_chunk(struct paste_chunk *chunk, struct slDouble *c_list, int decimals, enum wigOutType wot, boolean skip_NA, boolean skip_min, double min, int *last_printed, struct bcol_writer *bw, FILE *out)
+/* outputs one chunk of a section.  the rows to output are worked out first for the */
+/* whole chunk, then written out.  last_printed is the last chrom position output so */
+/* the wig headers come out right across chunks.  with bw, each run of rows */
+/* output is a block in the binary file instead */
 {
-    struct perBaseWig *pbw;
-    if (pbw_list)
+    int len = chunk->end - chunk->start;
+    int i;
+    unsigned long long prof_start = PROFILE_START();
+    memset(chunk->keep, 1, len);
+    if (skip_NA)
+	mask_na(chunk);
+    if (skip_min)
+	mask_under(chunk, min);
+    if (bw)
     {
-	boolean last_skipped = TRUE;
-	int i = 0;
-	int last_printed = -2;
-	for (i = 0; i < pbw_list->len; i++)
+	for (i = 0; i < len; i++)
 	{
-	    if ((!skip_NA || !has_na(pbw_list, i)) && (!skip_min || !has_under(pbw_list, i, min)))
-	    {
-		if (i - last_printed > 1)
-		{
-		    if (wot == varStepOut)
-			fprintf(out, "variableStep chrom=%s span=1\n", pbw_list->chrom);
-		    else if (wot == fixStepOut)
-			fprintf(out, "fixedStep chrom=%s start=%d step=1 span=1\n", pbw_list->chrom, pbw_list->chromStart+i+1);
-		}
-		print_line(pbw_list, c_list, decimals, wot, i, out);
-		last_printed = i;
-	    }
+	    int run_start = i;
+	    if (!chunk->keep[i])
+		continue;
+	    while ((i < len) && chunk->keep[i])
+		i++;
+	    bcol_write_block(bw, chunk, run_start, i);
+	}
+	PROFILE_STOP(prof_write, prof_start);
+	return;
+    }
+    for (i = 0; i < len; i++)
+    {
+	int pos = chunk->start + i;
+	if (!chunk->keep[i])
+	    continue;
+	if (pos - *last_printed > 1)
+	{
+	    if (wot == varStepOut)
+		fprintf(out, "variableStep chrom=%s span=1\n", chunk->section->chrom);
+	    else if (wot == fixStepOut)
+		fprintf(out, "fixedStep chrom=%s start=%d step=1 span=1\n", chunk->section->chrom, pos+1);
 	}
+	print_line(chunk, c_list, decimals, wot, i, out);
+	*last_printed = pos;
     }
+    PROFILE_STOP(prof_format, prof_start);
 }
 
 struct slDouble *parse_constants(char *consts)
@@ -123,14 +394,78 @@ struct slDouble *parse_constants(char *consts)
     return c_list;
 }
 
+struct paste_loader
+/* what the loading thread needs */
+{
+    struct metaBig *mb_list;
+    double fill;
+    struct paste_chunk *chunk;
+    char *error;                /* Why loading failed, NULL if it didn't. */
+};
+
+static void load_chunk(struct metaBig *mb_list, double fill, struct paste_chunk *chunk)
+/* read the chunk from every file into its column */
+{
+    struct metaBig *mb;
+    int len = chunk->end - chunk->start;
+    double *col = chunk->data;
+    int i;
+    for (mb = mb_list; mb != NULL; mb = mb->next, col += chunk->alloc)
+    {
+	unsigned long long prof_start = PROFILE_START();
+	struct perBaseWig *pbw = perBaseWigLoadSingleContinue(mb, chunk->section->chrom, chunk->start, chunk->end, FALSE, fill);
+	PROFILE_STOP(prof_load, prof_start);
+	PROFILE_COUNT(prof_sections, 1);
+	/* if the load returns null then NA the whole thing. */
+	if (pbw)
+	    memcpy(col, pbw->data, len * sizeof(double));
+	else
+	    for (i = 0; i < len; i++)
+		col[i] = NANUM;
+	perBaseWigFree(&pbw);
+    }
+}
+
+static void *load_chunk_thread(void *data)
+/* pthread wrapper for load_chunk().  an errAbort here isn't caught by the main */
+/* thread's errCatch, so it's kept for the main thread to raise after the join */
+{
+    struct paste_loader *loader = (struct paste_loader *)data;
+    struct errCatch *errCatch = errCatchNew();
+    if (errCatchStart(errCatch))
+	load_chunk(loader->mb_list, loader->fill, loader->chunk);
+    errCatchEnd(errCatch);
+    if (errCatch->gotError)
+	loader->error = cloneString(trimSpaces(errCatch->message->string));
+    errCatchFree(&errCatch);
+    return NULL;
+}
+
+static boolean next_chunk(struct paste_chunk *prev, struct paste_chunk *next, int chunk_size)
+/* work out where the chunk after prev is, moving on to the next section if needed. */
+/* return FALSE when there's nothing left. */
+{
+    struct bed *section = prev->section;
+    int start = prev->end;
+    if (start >= section->chromEnd)
+    {
+	section = section->next;
+	if (!section)
+	    return FALSE;
+	start = section->chromStart;
+    }
+    next->section = section;
+    next->start = start;
+    next->end = (start + chunk_size < section->chromEnd) ? start + chunk_size : section->chromEnd;
+    return TRUE;
+}
+
 void bwtool_paste(struct hash *options, char *favorites, char *regions, unsigned decimals, double fill,
 		  enum wigOutType wot, struct slName **p_files, char *tmp_dir, char *output_file)
 /* bwtool_paste - main for paste program */
 {
     struct metaBig *mb;
     struct metaBig *mb_list = NULL;
-    struct bed *bed;
-    struct slName *file;
     int num_sections = 0;
     int i = 0;
     boolean skip_na = (hashFindVal(options, "skip-NA") != NULL) ? TRUE : FALSE;
@@ -143,6 +478,12 @@ void bwtool_paste(struct hash *options, char *favorites, char *regions, unsigned
     boolean do_covs_consts = (hashFindVal(options, "consts-covs") != NULL) ? TRUE : FALSE;
     boolean skip_min = FALSE;
     double min = 0;
+    int chunk_size = PASTE_CHUNK_SIZE;
+    char *chunk_size_s = (char *)hashFindVal(options, "chunk-size");
+    if (chunk_size_s)
+	chunk_size = (int)sqlUnsigned(chunk_size_s);
+    if (chunk_size < 1)
+	errAbort("-chunk-size should be at least 1");
     if (hashFindVal(options, "skip-min"))
     {
 	skip_min = TRUE;
@@ -154,44 +495,49 @@ void bwtool_paste(struct hash *options, char *favorites, char *regions, unsigned
     }
     struct slDouble *c_list = parse_constants((char *)hashOptionalVal(options, "consts", NULL));
     struct slDouble *fix_consts = NULL;
+    struct bbiSummaryElement *sums = NULL;
+    int sum_ix;
     struct slName *labels = NULL;
     struct slName *files = *p_files;
-    FILE *out = (output_file) ? mustOpen(output_file, "w") : stdout;
-    /* open the files one by one */
+    char *binary_file = (char *)hashFindVal(options, "binary");
+    boolean binary_compress = (hashFindVal(options, "binary-compress") != NULL) ? TRUE : FALSE;
+    struct bcol_writer *bw = NULL;
+    FILE *out = (output_file && !binary_file) ? mustOpen_tracked(output_file, "w") : stdout;
+    if (binary_compress && !binary_file)
+	errAbort("-binary-compress goes with -binary");
+    /* open the files all at once */
     if (slCount(files) == 1)
 	check_for_list_files(&files, &labels, 0);
-    for (file = files; file != NULL; file = file->next)
+    mb_list = metaBigOpenList(files, tmp_dir, regions, (do_mean_consts || do_total_consts || do_covs_consts) ? &sums : NULL);
+    for (mb = mb_list, sum_ix = 0; (sums) && (mb != NULL); mb = mb->next, sum_ix++)
     {
-	mb = metaBigOpenWithTmpDir(file->name, tmp_dir, regions);
-	if (do_mean_consts || do_total_consts || do_covs_consts)
+	if (do_mean_consts)
 	{
-	    struct bbiSummaryElement sum = bbiTotalSummary(mb->big.bbi);
-	    if (do_mean_consts)
-	    {
-		struct slDouble *d = slDoubleNew((double)sum.sumData/sum.validCount);
-		slAddHead(&fix_consts, d);
-	    }
-	    if (do_total_consts)
-	    {
-		struct slDouble *d = slDoubleNew((double)sum.sumData);
-		slAddHead(&fix_consts, d);
-	    }
-	    if (do_covs_consts)
-	    {
-		struct slDouble *d = slDoubleNew((double)sum.validCount);
-		slAddHead(&fix_consts, d);
-	    }
+	    struct slDouble *d = slDoubleNew((double)sums[sum_ix].sumData/sums[sum_ix].validCount);
+	    slAddHead(&fix_consts, d);
+	}
+	if (do_total_consts)
+	{
+	    struct slDouble *d = slDoubleNew((double)sums[sum_ix].sumData);
+	    slAddHead(&fix_consts, d);
+	}
+	if (do_covs_consts)
+	{
+	    struct slDouble *d = slDoubleNew((double)sums[sum_ix].validCount);
+	    slAddHead(&fix_consts, d);
 	}
-	slAddHead(&mb_list, mb);
     }
-    slReverse(&mb_list);
+    freez(&sums);
     if (fix_consts)
     {
 	slReverse(&fix_consts);
 	c_list = slCat(c_list, fix_consts);
     }
     num_sections = slCount(mb_list->sections);
-    if (header)
+    chunk_size = fit_chunk_size(chunk_size, slCount(mb_list), (binary_file != NULL));
+    if (binary_file)
+	bw = bcol_writer_open(binary_file, labels, mb_list, c_list, binary_compress, chunk_size);
+    else if (header)
     {
 	printf("#chrom\tchromStart\tchromEnd");
 	if (labels)
@@ -212,29 +558,75 @@ void bwtool_paste(struct hash *options, char *favorites, char *regions, unsigned
 	}
 	printf("\n");
     }
-    for (bed = mb_list->sections; bed != NULL; bed = bed->next)
+    /* each chunk is written out while the one after it is read in by another thread */
+    if (mb_list->sections)
     {
-	struct perBaseWig *pbw_list = NULL;
-	/* load each region */
-	if (verbose)
-	    fprintf(stderr, "section %d / %d: %s:%d-%d\n", i++, num_sections, bed->chrom, bed->chromStart, bed->chromEnd);
-	for (mb = mb_list; mb != NULL; mb = mb->next)
+	struct paste_chunk chunks[2];
+	struct paste_chunk *cur = &chunks[0], *next = &chunks[1];
+	struct paste_loader loader;
+	int last_printed = 0;
+	int num_files = slCount(mb_list);
+	boolean more;
+	alloc_chunk(cur, num_files, chunk_size);
+	alloc_chunk(next, num_files, chunk_size);
+	loader.mb_list = mb_list;
+	loader.fill = fill;
+	loader.error = NULL;
+	next->section = mb_list->sections;
+	next->start = next->end = next->section->chromStart;
+	more = next_chunk(next, cur, chunk_size);
+	if (more)
+	    load_chunk(mb_list, fill, cur);
+	while (more)
 	{
-	    struct perBaseWig *pbw = perBaseWigLoadSingleContinue(mb, bed->chrom, bed->chromStart, bed->chromEnd, FALSE, fill);
-	    /* if the load returns null then NA the whole thing. */
-	    /* this isn't very efficient but it's the easy way out. */
-	    if (!pbw)
-		pbw = alloc_perBaseWig(bed->chrom, bed->chromStart, bed->chromEnd);
-	    slAddHead(&pbw_list, pbw);
+	    pthread_t loading;
+	    struct errCatch *errCatch;
+	    struct paste_chunk *swap;
+	    more = next_chunk(cur, next, chunk_size);
+	    if (more)
+	    {
+		loader.chunk = next;
+		if (pthread_create(&loading, NULL, load_chunk_thread, &loader) != 0)
+		    errAbort("couldn't start a thread to read the bigWigs");
+	    }
+	    if (cur->start == cur->section->chromStart)
+	    {
+		if (verbose)
+		    fprintf(stderr, "section %d / %d: %s:%d-%d\n", i++, num_sections, cur->section->chrom,
+			    cur->section->chromStart, cur->section->chromEnd);
+		last_printed = cur->start - 2;
+	    }
+	    /* the loader has to be joined even if writing fails, or it'd still be reading */
+	    /* through mb_list (and into next) after the error has let go of them */
+	    errCatch = errCatchNew();
+	    if (errCatchStart(errCatch))
+		output_chunk(cur, c_list, decimals, wot, skip_na, skip_min, min, &last_printed, bw, out);
+	    errCatchEnd(errCatch);
+	    if (more)
+		pthread_join(loading, NULL);
+	    if (errCatch->gotError || loader.error)
+	    {
+		char msg[1024];
+		snprintf(msg, sizeof(msg), "%s", (errCatch->gotError) ? trimSpaces(errCatch->message->string) : loader.error);
+		freez(&loader.error);
+		errCatchFree(&errCatch);
+		free_chunk(cur);
+		free_chunk(next);
+		errAbort("%s", msg);
+	    }
+	    errCatchFree(&errCatch);
+	    swap = cur;
+	    cur = next;
+	    next = swap;
 	}
-	slReverse(&pbw_list);
-	output_pbws(pbw_list, c_list, decimals, wot, skip_na, skip_min, min, out);
-	perBaseWigFreeList(&pbw_list);
+	free_chunk(cur);
+	free_chunk(next);
     }
     /* close the files */
-    carefulClose(&out);
+    bcol_writer_close(&bw);
+    carefulClose_tracked(&out);
     while ((mb = slPopHead(&mb_list)) != NULL)
-	metaBigClose(&mb);
+	metaBigRelease(&mb);
     if (labels)
 	slNameFreeList(&labels);
     slNameFreeList(p_files);
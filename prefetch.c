@@ -0,0 +1,144 @@
+/* fetching the parts of remote bigWigs that regions need ahead of loading them */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <jkweb/common.h>
+#include <jkweb/hash.h>
+#include <jkweb/sqlNum.h>
+#include <jkweb/udc.h>
+#include <jkweb/bbiFile.h>
+#include <jkweb/bigWig.h>
+#include <beato/bigs.h>
+#include "bwtool_shared.h"
+#include "prefetch.h"
+
+/* blocks closer than this are fetched in the same request, gap and all */
+#define PREFETCH_GAP 65536
+
+/* but no request is bigger than this, so the work spreads over the connections */
+#define PREFETCH_MAX_RANGE 4194304
+
+struct prefetch_range
+/* one range request */
+{
+    bits64 offset;
+    bits64 size;
+};
+
+struct prefetch_job
+/* what the connections share */
+{
+    char *url;
+    char *cache_dir;
+    struct prefetch_range *ranges;
+    struct udcFile **udcs;      /* One per thread, opened on its first range. */
+};
+
+int get_prefetch_connections(struct hash *options)
+/* read -prefetch=n, the number of range requests to have going at once when */
+/* prefetching remote bigWigs.  0 turns prefetching off */
+{
+    char *s = (char *)hashFindVal(options, "prefetch");
+    return (s) ? (int)sqlUnsigned(s) : PREFETCH_CONNECTIONS;
+}
+
+static int prefetch_range_cmp(const void *va, const void *vb)
+/* by offset */
+{
+    const struct prefetch_range *a = (struct prefetch_range *)va;
+    const struct prefetch_range *b = (struct prefetch_range *)vb;
+    if (a->offset < b->offset)
+	return -1;
+    return (a->offset > b->offset);
+}
+
+static int coalesce_ranges(struct prefetch_range *ranges, int num)
+/* sort and merge the block ranges in place, returning how many are left */
+{
+    int i, out = 0;
+    if (num == 0)
+	return 0;
+    qsort(ranges, num, sizeof(ranges[0]), prefetch_range_cmp);
+    for (i = 1; i < num; i++)
+    {
+	struct prefetch_range *last = &ranges[out];
+	bits64 last_end = last->offset + last->size;
+	bits64 end = ranges[i].offset + ranges[i].size;
+	if ((ranges[i].offset <= last_end + PREFETCH_GAP) && (end - last->offset <= PREFETCH_MAX_RANGE))
+	{
+	    if (end > last_end)
+		last->size = end - last->offset;
+	}
+	else if (end > last_end)
+	    ranges[++out] = ranges[i];
+    }
+    return out + 1;
+}
+
+static void prefetch_job(void *data, int job_ix, int thread_ix)
+/* parallel_for() job: one range request, on this thread's own connection */
+{
+    struct prefetch_job *pj = (struct prefetch_job *)data;
+    if (pj->udcs[thread_ix] == NULL)
+	pj->udcs[thread_ix] = udcFileOpen(pj->url, pj->cache_dir);
+    udcPrefetch(pj->udcs[thread_ix], pj->ranges[job_ix].offset, pj->ranges[job_ix].size);
+}
+
+void prefetch_regions(struct metaBig *mb, struct bed6 *regions, int pad, char *tmp_dir, int connections)
+/* for a remote bigWig, get every data block the regions (widened by pad on both */
+/* sides) will need into the udc cache before they're loaded: the blocks are */
+/* looked up in the index, merged into ranges, and fetched with up to connections */
+/* requests at once.  does nothing for local files */
+{
+    struct bbiFile *bbi;
+    struct prefetch_range *ranges = NULL;
+    struct prefetch_job pj;
+    struct bed6 *bed;
+    bits64 total = 0;
+    int num = 0, alloc = 0;
+    int i;
+    if ((connections < 1) || (mb->type != isaBigWig) || (strstr(mb->big.bbi->fileName, "://") == NULL))
+	return;
+    bbi = mb->big.bbi;
+    bbiAttachUnzoomedCir(bbi);
+    for (bed = regions; bed != NULL; bed = bed->next)
+    {
+	struct fileOffsetSize *blockList, *block;
+	int start = bed->chromStart - pad;
+	bits32 chromId;
+	blockList = bbiOverlappingBlocks(bbi, bbi->unzoomedCir, bed->chrom, (start > 0) ? start : 0,
+					 bed->chromEnd + pad, &chromId);
+	for (block = blockList; block != NULL; block = block->next)
+	{
+	    if (num == alloc)
+	    {
+		int new_alloc = (alloc > 0) ? 2 * alloc : 1024;
+		ExpandArray(ranges, alloc, new_alloc);
+		alloc = new_alloc;
+	    }
+	    ranges[num].offset = block->offset;
+	    ranges[num].size = block->size;
+	    num++;
+	}
+	slFreeList(&blockList);
+    }
+    num = coalesce_ranges(ranges, num);
+    for (i = 0; i < num; i++)
+	total += ranges[i].size;
+    if (connections > num)
+	connections = (num > 0) ? num : 1;
+    verbose(2, "prefetching %llu bytes of %s in %d ranges over %d connections\n",
+	    (unsigned long long)total, bbi->fileName, num, connections);
+    pj.url = bbi->fileName;
+    pj.cache_dir = (tmp_dir) ? tmp_dir : udcDefaultDir();
+    pj.ranges = ranges;
+    AllocArray(pj.udcs, connections);
+    parallel_for(connections, num, prefetch_job, &pj);
+    for (i = 0; i < connections; i++)
+	if (pj.udcs[i])
+	    udcFileClose(&pj.udcs[i]);
+    freeMem(pj.udcs);
+    freeMem(ranges);
+}
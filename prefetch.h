@@ -0,0 +1,21 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <jkweb/common.h>
+#include <jkweb/hash.h>
+#include <beato/bigs.h>
+
+/* concurrent range requests if -prefetch isn't given */
+#define PREFETCH_CONNECTIONS 4
+
+int get_prefetch_connections(struct hash *options);
+/* read -prefetch=n, the number of range requests to have going at once when */
+/* prefetching remote bigWigs.  0 turns prefetching off */
+
+void prefetch_regions(struct metaBig *mb, struct bed6 *regions, int pad, char *tmp_dir, int connections);
+/* for a remote bigWig, get every data block the regions (widened by pad on both */
+/* sides) will need into the udc cache before they're loaded: the blocks are */
+/* looked up in the index, merged into ranges, and fetched with up to connections */
+/* requests at once.  does nothing for local files */
+
+#endif /* PREFETCH_H */
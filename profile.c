@@ -0,0 +1,137 @@
+/* -profile: where a run's time goes, and how much it read and wrote */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <jkweb/common.h>
+#include <jkweb/hash.h>
+#include "profile.h"
+
+#include <time.h>
+
+boolean profiling = FALSE;
+
+static boolean profile_json = FALSE;
+static unsigned long long profile_began;
+static long long io_read_began, io_written_began;
+
+/* added to from any thread, with atomic adds so the timers don't serialize them */
+static unsigned long long phase_ns[PROFILE_PHASES];
+static unsigned long long phase_calls[PROFILE_PHASES];
+static unsigned long long counters[PROFILE_COUNTERS];
+
+static char *phase_names[PROFILE_PHASES] = {
+    "open", "index", "read", "inflate", "expand", "load", "stats", "format", "write",
+};
+
+static char *counter_names[PROFILE_COUNTERS] = {
+    "sections", "regions", "blocks",
+};
+
+unsigned long long profileClock()
+/* nanoseconds on a clock that doesn't jump */
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void read_proc_io(long long *read, long long *written)
+/* everything this process has read() and write()n so far, -1 where /proc/self/io */
+/* isn't there */
+{
+    FILE *f = fopen("/proc/self/io", "r");
+    char line[256];
+    *read = *written = -1;
+    if (f == NULL)
+	return;
+    while (fgets(line, sizeof(line), f))
+    {
+	if (startsWith("rchar:", line))
+	    *read = atoll(line + 6);
+	else if (startsWith("wchar:", line))
+	    *written = atoll(line + 6);
+    }
+    fclose(f);
+}
+
+boolean profileSetup(struct hash *options)
+/* start profiling if -profile is given: -profile or -profile=text for a table */
+/* on stderr at the end, -profile=json for one line of JSON there instead. */
+/* returns TRUE if it started, so whoever did also does the report */
+{
+    char *how = (char *)hashFindVal(options, "profile");
+    int i;
+    if (how == NULL)
+	return FALSE;
+    if (sameString(how, "json"))
+	profile_json = TRUE;
+    else if (sameString(how, "text") || sameString(how, "on"))
+	profile_json = FALSE;
+    else
+	errAbort("-profile should be given alone or as -profile=text or -profile=json");
+    for (i = 0; i < PROFILE_PHASES; i++)
+	phase_ns[i] = phase_calls[i] = 0;
+    for (i = 0; i < PROFILE_COUNTERS; i++)
+	counters[i] = 0;
+    read_proc_io(&io_read_began, &io_written_began);
+    profile_began = profileClock();
+    profiling = TRUE;
+    return TRUE;
+}
+
+void profileAdd(enum profile_phase phase, unsigned long long start)
+/* add the time since start (from profileClock()) to a phase */
+{
+    __sync_fetch_and_add(&phase_ns[phase], profileClock() - start);
+    __sync_fetch_and_add(&phase_calls[phase], 1);
+}
+
+void profileCount(enum profile_counter counter, unsigned long long n)
+/* add to a counter */
+{
+    __sync_fetch_and_add(&counters[counter], n);
+}
+
+void profileReport(char *command)
+/* print what's been gathered since profileSetup() and stop */
+{
+    double wall = (profileClock() - profile_began) / 1e9;
+    long long io_read, io_written;
+    double accounted = 0;
+    int i;
+    if (!profiling)
+	return;
+    profiling = FALSE;
+    read_proc_io(&io_read, &io_written);
+    io_read = (io_read >= 0) ? io_read - io_read_began : -1;
+    io_written = (io_written >= 0) ? io_written - io_written_began : -1;
+    for (i = 0; i < PROFILE_PHASES; i++)
+	accounted += phase_ns[i] / 1e9;
+    if (profile_json)
+    {
+	fprintf(stderr, "{\"command\": \"%s\", \"wall_seconds\": %.6f", command, wall);
+	for (i = 0; i < PROFILE_PHASES; i++)
+	    fprintf(stderr, ", \"%s_seconds\": %.6f, \"%s_calls\": %llu", phase_names[i], phase_ns[i] / 1e9,
+		    phase_names[i], phase_calls[i]);
+	for (i = 0; i < PROFILE_COUNTERS; i++)
+	    fprintf(stderr, ", \"%s\": %llu", counter_names[i], counters[i]);
+	fprintf(stderr, ", \"bytes_read\": %lld, \"bytes_written\": %lld}\n", io_read, io_written);
+	return;
+    }
+    fprintf(stderr, "profile of bwtool %s: %.3f s\n", command, wall);
+    fprintf(stderr, "   %-10s %12s %7s %12s\n", "phase", "seconds", "%", "calls");
+    for (i = 0; i < PROFILE_PHASES; i++)
+	if (phase_calls[i] > 0)
+	    fprintf(stderr, "   %-10s %12.3f %6.1f%% %12llu\n", phase_names[i], phase_ns[i] / 1e9,
+		    (wall > 0) ? 100 * phase_ns[i] / 1e9 / wall : 0.0, phase_calls[i]);
+    fprintf(stderr, "   %-10s %12.3f %6.1f%%\n", "other", (wall > accounted) ? wall - accounted : 0.0,
+	    (wall > accounted) ? 100 * (wall - accounted) / wall : 0.0);
+    if (accounted > wall)
+	fprintf(stderr, "   (phases add up to more than the run because they're summed over threads)\n");
+    for (i = 0; i < PROFILE_COUNTERS; i++)
+	fprintf(stderr, "   %-10s %12llu\n", counter_names[i], counters[i]);
+    if (io_read >= 0)
+	fprintf(stderr, "   %-13s %9lld\n   %-13s %9lld\n", "bytes read", io_read, "bytes written", io_written);
+}
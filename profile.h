@@ -0,0 +1,56 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <jkweb/common.h>
+#include <jkweb/hash.h>
+
+enum profile_phase
+/* where the time goes.  phases don't nest, so they add up to (at most) the */
+/* time spent, summed over threads */
+{
+    prof_open,          /* Opening bigWigs and reading their headers. */
+    prof_index,         /* R-tree queries for the blocks a region needs. */
+    prof_read,          /* Reading compressed blocks. */
+    prof_inflate,       /* zlib. */
+    prof_expand,        /* Decoding blocks into per-base values. */
+    prof_load,          /* Loads that do all four above in one call (not through the block cache). */
+    prof_stats,         /* Summaries, distributions, clustering. */
+    prof_format,        /* Writing text output. */
+    prof_write,         /* Making bigWigs and other binary output. */
+    PROFILE_PHASES,
+};
+
+enum profile_counter
+/* what gets counted */
+{
+    prof_sections,      /* Pieces of bigWigs loaded whole, a section at a time. */
+    prof_regions,       /* Regions loaded through the block cache. */
+    prof_blocks,        /* Data blocks inflated. */
+    PROFILE_COUNTERS,
+};
+
+extern boolean profiling;
+
+boolean profileSetup(struct hash *options);
+/* start profiling if -profile is given: -profile or -profile=text for a table */
+/* on stderr at the end, -profile=json for one line of JSON there instead. */
+/* returns TRUE if it started, so whoever did also does the report */
+
+unsigned long long profileClock();
+/* nanoseconds on a clock that doesn't jump */
+
+void profileAdd(enum profile_phase phase, unsigned long long start);
+/* add the time since start (from profileClock()) to a phase */
+
+void profileCount(enum profile_counter counter, unsigned long long n);
+/* add to a counter */
+
+void profileReport(char *command);
+/* print what's been gathered since profileSetup() and stop */
+
+/* the timers cost a branch when profiling is off */
+#define PROFILE_START() ((profiling) ? profileClock() : 0)
+#define PROFILE_STOP(phase, start) do { if (profiling) profileAdd((phase), (start)); } while (0)
+#define PROFILE_COUNT(counter, n) do { if (profiling) profileCount((counter), (n)); } while (0)
+
+#endif /* PROFILE_H */
@@ -42,7 +42,7 @@ void bwtool_random(struct hash *options, char *favorites, char *regions, unsigne
 /* random - main ... random number generation takes place here.  */
 {
     struct metaBig *mb = metaBigOpen_check(bigfile, tmp_dir, regions);
-    FILE *out = mustOpen(output_file, "w");
+    FILE *out = mustOpen_tracked(output_file, "w");
     boolean just_bed = (hashFindVal(options, "bed") != NULL) ? TRUE : FALSE;
     unsigned seed = sqlUnsigned((char *)hashOptionalVal(options, "seed", "0"));
     unsigned N = sqlUnsigned(num_s);
@@ -68,7 +68,7 @@ void bwtool_random(struct hash *options, char *favorites, char *regions, unsigne
 		fprintf(out, "%0.*f%c", decimals, pbw->data[i], (i < pbw->chromEnd - pbw->chromStart - 1) ? '\t' : '\n');
 	}
     }
-    carefulClose(&out);
+    carefulClose_tracked(&out);
     bedFreeList(&blacklist);
 }
 
@@ -15,6 +15,7 @@
 #include <beato/bigs.h>
 #include "bwtool.h"
 #include "bwtool_shared.h"
+#include "profile.h"
 
 #define NANUM sqrt(-1)
 
@@ -65,14 +66,17 @@ static void bwtool_remove_thresh(struct metaBig *mb, enum bw_op_type op, char *v
 {
     char wigfile[512];
     safef(wigfile, sizeof(wigfile), "%s.tmp.wig", outputfile);
-    FILE *out = mustOpen(wigfile, "w");
+    FILE *out = mustOpen_tracked(wigfile, "w");
     double val = (double)((float)sqlDouble(val_s));
     struct bed *section;
     const double na = NANUM;
     for (section = mb->sections; section != NULL; section = section->next)
     {
+	unsigned long long prof_start = PROFILE_START();
 	struct perBaseWig *pbwList = perBaseWigLoadContinue(mb, section->chrom, section->chromStart, section->chromEnd);
 	struct perBaseWig *pbw;
+	PROFILE_STOP(prof_load, prof_start);
+	PROFILE_COUNT(prof_sections, 1);
 	for (pbw = pbwList; pbw != NULL; pbw = pbw->next)
 	{
 	    int size = pbw->len;
@@ -126,10 +130,12 @@ static void bwtool_remove_thresh(struct metaBig *mb, enum bw_op_type op, char *v
 		}
 	    }
 	}
+	prof_start = PROFILE_START();
 	perBaseWigOutputNASkip(pbwList, out, wot, decimals, NULL, FALSE, condense);
+	PROFILE_STOP(prof_format, prof_start);
 	perBaseWigFreeList(&pbwList);
     }
-    carefulClose(&out);
+    carefulClose_tracked(&out);
     if (wig_only)
 	rename(wigfile, outputfile);
     else
@@ -145,15 +151,18 @@ static void bwtool_remove_mask(struct metaBig *mb, char *mask_file, char *output
 {
     char wigfile[512];
     safef(wigfile, sizeof(wigfile), "%s.tmp.wig", outputfile);
-    FILE *out = mustOpen(wigfile, "w");
+    FILE *out = mustOpen_tracked(wigfile, "w");
     struct hash *rt_hash = load_range_tree(mask_file);
     struct bed *section;
     const double na = NANUM;
     for (section = mb->sections; section != NULL; section = section->next)
     {
+	unsigned long long prof_start = PROFILE_START();
 	struct perBaseWig *pbwList = perBaseWigLoadContinue(mb, section->chrom, section->chromStart, section->chromEnd);
 	struct perBaseWig *pbw;
 	struct rbTree *chrom_tree = (struct rbTree *)hashFindVal(rt_hash, section->chrom);
+	PROFILE_STOP(prof_load, prof_start);
+	PROFILE_COUNT(prof_sections, 1);
 	if (chrom_tree && pbwList)
 	{
 	    for (pbw = pbwList; pbw != NULL; pbw = pbw->next)
@@ -169,11 +178,13 @@ static void bwtool_remove_mask(struct metaBig *mb, char *mask_file, char *output
 			pbw->data[i] = na;
 		}
 	    }
+	    prof_start = PROFILE_START();
 	    perBaseWigOutputNASkip(pbwList, out, wot, decimals, NULL, FALSE, condense);
+	    PROFILE_STOP(prof_format, prof_start);
 	    perBaseWigFreeList(&pbwList);
 	}
     }
-    carefulClose(&out);
+    carefulClose_tracked(&out);
     if (wig_only)
 	rename(wigfile, outputfile);
     else
@@ -198,6 +209,6 @@ void bwtool_remove(struct hash *options, char *favorites, char *regions, unsigne
 	bwtool_remove_mask(mb, val_or_file, outputfile, wot, decimals, condense, wig_only, inverse);
     else
 	bwtool_remove_thresh(mb, op, val_or_file, outputfile, wot, decimals, condense, wig_only);
-    metaBigClose(&mb);
+    metaBigRelease(&mb);
 }
 
@@ -0,0 +1,138 @@
+/* squeezing and stretching rows to a fixed width, for meta regions and binning */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <jkweb/common.h>
+#include "resample.h"
+
+#include <math.h>
+
+#define NANUM sqrt(-1)
+
+void resample_plan_set(struct resample_plan *plan, int in_len, int out_len)
+/* work out the windows and weights for squeezing or stretching in_len values into */
+/* out_len.  the plan's arrays are reused and only grow, so one plan can be set over */
+/* and over for rows of different lengths */
+{
+    double step = (double)in_len / out_len;
+    size_t need;
+    int span = 1;
+    int j;
+    if ((in_len < 1) || (out_len < 1))
+	errAbort("can't resample %d values to %d", in_len, out_len);
+    /* the widest window: an output covering step bases can touch ceil(step)+1 of them */
+    for (j = 0; j < out_len; j++)
+    {
+	int first = (int)floor(j * step);
+	int last = (int)ceil((j + 1) * step);
+	if (last > in_len)
+	    last = in_len;
+	if (last - first > span)
+	    span = last - first;
+    }
+    need = (size_t)out_len * span;
+    if (out_len > plan->alloc_out)
+    {
+	freeMem(plan->first);
+	AllocArray(plan->first, out_len);
+	plan->alloc_out = out_len;
+    }
+    if (need > plan->alloc_weights)
+    {
+	freeMem(plan->weights);
+	AllocArray(plan->weights, need);
+	plan->alloc_weights = need;
+    }
+    plan->in_len = in_len;
+    plan->out_len = out_len;
+    plan->span = span;
+    for (j = 0; j < out_len; j++)
+    {
+	double start = j * step;
+	double end = (j + 1) * step;
+	int first = (int)floor(start);
+	double *w = plan->weights + (size_t)j * span;
+	int t;
+	/* windows near the end are slid back so none reads past the row; */
+	/* the inputs that brings in just get weight 0 */
+	if (first > in_len - span)
+	    first = in_len - span;
+	plan->first[j] = first;
+	for (t = 0; t < span; t++)
+	{
+	    double lo = first + t;
+	    double hi = lo + 1;
+	    if (lo < start)
+		lo = start;
+	    if (hi > end)
+		hi = end;
+	    w[t] = (hi > lo) ? hi - lo : 0;
+	}
+    }
+}
+
+void resample_plan_free(struct resample_plan *plan)
+/* free the arrays in a plan (not the plan itself) */
+{
+    freez(&plan->first);
+    freez(&plan->weights);
+    plan->alloc_out = 0;
+    plan->alloc_weights = 0;
+}
+
+void resample_row(const struct resample_plan *plan, const double *in, double *out)
+/* resample in to out by the plan.  each output is the average of the input it covers, */
+/* weighted by how much of each base it covers, leaving out NA.  NA if it covers only */
+/* NA.  doesn't change the plan, so threads can share one */
+{
+    const int span = plan->span;
+    int j;
+    for (j = 0; j < plan->out_len; j++)
+    {
+	const double *x = in + plan->first[j];
+	const double *w = plan->weights + (size_t)j * span;
+	double sum = 0, weight = 0;
+	int t;
+	/* selects rather than branches, so the compiler can vectorize the window */
+	for (t = 0; t < span; t++)
+	{
+	    int ok = !isnan(x[t]);
+	    sum += ok ? x[t] * w[t] : 0;
+	    weight += ok ? w[t] : 0;
+	}
+	out[j] = (weight > 0) ? sum / weight : NANUM;
+    }
+}
+
+void resample_nan_aware(const double *in, int in_len, double *out, int out_len)
+/* one-off resample of a single row, the same as resample_row() would give but with */
+/* the weights worked out as it goes instead of stored in a plan */
+{
+    double step = (double)in_len / out_len;
+    int j;
+    if ((in_len < 1) || (out_len < 1))
+	errAbort("can't resample %d values to %d", in_len, out_len);
+    for (j = 0; j < out_len; j++)
+    {
+	double start = j * step;
+	double end = (j + 1) * step;
+	int last = (int)ceil(end);
+	double sum = 0, weight = 0;
+	int t;
+	if (last > in_len)
+	    last = in_len;
+	for (t = (int)floor(start); t < last; t++)
+	{
+	    double lo = (t < start) ? start : t;
+	    double hi = (t + 1 > end) ? end : t + 1;
+	    if ((hi > lo) && !isnan(in[t]))
+	    {
+		sum += in[t] * (hi - lo);
+		weight += hi - lo;
+	    }
+	}
+	out[j] = (weight > 0) ? sum / weight : NANUM;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <jkweb/common.h>
+
+struct resample_plan
+/* where each output value of a resampling comes from.  worked out once per */
+/* (in_len, out_len) pair so the per-row work is a plain multiply-add over */
+/* fixed-width windows */
+{
+    int in_len;
+    int out_len;
+    int span;                   /* Inputs looked at per output, the same for all. */
+    int *first;                 /* First input of each output's window. */
+    double *weights;            /* out_len x span, how much of each input the output covers. */
+    int alloc_out;
+    size_t alloc_weights;
+};
+
+void resample_plan_set(struct resample_plan *plan, int in_len, int out_len);
+/* work out the windows and weights for squeezing or stretching in_len values into */
+/* out_len.  the plan's arrays are reused and only grow, so one plan can be set over */
+/* and over for rows of different lengths */
+
+void resample_plan_free(struct resample_plan *plan);
+/* free the arrays in a plan (not the plan itself) */
+
+void resample_row(const struct resample_plan *plan, const double *in, double *out);
+/* resample in to out by the plan.  each output is the average of the input it covers, */
+/* weighted by how much of each base it covers, leaving out NA.  NA if it covers only */
+/* NA.  doesn't change the plan, so threads can share one */
+
+void resample_nan_aware(const double *in, int in_len, double *out, int out_len);
+/* one-off resample of a single row, the same as resample_row() would give but with */
+/* the weights worked out as it goes instead of stored in a plan */
+
+#endif /* RESAMPLE_H */
@@ -15,6 +15,7 @@
 #include <beato/bigs.h>
 #include "bwtool.h"
 #include "bwtool_shared.h"
+#include "profile.h"
 #include <beato/cluster.h>
 
 void usage_roll()
@@ -60,7 +61,7 @@ void bwtool_roll(struct hash *options, char *favorites, char *regions, unsigned
 /* bwtool_roll - main for the rolling-mean program */
 /* this function is too long. it'd be nice to break it up some time. */
 {
-    struct metaBig *mb = metaBigOpenWithTmpDir(bigfile, tmp_dir, regions);
+    struct metaBig *mb = metaBigOpen_cached(bigfile, tmp_dir, regions);
     int step = (int)sqlUnsigned((char *)hashOptionalVal(options, "step", "1"));
     int max_na = (int)sqlSigned((char *)hashOptionalVal(options, "max-NA", "-1"));
     char *min_mean_s = (char *)hashOptionalVal(options, "min-mean", "unused");
@@ -74,7 +75,7 @@ void bwtool_roll(struct hash *options, char *favorites, char *regions, unsigned
 	max_na = size - 1;
     if (size < 1)
 	errAbort("size must be >= 1 for bwtool window");
-    FILE *out = (outputfile) ? mustOpen(outputfile, "w") : stdout;
+    FILE *out = (outputfile) ? mustOpen_tracked(outputfile, "w") : stdout;
     struct bed *section;
     boolean broken = TRUE;  /* for headers */
     enum roll_command com;
@@ -88,12 +89,15 @@ void bwtool_roll(struct hash *options, char *favorites, char *regions, unsigned
     {
 	if (size <= section->chromEnd - section->chromStart)
 	{
+	    unsigned long long prof_start = PROFILE_START();
 	    struct perBaseWig *pbw = perBaseWigLoadSingleContinue(mb, section->chrom, section->chromStart,
 								  section->chromEnd, FALSE, fill);
 	    int i, j;
 	    int len = section->chromEnd - section->chromStart;
 	    double total = 0;
 	    int num_na = 0;
+	    PROFILE_STOP(prof_load, prof_start);
+	    PROFILE_COUNT(prof_sections, 1);
 	    /* load data */
 	    for (i = 0; i < size; i++)
 		add_to_tots(pbw->data[i], &num_na, &total);
@@ -150,6 +154,6 @@ void bwtool_roll(struct hash *options, char *favorites, char *regions, unsigned
 	    perBaseWigFree(&pbw);
 	}
     }
-    metaBigClose(&mb);
-    carefulClose(&out);
+    metaBigRelease(&mb);
+    carefulClose_tracked(&out);
 }
@@ -14,6 +14,7 @@
 #include <beato/bigs.h>
 #include "bwtool.h"
 #include "bwtool_shared.h"
+#include "profile.h"
 #include <beato/sax.h>
 
 void usage_sax()
@@ -38,8 +39,11 @@ errAbort(
 void wigsax_fasta(FILE *out, struct metaBig *mb, struct bed *region, int alpha, int window, double mean, double std)
 /* when not using an iterative alphabet size, make an output similar to FASTA */
 {
+    unsigned long long prof_start = PROFILE_START();
     struct perBaseWig *wigList = perBaseWigLoadContinue(mb, region->chrom, region->chromStart, region->chromEnd);
     struct perBaseWig *pbw;
+    PROFILE_STOP(prof_load, prof_start);
+    PROFILE_COUNT(prof_sections, 1);
     for (pbw = wigList; pbw != NULL; pbw = pbw->next)
     {
 	int data_len = pbw->chromEnd-pbw->chromStart;
@@ -84,6 +88,7 @@ void wigsax_bed4(FILE *out, struct metaBig *mb, struct bed *region, int alpha, i
 {
     struct bed *outBedList = NULL;
     struct bed *bed;
+    unsigned long long prof_start = PROFILE_START();
     struct perBaseWig *wigList = perBaseWigLoadContinue(mb, region->chrom, region->chromStart, region->chromEnd);
     struct perBaseWig *pbw;
     struct slDouble *datList = NULL;
@@ -91,6 +96,8 @@ void wigsax_bed4(FILE *out, struct metaBig *mb, struct bed *region, int alpha, i
     /* Maybe sometime I'll put back the option to use multiple alphabets at a time. */
     int alphaS = alpha;
     int alphaE = alpha;
+    PROFILE_STOP(prof_load, prof_start);
+    PROFILE_COUNT(prof_sections, 1);
     for (pbw = wigList; pbw != NULL; pbw = pbw->next)
     {
 	struct bed *bedList = make_initial_bed_list(pbw, alphaE - alphaS + 2);
@@ -163,7 +170,7 @@ void bwtool_sax(struct hash *options, char *favorites, char *regions, unsigned d
 	else if (std <= 0)
 	    errAbort("-std must be > 0");
     }
-    out = mustOpen(outputfile, "w");
+    out = mustOpen_tracked(outputfile, "w");
     for (bed = mb->sections; bed != NULL; bed = bed->next)
     {
 	/* print a header */
@@ -180,6 +187,6 @@ void bwtool_sax(struct hash *options, char *favorites, char *regions, unsigned d
 	    wigsax_bed4(out, mb, bed, alpha, window, mean, std, wig_out);
 	}
     }
-    metaBigClose(&mb);
-    carefulClose(&out);
+    metaBigRelease(&mb);
+    carefulClose_tracked(&out);
 }
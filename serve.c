@@ -0,0 +1,302 @@
+/* bwtool_serve - run commands sent over a Unix socket, keeping bigWigs open between them */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <jkweb/common.h>
+#include <jkweb/hash.h>
+#include <jkweb/options.h>
+#include <jkweb/sqlNum.h>
+#include <jkweb/dystring.h>
+#include <beato/bigs.h>
+#include "bwtool.h"
+#include "bwtool_shared.h"
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* open bigWigs kept if -cache-size isn't given */
+#define SERVE_CACHE_SIZE 64
+
+/* the most a request (working directory and arguments) can be */
+#define SERVE_MAX_REQUEST 1048576
+
+void usage_serve()
+/* Explain usage and exit. */
+{
+errAbort(
+  "bwtool serve - listen on a Unix socket for bwtool commands and run them\n"
+  "   in this process, keeping the bigWigs they open cached between them\n"
+  "usage:\n"
+  "   bwtool serve socket\n"
+  "options:\n"
+  "   -cache-size=n    keep up to n bigWigs open (default 64)\n"
+  "\n"
+  "Commands are sent by giving any other bwtool command -server=socket, e.g.\n"
+  "   bwtool summary -server=/tmp/bwtool.sock regions.bed signal.bw stdout\n"
+  "The command runs in the client's working directory and writes to the client's\n"
+  "standard output and error, and the client exits with the command's status.\n"
+  "Commands are run one at a time.  Stop the server with a signal (e.g. Ctrl-C).\n"
+  "Only the user running the server can connect to the socket.\n"
+  );
+}
+
+/* a request on the socket is, from the client: */
+/*    one sendmsg() with a uint32 payload length, carrying the client's stdout */
+/*    and stderr as SCM_RIGHTS, then the payload: the working directory and */
+/*    each argument, each ended by '\0' */
+/* and back from the server: an int32 exit status */
+
+static char *serve_socket_path = NULL;
+
+static void serve_stop(int sig)
+/* remove the socket on the way out */
+{
+    if (serve_socket_path)
+	unlink(serve_socket_path);
+    _exit(0);
+}
+
+static int serve_socket(char *path, boolean listening)
+/* make a Unix socket bound to or connected to path */
+{
+    struct sockaddr_un addr;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0)
+	errnoAbort("couldn't make a socket");
+    if (strlen(path) >= sizeof(addr.sun_path))
+	errAbort("socket path %s is too long", path);
+    ZeroVar(&addr);
+    addr.sun_family = AF_UNIX;
+    safecpy(addr.sun_path, sizeof(addr.sun_path), path);
+    if (listening)
+    {
+	/* whoever can connect runs commands as us, so only we can, whatever the umask */
+	mode_t old_mask = umask(077);
+	int bound;
+	unlink(path);
+	bound = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+	umask(old_mask);
+	if ((bound < 0) || (chmod(path, S_IRUSR | S_IWUSR) < 0) || (listen(sock, 16) < 0))
+	    errnoAbort("couldn't listen on %s", path);
+    }
+    else if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	errnoAbort("couldn't connect to bwtool server at %s", path);
+    return sock;
+}
+
+static boolean read_all(int fd, void *buf, size_t size)
+/* read exactly size bytes, FALSE if the other side went away first */
+{
+    char *p = (char *)buf;
+    while (size > 0)
+    {
+	ssize_t got = read(fd, p, size);
+	if (got <= 0)
+	    return FALSE;
+	p += got;
+	size -= got;
+    }
+    return TRUE;
+}
+
+static boolean write_all(int fd, void *buf, size_t size)
+/* write exactly size bytes, FALSE if the other side went away */
+{
+    char *p = (char *)buf;
+    while (size > 0)
+    {
+	ssize_t put = write(fd, p, size);
+	if (put <= 0)
+	    return FALSE;
+	p += put;
+	size -= put;
+    }
+    return TRUE;
+}
+
+static boolean receive_request(int conn, int fds[2], char **pPayload, uint32_t *pLen)
+/* get the client's stdout/stderr and the payload */
+{
+    struct msghdr msg;
+    struct iovec iov;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr *cmsg;
+    uint32_t len;
+    ZeroVar(&msg);
+    iov.iov_base = &len;
+    iov.iov_len = sizeof(len);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(conn, &msg, 0) != sizeof(len))
+	return FALSE;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if ((cmsg == NULL) || (cmsg->cmsg_type != SCM_RIGHTS) || (cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))))
+	return FALSE;
+    memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+    if ((len == 0) || (len > SERVE_MAX_REQUEST))
+    {
+	close(fds[0]);
+	close(fds[1]);
+	return FALSE;
+    }
+    *pPayload = needMem(len + 1);
+    if (!read_all(conn, *pPayload, len))
+    {
+	freez(pPayload);
+	close(fds[0]);
+	close(fds[1]);
+	return FALSE;
+    }
+    *pLen = len;
+    return TRUE;
+}
+
+static int run_request(char *payload, uint32_t len)
+/* chdir to the client's directory and run the command, catching errAbort.  */
+/* stdout and stderr are already the client's */
+{
+    char **argv;
+    char *p;
+    int argc = 1;
+    int status = 0;
+    int i;
+    payload[len] = '\0';
+    for (p = payload; p < payload + len; p++)
+	if (*p == '\0')
+	    argc++;
+    /* argv[0] stands in for the program name, the working directory is dropped */
+    AllocArray(argv, argc + 1);
+    argv[0] = "bwtool";
+    for (p = payload + strlen(payload) + 1, i = 1; p < payload + len; p += strlen(p) + 1)
+	argv[i++] = p;
+    argc = i;
+    if (chdir(payload) < 0)
+    {
+	fprintf(stderr, "couldn't go to directory %s\n", payload);
+	status = 1;
+    }
+    else if ((argc > 1) && (sameString(argv[1], "serve") || sameString(argv[1], "batch")))
+    {
+	fprintf(stderr, "can't run %s from the server\n", argv[1]);
+	status = 1;
+    }
+    else
+	status = bwtool_run_catching(argc, argv);
+    freeMem(argv);
+    return status;
+}
+
+static void serve_one(int conn)
+/* handle a connection: one request */
+{
+    int fds[2];
+    char *payload = NULL;
+    uint32_t len;
+    int32_t status;
+    int saved_out, saved_err;
+    if (!receive_request(conn, fds, &payload, &len))
+	return;
+    fflush(stdout);
+    fflush(stderr);
+    saved_out = dup(STDOUT_FILENO);
+    saved_err = dup(STDERR_FILENO);
+    dup2(fds[0], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    status = run_request(payload, len);
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+    freeMem(payload);
+    write_all(conn, &status, sizeof(status));
+}
+
+void bwtool_serve(struct hash *options, char *socket_path)
+/* bwtool_serve - main for the server; only a signal stops it */
+{
+    char *cache_s = (char *)hashFindVal(options, "cache-size");
+    int cache_size = (cache_s) ? (int)sqlUnsigned(cache_s) : SERVE_CACHE_SIZE;
+    char cwd[PATH_LEN];
+    char full_path[PATH_LEN];
+    int sock;
+    if (cache_size < 1)
+	errAbort("-cache-size should be at least 1");
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+	errnoAbort("couldn't get the working directory");
+    /* the socket is made relative to where the server started, whatever the requests chdir to */
+    if (socket_path[0] == '/')
+	safecpy(full_path, sizeof(full_path), socket_path);
+    else
+	safef(full_path, sizeof(full_path), "%s/%s", cwd, socket_path);
+    serve_socket_path = cloneString(full_path);
+    sock = serve_socket(serve_socket_path, TRUE);
+    signal(SIGINT, serve_stop);
+    signal(SIGTERM, serve_stop);
+    /* a client going away mid-output shouldn't take the server with it */
+    signal(SIGPIPE, SIG_IGN);
+    metaBigCacheEnable(cache_size);
+    bedCacheEnable(TRUE);
+    verbose(1, "bwtool serving on %s\n", serve_socket_path);
+    for (;;)
+    {
+	int conn = accept(sock, NULL, NULL);
+	if (conn < 0)
+	    continue;
+	serve_one(conn);
+	close(conn);
+    }
+}
+
+int bwtool_client(char *socket_path, int argc, char *argv[])
+/* send the command in argv (without the -server option) to a server and return */
+/* its exit status */
+{
+    int sock = serve_socket(socket_path, FALSE);
+    struct dyString *payload = dyStringNew(0);
+    char cwd[PATH_LEN];
+    struct msghdr msg;
+    struct iovec iov;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr *cmsg;
+    int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+    uint32_t len;
+    int32_t status;
+    int i;
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+	errnoAbort("couldn't get the working directory");
+    dyStringAppendN(payload, cwd, strlen(cwd) + 1);
+    for (i = 1; i < argc; i++)
+	dyStringAppendN(payload, argv[i], strlen(argv[i]) + 1);
+    len = payload->stringSize;
+    ZeroVar(&msg);
+    iov.iov_base = &len;
+    iov.iov_len = sizeof(len);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    fflush(stdout);
+    if ((sendmsg(sock, &msg, 0) != sizeof(len)) || !write_all(sock, payload->string, len))
+	errnoAbort("couldn't send the command to %s", socket_path);
+    dyStringFree(&payload);
+    if (!read_all(sock, &status, sizeof(status)))
+	errAbort("the bwtool server at %s went away before finishing", socket_path);
+    close(sock);
+    return status;
+}
@@ -14,6 +14,7 @@
 #include <beato/bigs.h>
 #include "bwtool.h"
 #include "bwtool_shared.h"
+#include "profile.h"
 
 #include <math.h>
 
@@ -41,7 +42,7 @@ void bwtool_shift(struct hash *options, char *favorites, char *regions, unsigned
 	errAbort("problem opening %s", bigfile);
     char wigfile[512];
     safef(wigfile, sizeof(wigfile), "%s.tmp.wig", outputfile);
-    FILE *out = mustOpen(wigfile, "w");
+    FILE *out = mustOpen_tracked(wigfile, "w");
     struct bed *section;
     boolean up = TRUE;
     if (shft > 0)
@@ -50,11 +51,14 @@ void bwtool_shift(struct hash *options, char *favorites, char *regions, unsigned
 	errAbort("it doesn't make sense to shift by zero.");
     for (section = mb->sections; section != NULL; section = section->next)
     {
+	unsigned long long prof_start = PROFILE_START();
 	struct perBaseWig *pbw = perBaseWigLoadSingleContinue(mb, section->chrom, section->chromStart,
 							      section->chromEnd, FALSE, na);
 	int i;
 	/* if the shift size is bigger than the section, NA the entire thing */
 	int size = pbw->len;
+	PROFILE_STOP(prof_load, prof_start);
+	PROFILE_COUNT(prof_sections, 1);
 	if (abs_shft >= size)
 	    for (i = 0; i < size; i++)
 		pbw->data[i] = na;
@@ -75,11 +79,13 @@ void bwtool_shift(struct hash *options, char *favorites, char *regions, unsigned
 		    pbw->data[i] = na;
 	    }
 	}
+	prof_start = PROFILE_START();
 	perBaseWigOutputNASkip(pbw, out, wot, decimals, NULL, FALSE, condense);
+	PROFILE_STOP(prof_format, prof_start);
 	perBaseWigFree(&pbw);
     }
-    carefulClose(&out);
+    carefulClose_tracked(&out);
     writeBw(wigfile, outputfile, mb->chromSizeHash);
     remove(wigfile);
-    metaBigClose(&mb);
+    metaBigRelease(&mb);
 }
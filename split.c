@@ -13,6 +13,8 @@
 #include <jkweb/bigWig.h>
 #include <beato/bigs.h>
 #include "bwtool.h"
+#include "bwtool_shared.h"
+#include "profile.h"
 
 void usage_split()
 /* Explain usage of the splitting program and exit. */
@@ -40,8 +42,8 @@ struct bed *newBed(char *chrom, int start, int end)
 void bwtool_split(struct hash *options, char *regions, char *size_s, char *bigfile, char *tmp_dir, char *outputfile)
 /* bwtool_split - main for the splitting program */
 {
-    struct metaBig *mb = metaBigOpenWithTmpDir(bigfile, tmp_dir, regions);
-    FILE *output = mustOpen(outputfile, "w");
+    struct metaBig *mb = metaBigOpen_cached(bigfile, tmp_dir, regions);
+    FILE *output = mustOpen_tracked(outputfile, "w");
     struct bed *section;
     struct bed *splitList = NULL;
     int size = 0;
@@ -54,9 +56,12 @@ void bwtool_split(struct hash *options, char *regions, char *size_s, char *bigfi
     int gap = 0;
     for (section = mb->sections; section != NULL; section = section->next)
     {
+	unsigned long long prof_start = PROFILE_START();
 	struct perBaseWig *pbwList = perBaseWigLoadContinue(mb, section->chrom, section->chromStart,
 							      section->chromEnd);
 	struct perBaseWig *pbw;
+	PROFILE_STOP(prof_load, prof_start);
+	PROFILE_COUNT(prof_sections, 1);
 	for (pbw = pbwList; pbw != NULL; pbw = pbw->next)
 	{
 	    int length = pbw->chromEnd - pbw->chromStart;
@@ -98,7 +103,7 @@ void bwtool_split(struct hash *options, char *regions, char *size_s, char *bigfi
     {
 	fprintf(output, "%s\t%d\t%d\n", section->chrom, section->chromStart, section->chromEnd);
     }
-    carefulClose(&output);
-    metaBigClose(&mb);
+    carefulClose_tracked(&output);
+    metaBigRelease(&mb);
     bedFreeList(&splitList);
 }
@@ -16,6 +16,8 @@
 #include <beato/stuff.h>
 #include "bwtool.h"
 #include "bwtool_shared.h"
+#include "profile.h"
+#include "memtrack.h"
 
 #define NANUM sqrt(-1)
 
@@ -175,23 +177,44 @@ void bwtool_summary_bed(struct metaBig *mb, unsigned decimals, struct bed *bed_l
 {
     if (total)
     {
-	struct perBaseWig *big_pbw = perBaseWigLoadHuge(mb, bed_list);
-	struct bed *big_bed;
+	unsigned long long prof_start;
+	struct perBaseWig *big_pbw;
+	struct bed *big_bed, *bed;
+	size_t total_bases = 0;
+	for (bed = bed_list; bed != NULL; bed = bed->next)
+	    total_bases += bed->chromEnd - bed->chromStart;
+	memTrackNeed(sizeof(struct perBaseWig) + total_bases * sizeof(double), "putting the regions together for -total");
+	prof_start = PROFILE_START();
+	big_pbw = perBaseWigLoadHuge(mb, bed_list);
+	PROFILE_STOP(prof_load, prof_start);
+	PROFILE_COUNT(prof_sections, 1);
+	memTrackAdd(mem_pbw, perBaseWigListSize(big_pbw));
 	AllocVar(big_bed);
 	big_bed->chrom = cloneString(big_pbw->chrom);
 	big_bed->chromStart = big_pbw->chromStart;
 	big_bed->chromEnd = big_pbw->chromEnd;
+	prof_start = PROFILE_START();
 	summary_loop(big_pbw, decimals, out, big_bed, 3, FALSE, zero_remove, with_quants, with_sos, with_sum, without_med);
+	PROFILE_STOP(prof_stats, prof_start);
 	bedFree(&big_bed);
+	memTrackSub(mem_pbw, perBaseWigListSize(big_pbw));
     }
     else
     {
 	struct bed *section;
 	for (section = bed_list; section != NULL; section = section->next)
 	{
+	    unsigned long long prof_start = PROFILE_START();
 	    struct perBaseWig *pbw = perBaseWigLoadSingleContinue(mb, section->chrom, section->chromStart, section->chromEnd, FALSE, fill);
+	    size_t pbw_size = perBaseWigListSize(pbw);
+	    PROFILE_STOP(prof_load, prof_start);
+	    PROFILE_COUNT(prof_sections, 1);
+	    memTrackAdd(mem_pbw, pbw_size);
+	    prof_start = PROFILE_START();
 	    summary_loop(pbw, decimals, out, section, bed_size, use_rgb, zero_remove, with_quants, with_sos, with_sum, without_med);
+	    PROFILE_STOP(prof_stats, prof_start);
 	    perBaseWigFreeList(&pbw);
+	    memTrackSub(mem_pbw, pbw_size);
 	}
     }
 }
@@ -217,9 +240,10 @@ void bwtool_summary(struct hash *options, char *favorites, char *regions, unsign
 	warn("-keep-bed useless with -total");
     if (mb->type != isaBigWig)
 	errAbort("file not bigWig type");
-    FILE *out = mustOpen(outputfile, "w");
+    FILE *out = mustOpen_tracked(outputfile, "w");
     boolean header = (hashFindVal(options, "header") != NULL) ? TRUE : FALSE;
     struct bed *bed_list = NULL;
+    size_t beds_size;
     boolean use_rgb = FALSE;
     int bed_size = 3;
     if (fileExists(loci_s))
@@ -269,8 +293,11 @@ void bwtool_summary(struct hash *options, char *favorites, char *regions, unsign
 	    fprintf(out, "\tsum");
 	fprintf(out, "\n");
     }
+    beds_size = slCount(bed_list) * sizeof(struct bed);
+    memTrackAdd(mem_beds, beds_size);
     bwtool_summary_bed(mb, decimals, bed_list, bed_size, use_rgb, out, fill, zero_remove, with_quants, with_sos, with_sum, total, without_med);
     bedFreeList(&bed_list);
-    carefulClose(&out);
-    metaBigClose(&mb);
+    memTrackSub(mem_beds, beds_size);
+    carefulClose_tracked(&out);
+    metaBigRelease(&mb);
 }
@@ -0,0 +1,114 @@
+/* bcoldump - paste -binary file -> the same text paste writes by default */
+/*   ** this isn't a full-featured program.  I'ts meant */
+/*   ** just for the test script. */
+
+/* It's run like */
+/*   bcoldump out.bcol out.txt */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <jkweb/common.h>
+#include <jkweb/zlibFace.h>
+
+#include <stdint.h>
+
+/* copied from paste.c */
+const uint64_t BCOL_MAGIC = 0x006c6f6342747742;
+const uint64_t BCOL_VERSION = 1;
+
+struct bcol_header
+{
+    uint64_t magic;
+    uint64_t version;
+    uint64_t num_files;
+    uint64_t num_consts;
+    uint64_t labels_size;
+    uint64_t compressed;
+    uint64_t num_blocks;
+    uint64_t index_offset;
+    uint64_t names_size;
+};
+
+struct bcol_index
+{
+    bits32 name_offset;
+    bits32 start;
+    bits32 end;
+    bits32 reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+int main(int argc, char *argv[])
+/* Process command line. */
+{
+    struct bcol_header header;
+    struct bcol_index *index;
+    double *consts;
+    char *labels, *names;
+    FILE *in, *out;
+    uint64_t b, c;
+    if (argc != 3)
+	errAbort("bad running of bcoldump");
+    in = mustOpen(argv[1], "rb");
+    mustRead(in, &header, sizeof(header));
+    if ((header.magic != BCOL_MAGIC) || (header.version != BCOL_VERSION))
+	errAbort("%s isn't a binary column file", argv[1]);
+    labels = needMem(header.labels_size + 1);
+    AllocArray(consts, header.num_consts + 1);
+    mustRead(in, labels, header.labels_size);
+    mustRead(in, consts, header.num_consts * sizeof(double));
+    AllocArray(index, header.num_blocks + 1);
+    names = needMem(header.names_size + 1);
+    if (fseek(in, header.index_offset, SEEK_SET) != 0)
+	errnoAbort("couldn't seek to the index of %s", argv[1]);
+    mustRead(in, index, header.num_blocks * sizeof(struct bcol_index));
+    mustRead(in, names, header.names_size);
+    out = mustOpen(argv[2], "w");
+    for (b = 0; b < header.num_blocks; b++)
+    {
+	struct bcol_index *ix = &index[b];
+	int len = ix->end - ix->start;
+	size_t size = (size_t)len * header.num_files * sizeof(float);
+	float *vals = needLargeMem(size);
+	int i;
+	if (fseek(in, ix->offset, SEEK_SET) != 0)
+	    errnoAbort("couldn't seek to block %llu of %s", (unsigned long long)b, argv[1]);
+	if (header.compressed)
+	{
+	    char *comp = needLargeMem(ix->size);
+	    mustRead(in, comp, ix->size);
+	    if (zUncompress(comp, ix->size, vals, size) != size)
+		errAbort("block %llu of %s didn't uncompress to its size", (unsigned long long)b, argv[1]);
+	    freeMem(comp);
+	}
+	else
+	    mustRead(in, vals, size);
+	for (i = 0; i < len; i++)
+	{
+	    uint64_t f;
+	    fprintf(out, "%s\t%u\t%u", names + ix->name_offset, ix->start + i, ix->start + i + 1);
+	    for (f = 0; f < header.num_files; f++)
+	    {
+		float val = vals[f * len + i];
+		if (isnan(val))
+		    fprintf(out, "\tNA");
+		else
+		    fprintf(out, "\t%0.2f", val);
+	    }
+	    for (c = 0; c < header.num_consts; c++)
+		fprintf(out, "\t%0.2f", consts[c]);
+	    fprintf(out, "\n");
+	}
+	freeMem(vals);
+    }
+    carefulClose(&out);
+    carefulClose(&in);
+    freeMem(labels);
+    freeMem(consts);
+    freeMem(index);
+    freeMem(names);
+    return 0;
+}
@@ -0,0 +1,109 @@
+#!/bin/bash
+
+# The benchmark script makes genome-scale bigWigs, beds and a chain
+# from a fixed seed with datamake, times bwtool on each workload below
+# with benchrun (wall time, CPU time, peak RSS and bytes read and
+# written, one JSON object per line in the results), and compares the
+# results with the baseline if there is one.  It's run from the tests build directory
+# by "make bench" (or "make bench-baseline" to save the results as the
+# new baseline).  The data is kept between runs and only made again if
+# the settings change.
+#
+# settings, from the environment:
+#   BENCH_GENOME       total bases in the genome (default 100000000)
+#   BENCH_CHROMS       number of chromosomes (default 10)
+#   BENCH_REGIONS      regions in the big bed (default 100000)
+#   BENCH_PASTE_FILES  bigWigs pasted together (default 20)
+#   BENCH_SEED         random seed (default 1)
+#   BENCH_DATA_OPTS    more datamake wig options for the main bigWig, e.g.
+#                      "-density=bedgraph -na=0.3" (see datamake's usage)
+#   BENCH_THREADS      -threads for the commands that take it (default 1)
+#   BENCH_TOLERANCE    fraction over the baseline that counts as a
+#                      regression (default 0.2)
+#   BENCH_DATA         where the data goes (default bench-data)
+#   BENCH_RESULTS      results file (default bench-results.jsonl)
+#   BENCH_BASELINE     baseline file (default $srcdir/bench/baseline.jsonl)
+#   BENCH_ONLY         a regular expression; only run the matching workloads
+
+srcdir=${srcdir:-.}
+genome=${BENCH_GENOME:-100000000}
+chroms=${BENCH_CHROMS:-10}
+num_regions=${BENCH_REGIONS:-100000}
+paste_files=${BENCH_PASTE_FILES:-20}
+seed=${BENCH_SEED:-1}
+threads=${BENCH_THREADS:-1}
+tolerance=${BENCH_TOLERANCE:-0.2}
+data=${BENCH_DATA:-bench-data}
+results=${BENCH_RESULTS:-bench-results.jsonl}
+baseline=${BENCH_BASELINE:-${srcdir}/bench/baseline.jsonl}
+only=${BENCH_ONLY:-.}
+bwtool=`pwd`/../bwtool
+benchrun=`pwd`/benchrun
+results_dir=`dirname $results`
+results=`cd $results_dir && pwd`/`basename $results`
+
+if [ ! -x $bwtool ] || [ ! -x ./datamake ] || [ ! -x $benchrun ]; then
+    echo "build bwtool, datamake and benchrun first"
+    exit 1
+fi
+
+# make the data
+settings="$genome $chroms $num_regions $paste_files $seed $BENCH_DATA_OPTS"
+mkdir -p $data
+if [ "`cat $data/settings 2> /dev/null`" != "$settings" ]; then
+    echo "making benchmark data in $data"
+    rm -f $data/*
+    ./datamake sizes $data/genome.sizes -genome=$genome -chroms=$chroms -seed=$seed || exit 1
+    # dense signal in 10-base steps, with 10% of the genome in gaps
+    ./datamake wig $data/genome.sizes $data/main.bw -seed=$seed $BENCH_DATA_OPTS || exit 1
+    # sparse peaks on the first 2Mb of chr1 for pasting
+    head -n 1 $data/genome.sizes | awk '{ printf("%s\t%d\n", $1, ($2 < 2000000) ? $2 : 2000000) }' > $data/paste.sizes
+    for i in `seq 1 $paste_files`; do
+        ./datamake wig $data/paste.sizes $data/paste$i.bw -density=sparse -peaks=500 -seed=$((seed + i)) || exit 1
+        echo paste$i.bw >> $data/paste.lst
+    done
+    ./datamake bed $data/genome.sizes $data/regions.bed -count=$num_regions -seed=$seed || exit 1
+    head -n 10000 $data/regions.bed > $data/regions10k.bed
+    # a chain per chromosome with ~1kb blocks, about as many as a real liftOver chain
+    ./datamake chain $data/genome.sizes $data/genome.chain $data/new.sizes -seed=$seed || exit 1
+    echo "$settings" > $data/settings
+fi
+
+# run the workloads
+rm -f $results
+run()
+{
+    name=$1
+    shift
+    if echo $name | grep -Eq "$only"; then
+        (cd $data && $benchrun run $name $results "$@") || exit 1
+    fi
+}
+run summary_genome_10k $bwtool summary 10000 main.bw summary.txt
+run summary_regions $bwtool summary regions.bed main.bw summary_regions.txt
+run aggregate $bwtool aggregate 1000:1000 regions.bed main.bw aggregate.txt
+run aggregate_meta $bwtool aggregate 1000:500:1000 regions.bed main.bw aggregate_meta.txt
+run matrix_10k $bwtool matrix 1000:1000 regions10k.bed main.bw matrix.txt -threads=$threads
+run extract_10k $bwtool extract bed regions10k.bed main.bw extract.txt
+run paste_${paste_files} $bwtool paste paste.lst -o=paste.txt
+run paste_consts_${paste_files} $bwtool paste paste.lst -consts-means -skip-NA -o=paste_consts.txt
+run lift_genome $bwtool lift main.bw genome.chain lifted.bw -sizes=new.sizes
+run distribution $bwtool distribution main.bw distribution.txt
+run find_extrema $bwtool find local-extrema main.bw extrema.bed -threads=$threads
+run find_maxima $bwtool find maxima regions.bed main.bw maxima.bed -threads=$threads
+run remove_less $bwtool remove less 5 main.bw removed.bw
+run shift_100 $bwtool shift 100 main.bw shifted.bw
+run chromgraph $bwtool chromgraph main.bw chromgraph.txt
+run sax_chr1 $bwtool sax 8 main.bw:chr1:0-2000000 sax.txt
+run window_chr1 $bwtool window 100 main.bw:chr1:0-2000000 -step=100 -o=window.txt
+rm -f $data/*.txt $data/extrema.bed $data/maxima.bed $data/lifted.bw $data/removed.bw $data/shifted.bw
+
+# compare
+if [ -n "$BENCH_SAVE_BASELINE" ]; then
+    cp $results $baseline
+    echo "saved $baseline"
+elif [ -e $baseline ]; then
+    $benchrun compare $baseline $results $tolerance
+else
+    echo "no baseline to compare with (make one with \"make bench-baseline\")"
+fi
@@ -0,0 +1,217 @@
+/* benchrun - time a command for the benchmarks and compare against a baseline */
+/*   ** this isn't a full-featured program.  It's meant */
+/*   ** just for the benchmark script. */
+
+/* It's run like */
+/*   benchrun run name results.jsonl command args... */
+/*   benchrun compare baseline.jsonl results.jsonl tolerance */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <jkweb/common.h>
+#include <jkweb/hash.h>
+#include <jkweb/linefile.h>
+#include <jkweb/sqlNum.h>
+
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* differences smaller than these are noise, whatever the tolerance */
+#define MIN_SECONDS 0.05
+#define MIN_RSS_KB 1024
+
+struct bench_result
+/* one line of a results file */
+{
+    struct bench_result *next;
+    char *name;
+    int status;
+    double wall;                /* Seconds. */
+    double cpu;                 /* User + system seconds. */
+    long max_rss;               /* Peak resident set in KB. */
+    long long bytes_read;       /* -1 where /proc/pid/io isn't there. */
+    long long bytes_written;
+};
+
+static double now()
+/* seconds on a clock that doesn't jump */
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void read_proc_io(pid_t pid, long long *read, long long *written)
+/* the bytes a finished (but not reaped) process read and wrote.  rchar and wchar count */
+/* everything that went through read() and write(), page cache or not */
+{
+    char name[64];
+    FILE *f;
+    char line[256];
+    *read = *written = -1;
+    safef(name, sizeof(name), "/proc/%d/io", (int)pid);
+    if ((f = fopen(name, "r")) == NULL)
+	return;
+    while (fgets(line, sizeof(line), f))
+    {
+	if (startsWith("rchar:", line))
+	    *read = atoll(line + 6);
+	else if (startsWith("wchar:", line))
+	    *written = atoll(line + 6);
+    }
+    fclose(f);
+}
+
+static void bench_run(char *name, char *results_file, char **command)
+/* run the command, timing it, and add a line for it to the results */
+{
+    struct bench_result res;
+    struct rusage ru;
+    siginfo_t info;
+    int status;
+    double start = now();
+    pid_t pid = fork();
+    FILE *out;
+    ZeroVar(&res);
+    if (pid < 0)
+	errnoAbort("couldn't fork for %s", name);
+    if (pid == 0)
+    {
+	execvp(command[0], command);
+	fprintf(stderr, "couldn't run %s\n", command[0]);
+	_exit(127);
+    }
+    /* wait without reaping so /proc/pid/io is still there to read */
+    if (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) < 0)
+	errnoAbort("waiting on %s", name);
+    res.wall = now() - start;
+    read_proc_io(pid, &res.bytes_read, &res.bytes_written);
+    if (wait4(pid, &status, 0, &ru) < 0)
+	errnoAbort("waiting on %s", name);
+    res.status = (WIFEXITED(status)) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    res.cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    res.max_rss = ru.ru_maxrss;
+    out = mustOpen(results_file, "a");
+    fprintf(out, "{\"name\": \"%s\", \"status\": %d, \"wall_seconds\": %.3f, \"cpu_seconds\": %.3f, "
+	    "\"max_rss_kb\": %ld, \"bytes_read\": %lld, \"bytes_written\": %lld}\n",
+	    name, res.status, res.wall, res.cpu, res.max_rss, res.bytes_read, res.bytes_written);
+    carefulClose(&out);
+    fprintf(stderr, "%-28s %8.2fs wall %8.2fs cpu %8ld KB rss%s\n", name, res.wall, res.cpu, res.max_rss,
+	    (res.status != 0) ? "  FAILED" : "");
+    if (res.status != 0)
+	exit(res.status);
+}
+
+static char *json_field(char *line, char *key)
+/* the text of a field's value in one of our own lines, or NULL.  not a JSON parser, */
+/* just enough for what bench_run() writes */
+{
+    char pattern[64];
+    char *s;
+    safef(pattern, sizeof(pattern), "\"%s\": ", key);
+    if ((s = strstr(line, pattern)) == NULL)
+	return NULL;
+    return s + strlen(pattern);
+}
+
+static struct bench_result *read_results(char *file)
+/* the results in a file, newest (last in the file) first */
+{
+    struct lineFile *lf = lineFileOpen(file, TRUE);
+    struct bench_result *list = NULL;
+    char *line;
+    while (lineFileNextReal(lf, &line))
+    {
+	struct bench_result *res;
+	char *name = json_field(line, "name");
+	char *s;
+	if ((name == NULL) || (*name != '"'))
+	    errAbort("line %d of %s isn't a benchmark result", lf->lineIx, file);
+	name++;
+	if ((s = strchr(name, '"')) == NULL)
+	    errAbort("line %d of %s isn't a benchmark result", lf->lineIx, file);
+	AllocVar(res);
+	res->name = cloneStringZ(name, s - name);
+	res->status = ((s = json_field(line, "status")) != NULL) ? atoi(s) : 0;
+	res->wall = ((s = json_field(line, "wall_seconds")) != NULL) ? atof(s) : 0;
+	res->cpu = ((s = json_field(line, "cpu_seconds")) != NULL) ? atof(s) : 0;
+	res->max_rss = ((s = json_field(line, "max_rss_kb")) != NULL) ? atol(s) : 0;
+	res->bytes_read = ((s = json_field(line, "bytes_read")) != NULL) ? atoll(s) : -1;
+	res->bytes_written = ((s = json_field(line, "bytes_written")) != NULL) ? atoll(s) : -1;
+	slAddHead(&list, res);
+    }
+    lineFileClose(&lf);
+    return list;
+}
+
+static boolean worse(double base, double now, double tolerance, double min_diff)
+/* is now more than tolerance (a fraction) and min_diff over base */
+{
+    return (now > base * (1 + tolerance)) && (now - base > min_diff);
+}
+
+static int bench_compare(char *baseline_file, char *results_file, double tolerance)
+/* print each benchmark next to its baseline and return the number of regressions */
+{
+    struct bench_result *base_list = read_results(baseline_file);
+    struct bench_result *res_list = read_results(results_file);
+    struct bench_result *res;
+    struct hash *base_hash = hashNew(8);
+    int regressions = 0;
+    /* the last run of each name in the baseline is the one compared against */
+    for (res = base_list; res != NULL; res = res->next)
+	if (!hashLookup(base_hash, res->name))
+	    hashAdd(base_hash, res->name, res);
+    slReverse(&res_list);
+    printf("%-28s %10s %10s %10s %10s %12s %12s\n", "benchmark", "wall", "base", "cpu", "base", "rss KB",
+	   "base");
+    for (res = res_list; res != NULL; res = res->next)
+    {
+	struct bench_result *base = (struct bench_result *)hashFindVal(base_hash, res->name);
+	char flags[128];
+	flags[0] = '\0';
+	if (base == NULL)
+	{
+	    printf("%-28s %10.2f %10s %10.2f %10s %12ld %12s  (no baseline)\n", res->name, res->wall, "-",
+		   res->cpu, "-", res->max_rss, "-");
+	    continue;
+	}
+	if (res->status != 0)
+	    safecat(flags, sizeof(flags), " FAILED");
+	if (worse(base->wall, res->wall, tolerance, MIN_SECONDS))
+	    safecat(flags, sizeof(flags), " WALL");
+	if (worse(base->cpu, res->cpu, tolerance, MIN_SECONDS))
+	    safecat(flags, sizeof(flags), " CPU");
+	if (worse(base->max_rss, res->max_rss, tolerance, MIN_RSS_KB))
+	    safecat(flags, sizeof(flags), " RSS");
+	if ((base->bytes_read >= 0) && (res->bytes_read >= 0) &&
+	    worse(base->bytes_read, res->bytes_read, tolerance, 1024 * 1024))
+	    safecat(flags, sizeof(flags), " READ");
+	if (flags[0] != '\0')
+	    regressions++;
+	printf("%-28s %10.2f %10.2f %10.2f %10.2f %12ld %12ld %s\n", res->name, res->wall, base->wall,
+	       res->cpu, base->cpu, res->max_rss, base->max_rss, (flags[0]) ? flags + 1 : "");
+    }
+    if (regressions > 0)
+	printf("%d benchmark%s regressed by more than %.0f%%\n", regressions, (regressions > 1) ? "s" : "",
+	       tolerance * 100);
+    hashFree(&base_hash);
+    return regressions;
+}
+
+int main(int argc, char *argv[])
+/* Process command line. */
+{
+    if ((argc >= 5) && sameString(argv[1], "run"))
+	bench_run(argv[2], argv[3], argv + 4);
+    else if ((argc == 5) && sameString(argv[1], "compare"))
+	return (bench_compare(argv[2], argv[3], sqlDouble(argv[4])) > 0) ? 1 : 0;
+    else
+	errAbort("bad running of benchrun");
+    return 0;
+}
@@ -0,0 +1,549 @@
+/* datamake - make reproducible synthetic data for tests and benchmarks */
+/*   ** this isn't a full-featured program.  It's meant */
+/*   ** for the test and benchmark scripts. */
+
+/* It's run like */
+/*   datamake sizes out.sizes [-genome=bases] [-chroms=n] */
+/*   datamake wig genome.sizes out.bw|out.wig [wig options] */
+/*   datamake bed genome.sizes out.bed [bed options] */
+/*   datamake chain genome.sizes out.chain new.sizes [chain options] */
+/* with the options in usage() below.  The same seed (-seed=n, default 1) and */
+/* options always give the same output, on any machine. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <jkweb/common.h>
+#include <jkweb/hash.h>
+#include <jkweb/options.h>
+#include <jkweb/linefile.h>
+#include <jkweb/sqlNum.h>
+#include <jkweb/localmem.h>
+#include <jkweb/bigWig.h>
+#include <jkweb/bwgInternal.h>
+
+#include <math.h>
+#include <stdint.h>
+
+void usage()
+/* Explain usage and exit. */
+{
+errAbort(
+  "datamake - make reproducible synthetic data for tests and benchmarks\n"
+  "usage:\n"
+  "   datamake sizes out.sizes\n"
+  "   datamake wig genome.sizes out.bw      (or out.wig for just the wig text)\n"
+  "   datamake bed genome.sizes out.bed\n"
+  "   datamake chain genome.sizes out.chain new.sizes\n"
+  "options:\n"
+  "   -seed=n             random seed (default 1)\n"
+  "sizes options:\n"
+  "   -genome=bases       total size of the genome (default 100000000)\n"
+  "   -chroms=n           number of chromosomes, sized like a real genome's\n"
+  "                       from biggest to smallest (default 10)\n"
+  "wig options:\n"
+  "   -density=d          one of:\n"
+  "                         dense     a value every -span bases (fixedStep)\n"
+  "                         bedgraph  piecewise-constant runs averaging -run bases\n"
+  "                         sparse    peaks -peak-width wide, -peaks per Mb\n"
+  "                       (default dense)\n"
+  "   -span=n             bases per value for dense (default 10)\n"
+  "   -run=n              average run length for bedgraph (default 500)\n"
+  "   -peaks=n            peaks per Mb for sparse (default 20)\n"
+  "   -peak-width=n       peak width for sparse (default 200)\n"
+  "   -dist=d             values are normal, uniform, exponential or counts\n"
+  "                       (default normal)\n"
+  "   -mean=m             mean of the values (default 10)\n"
+  "   -sd=s               standard deviation for normal, half-width for\n"
+  "                       uniform (default 2)\n"
+  "   -na=f               fraction of the genome with no data, in gaps\n"
+  "                       averaging -gap bases (default 0.1; sparse ignores it)\n"
+  "   -gap=n              average gap length (default 20000)\n"
+  "   -decimals=n         decimals written (default 2)\n"
+  "bed options:\n"
+  "   -count=n            number of regions (default 10000)\n"
+  "   -min-size=n         smallest region (default 500)\n"
+  "   -max-size=n         biggest region (default 5000)\n"
+  "   -unsorted           leave the regions in the order they're made\n"
+  "chain options:\n"
+  "   -block=n            average aligned block size (default 1000), which\n"
+  "                       gives about as many blocks as a real liftOver chain\n"
+  "   -indel=n            biggest gap on either side between blocks (default 50)\n"
+  );
+}
+
+/* random numbers: splitmix64, so the same seed gives the same data everywhere */
+
+static uint64_t rng_state;
+
+static void rng_seed(uint64_t seed)
+/* start the sequence over */
+{
+    rng_state = seed * 0x9E3779B97F4A7C15ULL + 0x632BE59BD9B4E019ULL;
+}
+
+static uint64_t rng_next()
+/* the next 64 random bits */
+{
+    uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double rng_unit()
+/* uniform on [0,1) */
+{
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static long rng_range(long lo, long hi)
+/* uniform on [lo,hi] */
+{
+    if (hi <= lo)
+	return lo;
+    return lo + (long)(rng_next() % (uint64_t)(hi - lo + 1));
+}
+
+static double rng_normal()
+/* standard normal, by Box-Muller */
+{
+    double u = 1.0 - rng_unit();
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * rng_unit());
+}
+
+static long rng_exp_length(double mean)
+/* an exponentially distributed length of at least 1 */
+{
+    long len = (long)(-mean * log(1.0 - rng_unit()));
+    return (len < 1) ? 1 : len;
+}
+
+enum value_dist
+/* what -dist can be */
+{
+    dist_normal,
+    dist_uniform,
+    dist_exponential,
+    dist_counts,
+};
+
+struct value_gen
+/* how values are drawn */
+{
+    enum value_dist dist;
+    double mean;
+    double sd;
+};
+
+static double random_value(struct value_gen *vg)
+/* one value */
+{
+    switch (vg->dist)
+    {
+    case dist_uniform:
+	return vg->mean + vg->sd * (2 * rng_unit() - 1);
+    case dist_exponential:
+	return -vg->mean * log(1.0 - rng_unit());
+    case dist_counts:
+    {
+	/* Poisson, by counting exponential arrivals (normal approximation when big) */
+	double t = 0;
+	int k = 0;
+	if (vg->mean > 50)
+	{
+	    double v = floor(vg->mean + sqrt(vg->mean) * rng_normal() + 0.5);
+	    return (v < 0) ? 0 : v;
+	}
+	while ((t -= log(1.0 - rng_unit())) < vg->mean)
+	    k++;
+	return k;
+    }
+    default:
+	return vg->mean + vg->sd * rng_normal();
+    }
+}
+
+struct chrom_size
+/* one line of the sizes file */
+{
+    struct chrom_size *next;
+    char *name;
+    long size;
+    int ix;                     /* Order in the file. */
+};
+
+static struct chrom_size *read_sizes(char *file, long *pTotal)
+/* the chromosomes in file order, and their total */
+{
+    struct lineFile *lf = lineFileOpen(file, TRUE);
+    struct chrom_size *list = NULL;
+    char *words[2];
+    long total = 0;
+    int ix = 0;
+    while (lineFileRowTab(lf, words))
+    {
+	struct chrom_size *cs;
+	AllocVar(cs);
+	cs->name = cloneString(words[0]);
+	cs->size = sqlLongLong(words[1]);
+	cs->ix = ix++;
+	total += cs->size;
+	slAddHead(&list, cs);
+    }
+    lineFileClose(&lf);
+    slReverse(&list);
+    if (list == NULL)
+	errAbort("%s has no chromosomes", file);
+    if (pTotal)
+	*pTotal = total;
+    return list;
+}
+
+static struct hash *size_hash(struct chrom_size *list)
+/* chromosome sizes by name, the way writeBw() wants them */
+{
+    struct hash *hash = hashNew(10);
+    struct chrom_size *cs;
+    for (cs = list; cs != NULL; cs = cs->next)
+	hashAddInt(hash, cs->name, (int)cs->size);
+    return hash;
+}
+
+void writeBw(char *inName, char *outName, struct hash *chromSizeHash)
+/* copied from bwtool_shared.c */
+{
+    struct lm *lm = lmInit(0);
+    struct bwgSection *sectionList = bwgParseWig(inName, TRUE, chromSizeHash, 1024, lm);
+    if (sectionList == NULL)
+	errAbort("%s is empty of data", inName);
+    bwgCreate(sectionList, chromSizeHash, 256, 1024, TRUE, outName);
+    lmCleanup(&lm);
+}
+
+static void make_sizes(struct hash *options, char *out_file)
+/* chromosome sizes going down like a real genome's: chrom i of n gets (n+1-i) shares */
+{
+    long genome = sqlLongLong((char *)hashOptionalVal(options, "genome", "100000000"));
+    int chroms = (int)sqlUnsigned((char *)hashOptionalVal(options, "chroms", "10"));
+    double shares = (double)chroms * (chroms + 1) / 2;
+    FILE *out;
+    int i;
+    if (chroms < 1)
+	errAbort("-chroms should be at least 1");
+    out = mustOpen(out_file, "w");
+    for (i = 1; i <= chroms; i++)
+    {
+	long size = (long)(genome * (chroms + 1 - i) / shares);
+	if (size > INT32_MAX)
+	    errAbort("chr%d would be %ld bases, more than a bigWig can hold.  use more -chroms", i, size);
+	fprintf(out, "chr%d\t%ld\n", i, size);
+    }
+    carefulClose(&out);
+}
+
+enum density
+/* what -density can be */
+{
+    dense,
+    bedgraph,
+    sparse,
+};
+
+struct wig_params
+/* the wig options */
+{
+    enum density density;
+    struct value_gen vg;
+    int span;
+    double run;
+    double peaks_per_mb;
+    int peak_width;
+    double na;
+    double gap;
+    int decimals;
+};
+
+static void write_dense(FILE *out, struct chrom_size *cs, long start, long end, struct wig_params *wp)
+/* a fixedStep section over [start,end) */
+{
+    long pos;
+    fprintf(out, "fixedStep chrom=%s start=%ld step=%d span=%d\n", cs->name, start + 1, wp->span, wp->span);
+    for (pos = start; pos + wp->span <= end; pos += wp->span)
+	fprintf(out, "%.*f\n", wp->decimals, random_value(&wp->vg));
+}
+
+static void write_bedgraph(FILE *out, struct chrom_size *cs, long start, long end, struct wig_params *wp)
+/* back-to-back constant runs over [start,end) */
+{
+    long pos = start;
+    while (pos < end)
+    {
+	long run_end = pos + rng_exp_length(wp->run);
+	if (run_end > end)
+	    run_end = end;
+	fprintf(out, "%s\t%ld\t%ld\t%.*f\n", cs->name, pos, run_end, wp->decimals, random_value(&wp->vg));
+	pos = run_end;
+    }
+}
+
+static void write_peak(FILE *out, struct chrom_size *cs, long start, struct wig_params *wp)
+/* one triangular peak in 10-base steps, its height drawn from the distribution */
+{
+    double height = fabs(random_value(&wp->vg));
+    int steps = (wp->peak_width + 9) / 10;
+    int i;
+    fprintf(out, "variableStep chrom=%s span=10\n", cs->name);
+    for (i = 0; i < steps; i++)
+    {
+	double frac = 1.0 - fabs((i + 0.5) / steps * 2 - 1);
+	fprintf(out, "%ld\t%.*f\n", start + 10 * i + 1, wp->decimals, height * frac);
+    }
+}
+
+static void write_chrom(FILE *out, struct chrom_size *cs, struct wig_params *wp)
+/* data and gaps along one chromosome */
+{
+    long pos = 0;
+    if (wp->density == sparse)
+    {
+	double mean_spacing = 1e6 / wp->peaks_per_mb;
+	while ((pos += rng_exp_length(mean_spacing)) + wp->peak_width <= cs->size)
+	{
+	    write_peak(out, cs, pos, wp);
+	    pos += wp->peak_width;
+	}
+	return;
+    }
+    /* stretches of data alternate with gaps so about -na of the genome is gaps */
+    double mean_data = (wp->na > 0) ? wp->gap * (1 - wp->na) / wp->na : (double)cs->size;
+    boolean in_gap = (rng_unit() < wp->na);
+    while (pos < cs->size)
+    {
+	long len = rng_exp_length((in_gap) ? wp->gap : mean_data);
+	long end = (pos + len < cs->size) ? pos + len : cs->size;
+	if (wp->density == dense)
+	{
+	    /* keep the steps on a grid */
+	    pos -= pos % wp->span;
+	    end -= end % wp->span;
+	}
+	if (!in_gap && (end > pos))
+	{
+	    if (wp->density == dense)
+		write_dense(out, cs, pos, end, wp);
+	    else
+		write_bedgraph(out, cs, pos, end, wp);
+	}
+	pos = (end > pos) ? end : pos + len;
+	in_gap = !in_gap;
+    }
+}
+
+static void make_wig(struct hash *options, char *sizes_file, char *out_file)
+/* a wig over the genome, turned into a bigWig unless out_file ends in .wig */
+{
+    struct wig_params wp;
+    char *density = (char *)hashOptionalVal(options, "density", "dense");
+    char *dist = (char *)hashOptionalVal(options, "dist", "normal");
+    struct chrom_size *sizes = read_sizes(sizes_file, NULL);
+    struct chrom_size *cs;
+    boolean just_wig = endsWith(out_file, ".wig");
+    char wig_file[PATH_LEN];
+    FILE *out;
+    ZeroVar(&wp);
+    if (sameString(density, "dense"))
+	wp.density = dense;
+    else if (sameString(density, "bedgraph"))
+	wp.density = bedgraph;
+    else if (sameString(density, "sparse"))
+	wp.density = sparse;
+    else
+	errAbort("-density should be dense, bedgraph or sparse");
+    if (sameString(dist, "normal"))
+	wp.vg.dist = dist_normal;
+    else if (sameString(dist, "uniform"))
+	wp.vg.dist = dist_uniform;
+    else if (sameString(dist, "exponential"))
+	wp.vg.dist = dist_exponential;
+    else if (sameString(dist, "counts"))
+	wp.vg.dist = dist_counts;
+    else
+	errAbort("-dist should be normal, uniform, exponential or counts");
+    wp.vg.mean = sqlDouble((char *)hashOptionalVal(options, "mean", "10"));
+    wp.vg.sd = sqlDouble((char *)hashOptionalVal(options, "sd", "2"));
+    wp.span = (int)sqlUnsigned((char *)hashOptionalVal(options, "span", "10"));
+    wp.run = sqlDouble((char *)hashOptionalVal(options, "run", "500"));
+    wp.peaks_per_mb = sqlDouble((char *)hashOptionalVal(options, "peaks", "20"));
+    wp.peak_width = (int)sqlUnsigned((char *)hashOptionalVal(options, "peak-width", "200"));
+    wp.na = sqlDouble((char *)hashOptionalVal(options, "na", "0.1"));
+    wp.gap = sqlDouble((char *)hashOptionalVal(options, "gap", "20000"));
+    wp.decimals = (int)sqlUnsigned((char *)hashOptionalVal(options, "decimals", "2"));
+    if ((wp.span < 1) || (wp.run < 1) || (wp.peak_width < 1) || (wp.gap < 1) || (wp.peaks_per_mb <= 0))
+	errAbort("-span, -run, -peaks, -peak-width and -gap should be positive");
+    if ((wp.na < 0) || (wp.na >= 1))
+	errAbort("-na should be at least 0 and less than 1");
+    if (just_wig)
+	safecpy(wig_file, sizeof(wig_file), out_file);
+    else
+	safef(wig_file, sizeof(wig_file), "%s.tmp.wig", out_file);
+    out = mustOpen(wig_file, "w");
+    for (cs = sizes; cs != NULL; cs = cs->next)
+	write_chrom(out, cs, &wp);
+    carefulClose(&out);
+    if (!just_wig)
+    {
+	struct hash *sizeHash = size_hash(sizes);
+	writeBw(wig_file, out_file, sizeHash);
+	hashFree(&sizeHash);
+	remove(wig_file);
+    }
+}
+
+struct gen_region
+/* a bed line */
+{
+    struct chrom_size *chrom;
+    long start;
+    long end;
+    char strand;
+    int id;
+};
+
+static int gen_region_cmp(const void *va, const void *vb)
+/* by chromosome (in sizes order) then start */
+{
+    const struct gen_region *a = (struct gen_region *)va;
+    const struct gen_region *b = (struct gen_region *)vb;
+    if (a->chrom != b->chrom)
+	return a->chrom->ix - b->chrom->ix;
+    if (a->start != b->start)
+	return (a->start < b->start) ? -1 : 1;
+    return a->id - b->id;
+}
+
+static void make_bed(struct hash *options, char *sizes_file, char *out_file)
+/* regions spread over the genome by chromosome size, either strand */
+{
+    int count = (int)sqlUnsigned((char *)hashOptionalVal(options, "count", "10000"));
+    long min_size = sqlLongLong((char *)hashOptionalVal(options, "min-size", "500"));
+    long max_size = sqlLongLong((char *)hashOptionalVal(options, "max-size", "5000"));
+    boolean unsorted = (hashFindVal(options, "unsorted") != NULL) ? TRUE : FALSE;
+    long total;
+    struct chrom_size *sizes = read_sizes(sizes_file, &total);
+    struct gen_region *regions;
+    FILE *out;
+    int i;
+    if ((min_size < 1) || (max_size < min_size))
+	errAbort("-min-size should be at least 1 and no more than -max-size");
+    AllocArray(regions, count);
+    for (i = 0; i < count; i++)
+    {
+	struct gen_region *reg = &regions[i];
+	long pos = rng_range(0, total - 1);
+	long width = rng_range(min_size, max_size);
+	for (reg->chrom = sizes; pos >= reg->chrom->size; reg->chrom = reg->chrom->next)
+	    pos -= reg->chrom->size;
+	if (width > reg->chrom->size)
+	    width = reg->chrom->size;
+	if (pos + width > reg->chrom->size)
+	    pos = reg->chrom->size - width;
+	reg->start = pos;
+	reg->end = pos + width;
+	reg->strand = (rng_unit() < 0.5) ? '+' : '-';
+	reg->id = i + 1;
+    }
+    if (!unsorted)
+	qsort(regions, count, sizeof(regions[0]), gen_region_cmp);
+    out = mustOpen(out_file, "w");
+    for (i = 0; i < count; i++)
+	fprintf(out, "%s\t%ld\t%ld\tr%d\t0\t%c\n", regions[i].chrom->name, regions[i].start, regions[i].end,
+		regions[i].id, regions[i].strand);
+    carefulClose(&out);
+    freeMem(regions);
+}
+
+static void make_chain(struct hash *options, char *sizes_file, char *out_file, char *new_sizes_file)
+/* a chain per chromosome onto a slightly different version of itself: blocks */
+/* around -block long, separated by small insertions and deletions.  the sizes of */
+/* the new chromosomes go in new_sizes_file */
+{
+    long block = sqlLongLong((char *)hashOptionalVal(options, "block", "1000"));
+    int indel = (int)sqlUnsigned((char *)hashOptionalVal(options, "indel", "50"));
+    struct chrom_size *sizes = read_sizes(sizes_file, NULL);
+    struct chrom_size *cs;
+    FILE *out, *new_sizes;
+    int id = 1;
+    if (block < 10)
+	errAbort("-block should be at least 10");
+    out = mustOpen(out_file, "w");
+    new_sizes = mustOpen(new_sizes_file, "w");
+    for (cs = sizes; cs != NULL; cs = cs->next)
+    {
+	long *blocks = NULL, *dts = NULL, *dqs = NULL;
+	long t = 0, q = 0;
+	int n = 0, alloc = 0;
+	int i;
+	for (;;)
+	{
+	    long len = rng_range(block / 5, block * 9 / 5);
+	    long dt = rng_range(0, indel), dq = rng_range(0, indel);
+	    if (t + len > cs->size)
+		break;
+	    if (n == alloc)
+	    {
+		int new_alloc = (alloc > 0) ? 2 * alloc : 1024;
+		ExpandArray(blocks, alloc, new_alloc);
+		ExpandArray(dts, alloc, new_alloc);
+		ExpandArray(dqs, alloc, new_alloc);
+		alloc = new_alloc;
+	    }
+	    blocks[n] = len;
+	    t += len;
+	    q += len;
+	    n++;
+	    if (dt + dq == 0)
+		dt = 1;
+	    /* stop with a block, so there's room for a whole one after any gap */
+	    if (t + dt + block * 9 / 5 > cs->size)
+		break;
+	    dts[n-1] = dt;
+	    dqs[n-1] = dq;
+	    t += dt;
+	    q += dq;
+	}
+	if (n > 0)
+	{
+	    fprintf(out, "chain 1000 %s %ld + 0 %ld %s %ld + 0 %ld %d\n", cs->name, cs->size, t, cs->name, q, q, id++);
+	    for (i = 0; i < n - 1; i++)
+		fprintf(out, "%ld\t%ld\t%ld\n", blocks[i], dts[i], dqs[i]);
+	    fprintf(out, "%ld\n\n", blocks[n-1]);
+	    fprintf(new_sizes, "%s\t%ld\n", cs->name, q);
+	}
+	freeMem(blocks);
+	freeMem(dts);
+	freeMem(dqs);
+    }
+    carefulClose(&new_sizes);
+    carefulClose(&out);
+}
+
+int main(int argc, char *argv[])
+/* Process command line. */
+{
+    struct hash *options = optionParseIntoHashExceptNumbers(&argc, argv, FALSE);
+    rng_seed(sqlUnsignedLong((char *)hashOptionalVal(options, "seed", "1")));
+    if ((argc == 3) && sameString(argv[1], "sizes"))
+	make_sizes(options, argv[2]);
+    else if ((argc == 4) && sameString(argv[1], "wig"))
+	make_wig(options, argv[2], argv[3]);
+    else if ((argc == 4) && sameString(argv[1], "bed"))
+	make_bed(options, argv[2], argv[3]);
+    else if ((argc == 5) && sameString(argv[1], "chain"))
+	make_chain(options, argv[2], argv[3], argv[4]);
+    else
+	usage();
+    hashFree(&options);
+    return 0;
+}
@@ -0,0 +1,63 @@
+# a stand-in web server for the remote tests: serves the files in a directory like a
+# real one would to udc, answering byte-range requests with 206 and Content-Range,
+# and logs each request as "method path range status" to a file
+import http.server
+import os
+import re
+import sys
+
+
+class RangeHandler(http.server.BaseHTTPRequestHandler):
+    def send_file(self, with_body):
+        path = os.path.join(self.server.root, self.path.lstrip("/"))
+        if not os.path.isfile(path):
+            self.log_request_line("-", 404)
+            self.send_error(404)
+            return
+        size = os.path.getsize(path)
+        start, end = 0, size - 1
+        status = 200
+        asked = self.headers.get("Range")
+        if asked:
+            m = re.match(r"bytes=(\d+)-(\d*)$", asked)
+            if not m or int(m.group(1)) >= size:
+                self.log_request_line(asked, 416)
+                self.send_error(416)
+                return
+            start = int(m.group(1))
+            if m.group(2):
+                end = min(int(m.group(2)), size - 1)
+            status = 206
+        self.log_request_line(asked or "-", status)
+        self.send_response(status)
+        self.send_header("Content-Length", str(end - start + 1))
+        self.send_header("Last-Modified", self.date_time_string(int(os.path.getmtime(path))))
+        self.send_header("Accept-Ranges", "bytes")
+        if status == 206:
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, size))
+        self.end_headers()
+        if with_body:
+            with open(path, "rb") as f:
+                f.seek(start)
+                self.wfile.write(f.read(end - start + 1))
+
+    def do_HEAD(self):
+        self.send_file(False)
+
+    def do_GET(self):
+        self.send_file(True)
+
+    def log_request_line(self, asked, status):
+        with open(self.server.log, "a") as f:
+            f.write("%s %s %s %d\n" % (self.command, self.path, asked, status))
+
+    def log_message(self, format, *args):
+        pass
+
+
+if __name__ == "__main__":
+    root, port, log = sys.argv[1], int(sys.argv[2]), sys.argv[3]
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", port), RangeHandler)
+    server.root = root
+    server.log = log
+    server.serve_forever()
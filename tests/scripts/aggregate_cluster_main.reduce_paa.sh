@@ -0,0 +1,10 @@
+#!/bin/bash
+
+name=aggregate_cluster_main.reduce_paa
+./core-test.sh $name \
+  answers/${name}.txt \
+  tested.txt \
+  0 0 0 \
+  wigs/main.wig \
+  ../../bwtool agg 3:3 ../beds/cluster_main.bed main.bw tested.txt -cluster=3 -seed=7 -cluster-reduce=paa:3
+exit $?
@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# with -keep-going, the commands after failed ones still run and get the usual
+# answer, and the batch as a whole still fails
+name=batch_summary_main_every3
+if [ ! -e answers/${name}.txt ]; then
+    exit 77
+fi
+tmpdir=`mktemp -d ${name}.XXXX`
+./bwmake wigs/main.sizes wigs/main.wig $tmpdir/main.bw
+cd $tmpdir
+if ../../bwtool batch ../misc/summary_every3_after_errors.jobs -keep-going 2> errors.txt; then
+    echo "the batch didn't fail"
+    cd ../
+    rm -rf $tmpdir
+    exit 1
+fi
+failures=`grep -c "failed: summary no_such.bed" errors.txt`
+if [ ! -e tested.txt ] || [ "$failures" -ne 2 ]; then
+    cd ../
+    rm -rf $tmpdir
+    exit 2
+fi
+cd ../
+difference=`diff answers/${name}.txt $tmpdir/tested.txt | wc -l`
+if [ "$difference" -gt 0 ]; then
+    echo "results don't match correct answer"
+    mkdir -p fails
+    cp $tmpdir/tested.txt fails/${name}-keep-going-tested.txt
+    rm -rf $tmpdir
+    exit 1
+fi
+rm -rf $tmpdir
+exit 0
@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# two workers: each command's stdout is spooled and copied out in the order of the
+# jobs file, and the commands after a wait see what the ones before it made
+name=batch_summary_main_workers
+if [ ! -e answers/${name}.txt ]; then
+    exit 77
+fi
+tmpdir=`mktemp -d ${name}.XXXX`
+./bwmake wigs/main.sizes wigs/main.wig $tmpdir/main.bw
+cd $tmpdir
+mkdir spool
+if ! ../../bwtool batch ../misc/summary_workers.jobs -workers=2 -tmp-dir=spool > tested.txt; then
+    cd ../
+    rm -rf $tmpdir
+    exit 2
+fi
+if [ -n "`ls spool`" ]; then
+    echo "spooled output was left behind"
+    cd ../
+    rm -rf $tmpdir
+    exit 1
+fi
+cd ../
+difference=`diff answers/${name}.txt $tmpdir/tested.txt | wc -l`
+if [ "$difference" -gt 0 ]; then
+    echo "results don't match correct answer"
+    mkdir -p fails
+    cp $tmpdir/tested.txt fails/${name}-tested.txt
+    rm -rf $tmpdir
+    exit 1
+fi
+rm -rf $tmpdir
+exit 0
@@ -0,0 +1,41 @@
+#!/bin/bash
+
+# two workers without -keep-going: the batch fails, the output of the command before
+# the failed one is still copied out, and the command after the wait never runs
+name=batch_summary_main_every3
+if [ ! -e answers/${name}.txt ]; then
+    exit 77
+fi
+tmpdir=`mktemp -d ${name}.XXXX`
+./bwmake wigs/main.sizes wigs/main.wig $tmpdir/main.bw
+cd $tmpdir
+mkdir spool
+finish() {
+    cd ../
+    rm -rf $tmpdir
+    exit $1
+}
+if ../../bwtool batch ../misc/summary_workers_stop.jobs -workers=2 -tmp-dir=spool > tested.txt 2> errors.txt; then
+    echo "the batch didn't fail"
+    finish 1
+fi
+if [ "`grep -c 'line 4 failed: summary no_such.bed' errors.txt`" -ne 1 ]; then
+    echo "the failed command wasn't reported"
+    finish 1
+fi
+if [ -e shifted.bw ]; then
+    echo "the command after the failure ran"
+    finish 1
+fi
+if [ -n "`ls spool`" ]; then
+    echo "spooled output was left behind"
+    finish 1
+fi
+difference=`diff ../answers/${name}.txt tested.txt | wc -l`
+if [ "$difference" -gt 0 ]; then
+    echo "results don't match correct answer"
+    mkdir -p ../fails
+    cp tested.txt ../fails/${name}-workers-stop-tested.txt
+    finish 1
+fi
+finish 0
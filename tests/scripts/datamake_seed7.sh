@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# the synthetic data generator gives the same data for the same seed
+name=`basename $0 .sh`
+if [ ! -e answers/${name}.txt ]; then
+    exit 77
+fi
+tmpdir=`mktemp -d ${name}.XXXX`
+opts="-seed=7"
+./datamake sizes $tmpdir/g.sizes -genome=60000 -chroms=3 $opts &&
+./datamake wig $tmpdir/g.sizes $tmpdir/dense.wig -span=100 -na=0.2 -gap=5000 $opts &&
+./datamake wig $tmpdir/g.sizes $tmpdir/bedgraph.wig -density=bedgraph -dist=counts -mean=4 -run=2000 $opts &&
+./datamake wig $tmpdir/g.sizes $tmpdir/sparse.wig -density=sparse -dist=exponential -peaks=50 -peak-width=50 $opts &&
+./datamake bed $tmpdir/g.sizes $tmpdir/regions.bed -count=10 -min-size=100 -max-size=1000 $opts &&
+./datamake chain $tmpdir/g.sizes $tmpdir/g.chain $tmpdir/new.sizes -block=5000 $opts
+if [ $? -gt 0 ]; then
+    rm -rf $tmpdir
+    exit 2
+fi
+for f in g.sizes dense.wig bedgraph.wig sparse.wig regions.bed g.chain new.sizes; do
+    echo "# $f"
+    cat $tmpdir/$f
+done > $tmpdir/tested.txt
+difference=`diff answers/${name}.txt $tmpdir/tested.txt | wc -l`
+if [ "$difference" -gt 0 ]; then
+    echo "results don't match correct answer"
+    mkdir -p fails
+    cp $tmpdir/tested.txt fails/${name}-tested.txt
+    rm -rf $tmpdir
+    exit 1
+fi
+rm -rf $tmpdir
+exit 0
@@ -0,0 +1,52 @@
+#!/bin/bash
+
+# extract from a bigWig given as a URL.  the three regions all need the same data
+# block, so -prefetch should get it in one range request before loading, and the
+# stand-in server should only have been asked for byte ranges
+name=extract_main_agg1_remote
+if [ ! -e answers/${name}.bed ]; then
+    exit 77
+fi
+if ! python3 -c "import http.server; http.server.ThreadingHTTPServer" 2> /dev/null; then
+    exit 77
+fi
+tmpdir=`mktemp -d ${name}.XXXX`
+mkdir $tmpdir/web
+./bwmake wigs/main.sizes wigs/main.wig $tmpdir/web/main.bw
+cd $tmpdir
+port=`python3 -c "import socket; s = socket.socket(); s.bind(('127.0.0.1', 0)); print(s.getsockname()[1])"`
+python3 ../misc/range_server.py web $port requests.log 2> /dev/null &
+server=$!
+finish() {
+    kill $server
+    cd ../
+    rm -rf $tmpdir
+    exit $1
+}
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    python3 -c "import urllib.request; urllib.request.urlopen('http://127.0.0.1:$port/main.bw')" 2> /dev/null && break
+    sleep 0.2
+done
+rm -f requests.log
+../../bwtool extract bed ../beds/agg1.bed http://127.0.0.1:$port/main.bw tested.bed \
+    -prefetch=4 -tmp-dir=udc -verbose=2 2> errors.txt || finish 2
+if ! grep -q "^prefetching [0-9]* bytes of http://127.0.0.1:$port/main.bw in 1 ranges over 1 connections" errors.txt; then
+    echo "the regions' data wasn't prefetched in one range request"
+    finish 1
+fi
+if ! grep -q "^GET /main.bw bytes=[0-9]*-[0-9]* 206" requests.log; then
+    echo "nothing was asked for by byte range"
+    finish 1
+fi
+if grep -q "^GET .* 200" requests.log; then
+    echo "a whole file was downloaded"
+    finish 1
+fi
+difference=`diff ../answers/${name}.bed tested.bed | wc -l`
+if [ "$difference" -gt 0 ]; then
+    echo "results don't match correct answer"
+    mkdir -p ../fails
+    cp tested.bed ../fails/${name}-tested.bed
+    finish 1
+fi
+finish 0
@@ -0,0 +1,10 @@
+#!/bin/bash
+
+name=find_max_long
+./core-test.sh $name \
+  answers/${name}.bed \
+  tested.bed \
+  0 0 0 \
+  wigs/long.wig \
+  ../../bwtool find maxima ../beds/${name}.bed long.bw tested.bed -threads=3
+exit $?
@@ -6,5 +6,5 @@ name=`basename $0 .sh`
   bad.txt \
   1 var no \
   wigs/main.wig \
-  ../../bwtool lift main.bw ../misc/to_new_transposon_and_gap.chain lifted.bw -unlifted=bad.txt
+  ../../bwtool lift main.bw ../misc/to_new_transposon_and_gap.chain lifted.bw -unlifted=bad.txt -tmp-dir=.
 exit $?
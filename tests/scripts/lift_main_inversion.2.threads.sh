@@ -0,0 +1,10 @@
+#!/bin/bash
+
+name=lift_main_inversion.2
+./core-test.sh $name \
+  answers/${name}.txt \
+  bad.txt \
+  1 var no \
+  wigs/main.wig \
+  ../../bwtool lift main.bw ../misc/to_new_transposon_and_gap.chain lifted.bw -unlifted=bad.txt -threads=2 -tmp-dir=.
+exit $?
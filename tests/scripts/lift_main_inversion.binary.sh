@@ -0,0 +1,28 @@
+#!/bin/bash
+
+# -unlifted-binary read back with unliftdump is the same as the -unlifted bed
+name=lift_main_inversion.2
+if [ ! -e answers/${name}.txt ]; then
+    exit 77
+fi
+tmpdir=`mktemp -d ${name}.XXXX`
+./bwmake wigs/main.sizes wigs/main.wig $tmpdir/main.bw
+cd $tmpdir
+../../bwtool lift main.bw ../misc/to_new_transposon_and_gap.chain lifted.bw -unlifted=bad.bin -unlifted-binary -tmp-dir=. &&
+../unliftdump bad.bin bad.txt
+if [ $? -gt 0 ]; then
+    cd ../
+    rm -rf $tmpdir
+    exit 2
+fi
+cd ../
+difference=`diff answers/${name}.txt $tmpdir/bad.txt | wc -l`
+if [ "$difference" -gt 0 ]; then
+    echo "results don't match correct answer"
+    mkdir -p fails
+    cp $tmpdir/bad.txt fails/${name}-binary-bad.txt
+    rm -rf $tmpdir
+    exit 1
+fi
+rm -rf $tmpdir
+exit 0
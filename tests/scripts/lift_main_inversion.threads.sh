@@ -0,0 +1,10 @@
+#!/bin/bash
+
+name=lift_main_inversion.1
+./core-test.sh $name \
+  answers/${name}.wig \
+  lifted.bw \
+  1 var no \
+  wigs/main.wig \
+  ../../bwtool lift main.bw ../misc/to_new_transposon_and_gap.chain lifted.bw -threads=2 -tmp-dir=.
+exit $?
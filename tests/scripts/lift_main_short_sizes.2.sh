@@ -0,0 +1,10 @@
+#!/bin/bash
+
+name=`basename $0 .sh`
+./core-test.sh $name \
+  answers/${name}.txt \
+  bad.txt \
+  1 var no \
+  wigs/main.wig \
+  ../../bwtool lift main.bw ../misc/to_new_main.chain lifted.bw -sizes=../misc/new_main_short.sizes -unlifted=bad.txt -tmp-dir=.
+exit $?
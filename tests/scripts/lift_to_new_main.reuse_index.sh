@@ -0,0 +1,28 @@
+#!/bin/bash
+
+# lift twice with the same -tmp-dir.  the first run saves the chain index
+# there and the second maps it instead of parsing the chain again
+
+name=lift_to_new_main
+idx=`mktemp -d ${name}.idx.XXXX`
+idx=`cd $idx && pwd`
+for run in 1 2; do
+    ./core-test.sh $name \
+      answers/${name}.wig \
+      lifted.bw \
+      1 var no \
+      wigs/main.wig \
+      ../../bwtool lift main.bw ../misc/to_new_main.chain lifted.bw -tmp-dir=$idx
+    ret=$?
+    if [ $ret -ne 0 ]; then
+	rm -rf $idx
+	exit $ret
+    fi
+    if ! ls $idx/to_new_main.chain.*.bwtidx > /dev/null 2>&1; then
+	echo "chain index wasn't saved in -tmp-dir"
+	rm -rf $idx
+	exit 1
+    fi
+done
+rm -rf $idx
+exit 0
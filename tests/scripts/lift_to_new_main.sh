@@ -6,5 +6,5 @@ name=`basename $0 .sh`
   lifted.bw \
   1 var no \
   wigs/main.wig \
-  ../../bwtool lift main.bw ../misc/to_new_main.chain lifted.bw
+  ../../bwtool lift main.bw ../misc/to_new_main.chain lifted.bw -tmp-dir=.
 exit $?
@@ -0,0 +1,12 @@
+#!/bin/bash
+
+# up:meta:down rows on the minus strand are labelled from the end of the region to its
+# start, the same as the upstream, meta, and downstream pieces fused together
+name=`basename $0 .sh`
+./core-test.sh $name \
+  answers/${name}.txt \
+  tested.txt \
+  1 var no \
+  wigs/main.wig \
+  ../../bwtool matrix 2:4:2 ../beds/meta_main.bed main.bw tested.txt -keep-bed -decimals=2
+exit $?
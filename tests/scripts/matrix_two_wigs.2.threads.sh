@@ -0,0 +1,10 @@
+#!/bin/bash
+
+name=matrix_two_wigs.2
+./core-test.sh $name \
+  answers/${name}.txt \
+  tested.txt \
+  1 var no \
+  wigs/main.wig wigs/second.wig \
+  ../../bwtool matrix 5:5 ../beds/agg2.bed main.bw,second.bw tested.txt -starts -keep-bed -decimals=1 -threads=2
+exit $?
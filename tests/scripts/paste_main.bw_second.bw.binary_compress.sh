@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# -binary output read back with bcoldump is the same as the text output
+name=paste_main.bw_second.bw.3
+if [ ! -e answers/${name}.txt ]; then
+    exit 77
+fi
+tmpdir=`mktemp -d ${name}.XXXX`
+./bwmake wigs/main.sizes wigs/main.wig $tmpdir/main.bw &&
+./bwmake wigs/second.sizes wigs/second.wig $tmpdir/second.bw
+cd $tmpdir
+../../bwtool paste -skip-NA -consts=3.4,-2.3 -chunk-size=5 -binary-compress main.bw second.bw -binary=tested.bcol &&
+../bcoldump tested.bcol tested.txt
+if [ $? -gt 0 ]; then
+    cd ../
+    rm -rf $tmpdir
+    exit 2
+fi
+cd ../
+difference=`diff answers/${name}.txt $tmpdir/tested.txt | wc -l`
+if [ "$difference" -gt 0 ]; then
+    echo "results don't match correct answer"
+    mkdir -p fails
+    cp $tmpdir/tested.txt fails/${name}-binary_compress-tested.txt
+    rm -rf $tmpdir
+    exit 1
+fi
+rm -rf $tmpdir
+exit 0
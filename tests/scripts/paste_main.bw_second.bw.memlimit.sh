@@ -0,0 +1,10 @@
+#!/bin/bash
+
+name=`basename $0 .sh`
+./core-test.sh $name \
+  answers/paste_main.bw_second.bw.1.txt \
+  tested.txt \
+  0 0 0 \
+  wigs/main.wig wigs/second.wig \
+  ../../bwtool paste main.bw second.bw -o=tested.txt -mem-limit=8K -mem-report
+exit $?
@@ -0,0 +1,19 @@
+#!/bin/bash
+
+name=`basename $0 .sh`
+sock=${TMPDIR:-/tmp}/bwtool-${name}-$$.sock
+../bwtool serve $sock 2> /dev/null &
+server=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S $sock ] && break
+    sleep 0.2
+done
+./core-test.sh $name \
+  answers/${name}.txt \
+  tested.txt \
+  0 0 0 \
+  wigs/main.wig \
+  ../../bwtool summary -server=$sock 3 main.bw tested.txt -header -decimals=1
+ret=$?
+kill $server
+exit $ret
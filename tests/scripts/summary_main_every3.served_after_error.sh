@@ -0,0 +1,54 @@
+#!/bin/bash
+
+# a request that fails part way through (holding main.bw and its output open) shouldn't
+# leave anything behind in the server: the next request still works, and the server
+# has no more files open than before
+name=summary_main_every3.served
+if [ ! -e answers/${name}.txt ]; then
+    exit 77
+fi
+tmpdir=`mktemp -d ${name}.XXXX`
+./bwmake wigs/main.sizes wigs/main.wig $tmpdir/main.bw
+cd $tmpdir
+sock=${TMPDIR:-/tmp}/bwtool-${name}-$$.sock
+../../bwtool serve $sock 2> /dev/null &
+server=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S $sock ] && break
+    sleep 0.2
+done
+open_files() {
+    ls /proc/$server/fd 2> /dev/null | wc -l
+}
+finish() {
+    kill $server
+    cd ../
+    rm -rf $tmpdir
+    exit $1
+}
+if [ "`ls -l $sock | cut -c1-10`" != "srw-------" ]; then
+    echo "the socket can be used by other users"
+    finish 1
+fi
+../../bwtool summary -server=$sock 3 main.bw first.txt -header -decimals=1 || finish 2
+before=`open_files`
+for i in 1 2 3; do
+    if ../../bwtool summary -server=$sock no_such.bed main.bw failed.txt -header 2> /dev/null; then
+	echo "the bad request didn't fail"
+	finish 1
+    fi
+done
+../../bwtool summary -server=$sock 3 main.bw tested.txt -header -decimals=1 || finish 2
+after=`open_files`
+if [ "$after" -gt "$before" ]; then
+    echo "the server went from $before to $after open files after the failed requests"
+    finish 1
+fi
+difference=`diff ../answers/${name}.txt tested.txt | wc -l`
+if [ "$difference" -gt 0 ]; then
+    echo "results don't match correct answer"
+    mkdir -p ../fails
+    cp tested.txt ../fails/${name}-after-error-tested.txt
+    finish 1
+fi
+finish 0
@@ -0,0 +1,96 @@
+/* unliftdump - binary -unlifted file -> the same bed lift writes */
+/*   ** this isn't a full-featured program.  I'ts meant */
+/*   ** just for the test script. */
+
+/* It's run like */
+/*   unliftdump unlifted.bin unlifted.bed */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <jkweb/common.h>
+
+#include <stdint.h>
+
+/* copied from lift.c */
+const uint64_t UNLIFTED_MAGIC = 0x74666c6e55747742;
+const uint64_t UNLIFTED_VERSION = 1;
+
+struct unlifted_header
+{
+    uint64_t magic;
+    uint64_t version;
+    uint64_t num_chroms;
+    uint64_t num_runs;
+    uint64_t names_size;
+};
+
+struct unlifted_chrom
+{
+    bits32 name_offset;
+    bits32 first_run;
+    bits32 num_runs;
+    bits32 reserved;
+};
+
+struct unlifted_record
+{
+    bits32 start;
+    bits32 end;
+    bits32 why;
+    bits32 dest_name_offset;
+    bits32 dest_start;
+    bits32 strand;
+};
+
+static char *reasons[] = {
+    "problem_lifting", "deleted_in_destination", "duplicated_in_destination", NULL,
+    NULL, "destination_chrom_not_in_sizes", "past_end_of_destination_chrom",
+};
+
+int main(int argc, char *argv[])
+/* Process command line. */
+{
+    struct unlifted_header header;
+    struct unlifted_chrom *chroms;
+    struct unlifted_record *records;
+    char *names;
+    FILE *in, *out;
+    uint64_t i, j;
+    if (argc != 3)
+	errAbort("bad running of unliftdump");
+    in = mustOpen(argv[1], "rb");
+    mustRead(in, &header, sizeof(header));
+    if ((header.magic != UNLIFTED_MAGIC) || (header.version != UNLIFTED_VERSION))
+	errAbort("%s isn't a binary unlifted file", argv[1]);
+    AllocArray(chroms, header.num_chroms + 1);
+    AllocArray(records, header.num_runs + 1);
+    names = needMem(header.names_size + 1);
+    mustRead(in, chroms, header.num_chroms * sizeof(struct unlifted_chrom));
+    mustRead(in, records, header.num_runs * sizeof(struct unlifted_record));
+    mustRead(in, names, header.names_size);
+    carefulClose(&in);
+    out = mustOpen(argv[2], "w");
+    for (i = 0; i < header.num_chroms; i++)
+    {
+	struct unlifted_chrom *chrom = &chroms[i];
+	for (j = chrom->first_run; j < chrom->first_run + chrom->num_runs; j++)
+	{
+	    struct unlifted_record *rec = &records[j];
+	    fprintf(out, "%s\t%u\t%u\t", names + chrom->name_offset, rec->start, rec->end);
+	    if (rec->why == 4)
+		fprintf(out, "multi_mapped_%s_%u\t0\t%c\n", names + rec->dest_name_offset, rec->dest_start,
+			(char)rec->strand);
+	    else if ((rec->why < ArraySize(reasons)) && reasons[rec->why])
+		fprintf(out, "%s\t0\t.\n", reasons[rec->why]);
+	    else
+		errAbort("unknown reason %u in %s", rec->why, argv[1]);
+	}
+    }
+    carefulClose(&out);
+    freeMem(chroms);
+    freeMem(records);
+    freeMem(names);
+    return 0;
+}
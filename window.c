@@ -15,6 +15,7 @@
 #include <beato/bigs.h>
 #include "bwtool.h"
 #include "bwtool_shared.h"
+#include "profile.h"
 #include <beato/cluster.h>
 
 void usage_window()
@@ -41,7 +42,7 @@ void bwtool_window(struct hash *options, char *favorites, char *regions, unsigne
                    double fill, char *size_s, char *bigfile, char *tmp_dir, char *output_file)
 /* bwtool_window - main for the windowing program */
 {
-    struct metaBig *mb = metaBigOpenWithTmpDir(bigfile, tmp_dir, regions);
+    struct metaBig *mb = metaBigOpen_cached(bigfile, tmp_dir, regions);
     boolean skip_na = (hashFindVal(options, "skip-NA") != NULL) ? TRUE : FALSE;
     if (!isnan(fill) && skip_na)
 	errAbort("cannot use -skip_na with -fill");
@@ -50,7 +51,7 @@ void bwtool_window(struct hash *options, char *favorites, char *regions, unsigne
     int size = sqlSigned(size_s);
     if (size < 1)
 	errAbort("size must be >= 1 for bwtool window");
-    FILE *out = (output_file) ? mustOpen(output_file, "w") : stdout;
+    FILE *out = (output_file) ? mustOpen_tracked(output_file, "w") : stdout;
     struct bed *section;
     for (section = mb->sections; section != NULL; section = section->next)
     {
@@ -58,9 +59,12 @@ void bwtool_window(struct hash *options, char *favorites, char *regions, unsigne
 	{
 	    /* I think window should be split into to two functions */
 	    /* when skipping NA, perBaseWigLoadContinue should be used */
+	    unsigned long long prof_start = PROFILE_START();
 	    struct perBaseWig *pbw = perBaseWigLoadSingleContinue(mb, section->chrom, section->chromStart,
 								  section->chromEnd, FALSE, fill);
 	    int i, j;
+	    PROFILE_STOP(prof_load, prof_start);
+	    PROFILE_COUNT(prof_sections, 1);
 	    for (i = 0; i <= pbw->len - size; i += step)
 	    {
 		int s = pbw->chromStart + i;
@@ -99,6 +103,6 @@ void bwtool_window(struct hash *options, char *favorites, char *regions, unsigne
 	    perBaseWigFree(&pbw);
 	}
     }
-    metaBigClose(&mb);
-    carefulClose(&out);
+    metaBigRelease(&mb);
+    carefulClose_tracked(&out);
 }